@@ -0,0 +1,257 @@
+// Generator of compiled route tables for HttpServer
+//
+// Reads a route spec (see route_spec.h) and writes:
+//   <prefix>.h   - RouteId enum, RouteParams, table of paths and handlers per method and the
+//                  <NAMESPACE>_HANDLERS(HANDLER) X-macro to bind handlers, e.g. to member pointers
+//   <prefix>.re  - re2c source of two matchers:
+//                  find_route(url)           - literal paths only, like example.re
+//                  match_route(url, params)  - all paths, {param} segments captured with re2c tags
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -o route_gen route_gen.cpp
+//   ./route_gen routes.spec routes [namespace]
+//   re2c -o routes.cpp routes.re
+//
+// HttpServer binding example:
+//
+// #define BIND(route, method, handler) m_handlers[routes::route][routes::method] = &HttpServer::handler;
+// routes::ROUTES_HANDLERS(BIND)
+// ...
+// routes::RouteParams params;
+// routes::RouteId route = routes::match_route(url, params);
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "route_spec.h"
+
+namespace
+{
+std::string upper(std::string text)
+{
+    for (char& c : text)
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    return text;
+}
+
+std::string base_name(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// re2c rule of the route, the params captured between the tags p<2n> and p<2n+1>
+std::string rule(const route_spec::Route& route, bool tags)
+{
+    std::string rule;
+    std::string literal;
+    int param = 0;
+    for (const route_spec::Segment& segment : route.segments)
+    {
+        literal += '/';
+        if (!segment.param)
+        {
+            literal += segment.text;
+            continue;
+        }
+        rule += "\"" + literal + "\" ";
+        literal.clear();
+        if (tags)
+            rule += "@p" + std::to_string(2 * param) + " [^/?\\x00]+ @p" +
+                    std::to_string(2 * param + 1) + " ";
+        else
+            rule += "[^/?\\x00]+ ";
+        param++;
+    }
+    if (route.segments.empty())
+        literal = "/";
+    if (!literal.empty())
+        rule += "\"" + literal + "\" ";
+    // The query string or the end of the URL
+    return rule + "[\\x00?]";
+}
+
+std::string padded(std::string text, size_t width)
+{
+    if (text.size() < width)
+        text.resize(width, ' ');
+    return text + " ";
+}
+
+std::string header(const std::vector<route_spec::Route>& routes, const std::string& spec,
+                   const std::string& ns)
+{
+    size_t max_params = 0;
+    for (const route_spec::Route& route : routes)
+        max_params = std::max(max_params, route.params());
+
+    std::ostringstream out;
+    out << "// Generated by route_gen from " << spec << ", do not edit\n\n"
+        << "#pragma once\n\n#include <cstddef>\n#include <string_view>\n\n"
+        << "namespace " << ns << "\n{\n";
+
+    out << "enum Method\n{\n";
+    for (int n = 0; n < route_spec::methods_count; n++)
+        out << "    " << route_spec::methods[n] << ",\n";
+    out << "    METHODS_COUNT,\n};\n\n";
+
+    out << "enum RouteId\n{\n    ROUTE_NONE = -1,\n";
+    for (const route_spec::Route& route : routes)
+        out << "    ROUTE_" << route.name << ", // " << route.path << "\n";
+    out << "    ROUTES_COUNT,\n};\n\n";
+
+    out << "static const int max_params = " << max_params << ";\n\n"
+        << "// Values of the {param} segments in the order of the path\n"
+        << "struct RouteParams\n{\n"
+        << "    std::string_view values[max_params > 0 ? max_params : 1];\n"
+        << "    int count = 0;\n};\n\n"
+        << "struct Route\n{\n    const char* path;\n"
+        << "    // Handler name for each Method, nullptr if the method is not routed\n"
+        << "    const char* handlers[METHODS_COUNT];\n};\n\n"
+        << "inline constexpr Route table[ROUTES_COUNT] = {\n";
+    for (const route_spec::Route& route : routes)
+    {
+        out << "    {\"" << route.path << "\", {";
+        for (int n = 0; n < route_spec::methods_count; n++)
+        {
+            out << (n ? ", " : "");
+            if (route.handlers[n].empty())
+                out << "nullptr";
+            else
+                out << "\"" << route.handlers[n] << "\"";
+        }
+        out << "}},\n";
+    }
+    out << "};\n\n";
+
+    out << "// HANDLER(route, method, handler) for every routed method\n"
+        << "#define " << upper(ns) << "_HANDLERS(HANDLER)";
+    for (const route_spec::Route& route : routes)
+        for (int n = 0; n < route_spec::methods_count; n++)
+            if (!route.handlers[n].empty())
+                out << " \\\n    HANDLER(ROUTE_" << route.name << ", " << route_spec::methods[n]
+                    << ", " << route.handlers[n] << ")";
+    out << "\n\n";
+
+    out << "// Literal paths only, URLs must be NULL terminated\n"
+        << "RouteId find_route(const char* url);\n"
+        << "// All paths, captures the {param} segments, URLs must be NULL terminated\n"
+        << "RouteId match_route(const char* url, RouteParams& params);\n"
+        << "} // namespace " << ns << "\n";
+    return out.str();
+}
+
+std::string matchers(const std::vector<route_spec::Route>& routes, const std::string& spec,
+                     const std::string& ns, const std::string& header_name)
+{
+    size_t max_params = 0;
+    size_t width = 0;
+    for (const route_spec::Route& route : routes)
+    {
+        max_params = std::max(max_params, route.params());
+        width = std::max(width, rule(route, true).size());
+    }
+
+    std::ostringstream out;
+    out << "// Generated by route_gen from " << spec << ", do not edit\n"
+        << "// re2c -o " << header_name.substr(0, header_name.size() - 2) << ".cpp "
+        << header_name.substr(0, header_name.size() - 2) << ".re\n\n"
+        << "#include \"" << header_name << "\"\n\n"
+        << "namespace " << ns << "\n{\n";
+
+    // Literal paths, like example.re. YYCTYPE is unsigned like in tokenizer.re, so UTF-8 bytes
+    // (>= 0x80) in a param compare above \x00 and fall into the [^/?\x00] classes.
+    out << "// Quick path lookup of the literal paths\n"
+        << "RouteId find_route(const char* YYCURSOR)\n{\n"
+        << "    const char *YYMARKER;\n"
+        << "    /*!re2c\n"
+        << "    re2c:define:YYCTYPE = \"unsigned char\";\n"
+        << "    re2c:yyfill:enable = 0;\n";
+    for (const route_spec::Route& route : routes)
+        if (!route.params())
+            out << "    " << padded(rule(route, false), width) << "{ return ROUTE_" << route.name
+                << "; }\n";
+    out << "    " << padded("*", width) << "{ return ROUTE_NONE; }\n"
+        << "    */\n"
+        << "    return ROUTE_NONE;\n}\n\n";
+
+    // All paths, the tags mark the begin and the end of every param
+    out << "// Path lookup capturing the {param} segments\n"
+        << "RouteId match_route(const char* YYCURSOR, RouteParams& params)\n{\n"
+        << "    const char *YYMARKER;\n";
+    if (max_params)
+    {
+        out << "    const char ";
+        for (size_t n = 0; n < 2 * max_params; n++)
+            out << (n ? ", " : "") << "*p" << n;
+        out << ";\n";
+    }
+    out << "    /*!stags:re2c format = 'const char *@@;\\n'; */\n"
+        << "    /*!re2c\n"
+        << "    re2c:define:YYCTYPE = \"unsigned char\";\n"
+        << "    re2c:yyfill:enable = 0;\n"
+        << "    re2c:flags:tags = 1;\n";
+    for (const route_spec::Route& route : routes)
+    {
+        out << "    " << padded(rule(route, true), width) << "{ ";
+        size_t params = route.params();
+        for (size_t n = 0; n < params; n++)
+            out << "params.values[" << n << "] = std::string_view(p" << 2 * n << ", p"
+                << 2 * n + 1 << " - p" << 2 * n << "); ";
+        out << "params.count = " << params << "; return ROUTE_" << route.name << "; }\n";
+    }
+    out << "    " << padded("*", width) << "{ params.count = 0; return ROUTE_NONE; }\n"
+        << "    */\n"
+        << "    return ROUTE_NONE;\n}\n"
+        << "} // namespace " << ns << "\n";
+    return out.str();
+}
+
+bool write_file(const std::string& path, const std::string& text)
+{
+    std::ofstream out(path);
+    out << text;
+    out.close();
+    if (!out)
+    {
+        std::fprintf(stderr, "route_gen: cannot write %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::fprintf(stderr, "usage: %s <route spec> <output prefix> [namespace]\n", argv[0]);
+        return 2;
+    }
+    std::string spec = argv[1];
+    std::string prefix = argv[2];
+    std::string ns = argc > 3 ? argv[3] : "routes";
+
+    std::vector<route_spec::Route> routes;
+    try
+    {
+        routes = route_spec::load(spec);
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "route_gen: %s: %s\n", spec.c_str(), e.what());
+        return 1;
+    }
+    if (routes.empty())
+    {
+        std::fprintf(stderr, "route_gen: %s: no routes\n", spec.c_str());
+        return 1;
+    }
+
+    std::string header_name = base_name(prefix) + ".h";
+    if (!write_file(prefix + ".h", header(routes, base_name(spec), ns)) ||
+        !write_file(prefix + ".re", matchers(routes, base_name(spec), ns, header_name)))
+        return 1;
+    return 0;
+}
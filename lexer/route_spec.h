@@ -0,0 +1,216 @@
+// Route specification shared by route_gen and router_bench
+//
+// One route per line, '#' starts a comment:
+//
+//     METHOD[,METHOD...]  PATH  HANDLER
+//     GET,HEAD            /users/{id}/posts/{post}  user_post
+//
+// A {param} is a whole path segment. Lines with the same path and different methods form one
+// route. When several routes match a URL the one with a literal segment at the first difference
+// wins, so /users/me is matched before /users/{id}. The query string is not part of the match.
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace route_spec
+{
+static const char* const methods[] = {"GET", "POST", "PUT", "DELETE", "PATCH", "HEAD", "OPTIONS"};
+static const int methods_count = sizeof(methods) / sizeof(methods[0]);
+
+struct Segment
+{
+    std::string text; // literal text or name of the param
+    bool param;
+};
+
+struct Route
+{
+    std::string path;
+    std::vector<Segment> segments;
+    // Handler for each method of methods[], empty if the method is not routed
+    std::string handlers[methods_count];
+    // Identifier made from the path
+    std::string name;
+    int line = 0;
+
+    size_t params() const
+    {
+        return std::count_if(segments.begin(), segments.end(),
+                             [](const Segment& segment) { return segment.param; });
+    }
+
+    // Path with the param names left out, routes of the same shape cannot be told apart
+    std::string shape() const
+    {
+        std::string shape;
+        for (const Segment& segment : segments)
+            shape += segment.param ? "/{}" : "/" + segment.text;
+        return shape.empty() ? "/" : shape;
+    }
+};
+
+namespace detail
+{
+inline std::runtime_error error(int line, const std::string& message)
+{
+    return std::runtime_error("line " + std::to_string(line) + ": " + message);
+}
+
+inline bool is_identifier(const std::string& text)
+{
+    if (text.empty() || std::isdigit(static_cast<unsigned char>(text[0])))
+        return false;
+    return std::all_of(text.begin(), text.end(), [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    });
+}
+
+inline std::vector<Segment> split_path(const std::string& path, int line)
+{
+    if (path.empty() || path[0] != '/')
+        throw error(line, "path must start with '/': " + path);
+
+    std::vector<Segment> segments;
+    if (path == "/")
+        return segments;
+    size_t start = 1;
+    while (start <= path.size())
+    {
+        size_t end = std::min(path.find('/', start), path.size());
+        std::string text = path.substr(start, end - start);
+        if (text.empty())
+            throw error(line, "empty segment in " + path);
+        if (text.front() == '{' && text.back() == '}')
+        {
+            std::string name = text.substr(1, text.size() - 2);
+            if (!is_identifier(name))
+                throw error(line, "bad param name {" + name + "}");
+            segments.push_back({name, true});
+        }
+        else
+        {
+            for (char c : text)
+                if (c == '{' || c == '}' || c == '?' || c == '"' || c == '\\' ||
+                    !std::isgraph(static_cast<unsigned char>(c)))
+                    throw error(line, "bad character in segment " + text);
+            segments.push_back({text, false});
+        }
+        start = end + 1;
+    }
+    return segments;
+}
+
+inline std::string make_name(const Route& route)
+{
+    std::string name;
+    for (const Segment& segment : route.segments)
+    {
+        if (!name.empty())
+            name += '_';
+        for (char c : segment.text)
+            name += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    }
+    return name.empty() ? "root" : name;
+}
+} // namespace detail
+
+// Literal segment before param at the first difference, shorter route first
+inline bool more_specific(const Route& a, const Route& b)
+{
+    size_t count = std::min(a.segments.size(), b.segments.size());
+    for (size_t n = 0; n < count; n++)
+    {
+        const Segment& left = a.segments[n];
+        const Segment& right = b.segments[n];
+        if (left.param != right.param)
+            return !left.param;
+        if (!left.param && left.text != right.text)
+            return left.text < right.text;
+    }
+    return a.segments.size() < b.segments.size();
+}
+
+// Routes sorted by more_specific(), throws std::runtime_error with the line of a bad spec
+inline std::vector<Route> parse(std::istream& in)
+{
+    std::vector<Route> routes;
+    std::string text;
+    for (int line = 1; std::getline(in, text); line++)
+    {
+        text = text.substr(0, text.find('#'));
+        std::istringstream fields(text);
+        std::string method_list, path, handler, extra;
+        if (!(fields >> method_list))
+            continue;
+        if (!(fields >> path >> handler) || (fields >> extra))
+            throw detail::error(line, "expected METHOD[,METHOD...] PATH HANDLER");
+        if (!detail::is_identifier(handler))
+            throw detail::error(line, "bad handler name " + handler);
+
+        Route route;
+        route.path = path;
+        route.line = line;
+        route.segments = detail::split_path(path, line);
+
+        auto same = std::find_if(routes.begin(), routes.end(), [&route](const Route& other) {
+            return other.shape() == route.shape();
+        });
+        if (same != routes.end() && same->path != path)
+            throw detail::error(line, path + " conflicts with " + same->path + " of line " +
+                                          std::to_string(same->line));
+        Route& target = same != routes.end() ? *same : route;
+
+        std::istringstream list(method_list);
+        std::string method;
+        while (std::getline(list, method, ','))
+        {
+            auto found = std::find(methods, methods + methods_count, method);
+            if (found == methods + methods_count)
+                throw detail::error(line, "unknown method " + method);
+            std::string& slot = target.handlers[found - methods];
+            if (!slot.empty())
+                throw detail::error(line, method + " " + path + " routed twice");
+            slot = handler;
+        }
+        if (same == routes.end())
+            routes.push_back(std::move(route));
+    }
+
+    std::stable_sort(routes.begin(), routes.end(), more_specific);
+    // Unique identifiers, two paths may differ only in punctuation
+    for (size_t n = 0; n < routes.size(); n++)
+    {
+        std::string name = detail::make_name(routes[n]);
+        std::string unique = name;
+        for (int suffix = 2; std::any_of(routes.begin(), routes.begin() + n,
+                                         [&unique](const Route& r) { return r.name == unique; });
+             suffix++)
+            unique = name + "_" + std::to_string(suffix);
+        routes[n].name = unique;
+    }
+    return routes;
+}
+
+inline std::vector<Route> load(const std::string& file)
+{
+    std::ifstream in(file);
+    if (!in)
+        throw std::runtime_error("cannot open " + file);
+    return parse(in);
+}
+
+// Path part of the URL, without the query string
+inline std::string_view url_path(std::string_view url)
+{
+    return url.substr(0, url.find('?'));
+}
+} // namespace route_spec
@@ -0,0 +1,387 @@
+// Router benchmark over a realistic URL mix
+//
+// Generates URLs from a route spec (see route_spec.h): hot routes are requested more often, the
+// {param} segments get numeric ids, slugs (some in raw UTF-8) and file names, some URLs carry a
+// query string and some match no route. Compares, in ns per lookup:
+//   map   - std::unordered_map of the literal paths, then a scan of the routes with params
+//   trie  - radix trie, literal edges before param edges with backtracking
+//   re2c  - match_route() generated by route_gen and re2c, only with -DROUTER_BENCH_RE2C
+// All routers must agree on every URL before they are timed.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -o router_bench router_bench.cpp
+//   ./router_bench [routes.spec] [urls]
+//
+// With the re2c router:
+//   ./route_gen routes.spec routes && re2c -o routes.cpp routes.re
+//   g++ -std=c++17 -O2 -DROUTER_BENCH_RE2C -o router_bench router_bench.cpp routes.cpp
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "route_spec.h"
+
+#ifdef ROUTER_BENCH_RE2C
+#include "routes.h"
+#endif
+
+static const int max_params = 8;
+
+struct Params
+{
+    std::string_view values[max_params];
+    int count = 0;
+};
+
+// Match the segments of the path against the route, fills params
+static bool match_segments(const route_spec::Route& route, std::string_view path, Params& params)
+{
+    params.count = 0;
+    if (route.segments.empty())
+        return path == "/";
+    size_t position = 0;
+    for (const route_spec::Segment& segment : route.segments)
+    {
+        if (position >= path.size() || path[position] != '/')
+            return false;
+        position++;
+        size_t end = std::min(path.find('/', position), path.size());
+        std::string_view text = path.substr(position, end - position);
+        if (segment.param)
+        {
+            if (text.empty() || params.count == max_params)
+                return false;
+            params.values[params.count++] = text;
+        }
+        else if (text != segment.text)
+            return false;
+        position = end;
+    }
+    return position == path.size();
+}
+
+class MapRouter
+{
+  public:
+    explicit MapRouter(const std::vector<route_spec::Route>& routes) : m_routes(routes)
+    {
+        for (size_t n = 0; n < routes.size(); n++)
+            if (routes[n].params())
+                m_param_routes.push_back(static_cast<int>(n));
+            else
+                m_literal[routes[n].path] = static_cast<int>(n);
+    }
+
+    int match(const char* url, Params& params) const
+    {
+        std::string_view path = route_spec::url_path(url);
+        params.count = 0;
+        auto found = m_literal.find(path);
+        if (found != m_literal.end())
+            return found->second;
+        for (int route : m_param_routes)
+            if (match_segments(m_routes[route], path, params))
+                return route;
+        params.count = 0;
+        return -1;
+    }
+
+  private:
+    const std::vector<route_spec::Route>& m_routes;
+    std::unordered_map<std::string_view, int> m_literal;
+    std::vector<int> m_param_routes;
+};
+
+// Radix trie on the characters of the literal parts, a param is an edge of its own
+class TrieRouter
+{
+  public:
+    explicit TrieRouter(const std::vector<route_spec::Route>& routes) : m_root(new Node)
+    {
+        for (size_t n = 0; n < routes.size(); n++)
+        {
+            Node* node = m_root.get();
+            std::string literal;
+            for (const route_spec::Segment& segment : routes[n].segments)
+            {
+                literal += '/';
+                if (!segment.param)
+                {
+                    literal += segment.text;
+                    continue;
+                }
+                node = insert(node, literal);
+                literal.clear();
+                if (!node->param)
+                    node->param.reset(new Node);
+                node = node->param.get();
+            }
+            if (routes[n].segments.empty())
+                literal = "/";
+            node = insert(node, literal);
+            // Routes are sorted by specificity, the first one of a shape wins
+            if (node->route < 0)
+                node->route = static_cast<int>(n);
+        }
+    }
+
+    int match(const char* url, Params& params) const
+    {
+        params.count = 0;
+        return match(m_root.get(), route_spec::url_path(url), params);
+    }
+
+  private:
+    struct Node
+    {
+        std::string prefix;
+        std::vector<std::unique_ptr<Node>> children; // literal edges, distinct first characters
+        std::unique_ptr<Node> param;
+        int route = -1;
+    };
+
+    std::unique_ptr<Node> m_root;
+
+    // Node at the end of the literal below node, splitting edges as needed
+    static Node* insert(Node* node, std::string_view literal)
+    {
+        while (!literal.empty())
+        {
+            Node* child = nullptr;
+            for (auto& candidate : node->children)
+                if (candidate->prefix[0] == literal[0])
+                    child = candidate.get();
+            if (!child)
+            {
+                node->children.emplace_back(new Node);
+                node->children.back()->prefix = std::string(literal);
+                return node->children.back().get();
+            }
+
+            size_t common = 0;
+            while (common < child->prefix.size() && common < literal.size() &&
+                   child->prefix[common] == literal[common])
+                common++;
+            if (common < child->prefix.size())
+            {
+                // Split the edge at the first difference
+                std::unique_ptr<Node> tail(new Node);
+                tail->prefix = child->prefix.substr(common);
+                tail->children = std::move(child->children);
+                tail->param = std::move(child->param);
+                tail->route = child->route;
+                child->prefix.resize(common);
+                child->children.clear();
+                child->children.push_back(std::move(tail));
+                child->param.reset();
+                child->route = -1;
+            }
+            node = child;
+            literal.remove_prefix(common);
+        }
+        return node;
+    }
+
+    static int match(const Node* node, std::string_view path, Params& params)
+    {
+        if (path.empty())
+            return node->route;
+
+        for (const auto& child : node->children)
+            if (child->prefix[0] == path[0])
+            {
+                if (path.compare(0, child->prefix.size(), child->prefix) == 0)
+                {
+                    int route = match(child.get(), path.substr(child->prefix.size()), params);
+                    if (route >= 0)
+                        return route;
+                }
+                break;
+            }
+
+        if (node->param && params.count < max_params && path[0] != '/')
+        {
+            size_t end = std::min(path.find('/'), path.size());
+            int count = params.count;
+            params.values[params.count++] = path.substr(0, end);
+            int route = match(node->param.get(), path.substr(end), params);
+            if (route >= 0)
+                return route;
+            params.count = count;
+        }
+        return -1;
+    }
+};
+
+#ifdef ROUTER_BENCH_RE2C
+class Re2cRouter
+{
+  public:
+    int match(const char* url, Params& params) const
+    {
+        routes::RouteParams route_params;
+        int route = routes::match_route(url, route_params);
+        params.count = route_params.count;
+        for (int n = 0; n < route_params.count; n++)
+            params.values[n] = route_params.values[n];
+        return route;
+    }
+};
+#endif
+
+static std::vector<std::string> make_urls(const std::vector<route_spec::Route>& routes,
+                                          size_t count)
+{
+    std::mt19937 random(12345);
+    // Hot routes first: the weight of a route falls with its rank
+    std::vector<size_t> ranks(routes.size());
+    for (size_t n = 0; n < ranks.size(); n++)
+        ranks[n] = n;
+    std::shuffle(ranks.begin(), ranks.end(), random);
+    std::vector<double> weights(routes.size());
+    for (size_t n = 0; n < routes.size(); n++)
+        weights[ranks[n]] = 1.0 / (n + 1);
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<uint32_t> number(1, 9999999);
+
+    static const char* const queries[] = {"?page=2", "?page=3&sort=desc", "?q=shoes&limit=50",
+                                          "?utm_source=mail&utm_campaign=spring"};
+    std::vector<std::string> urls;
+    urls.reserve(count);
+    while (urls.size() < count)
+    {
+        const route_spec::Route& route = routes[pick(random)];
+        std::string url;
+        for (const route_spec::Segment& segment : route.segments)
+        {
+            url += '/';
+            if (!segment.param)
+                url += segment.text;
+            else if (percent(random) < 60)
+                url += std::to_string(number(random));
+            else if (percent(random) < 50)
+            {
+                char slug[32];
+                std::snprintf(slug, sizeof(slug), "item-%06x", number(random));
+                url += slug;
+            }
+            else if (percent(random) < 20)
+            {
+                // Raw UTF-8, the bytes >= 0x80 must stay inside the param
+                char slug[32];
+                std::snprintf(slug, sizeof(slug), "caf\xc3\xa9-%04x", number(random) & 0xffff);
+                url += slug;
+            }
+            else
+            {
+                char file[32];
+                std::snprintf(file, sizeof(file), "app.%05x.js", number(random) & 0xfffff);
+                url += file;
+            }
+        }
+        if (url.empty())
+            url = "/";
+
+        int roll = percent(random);
+        // Misses: a typo in the path or an extra segment
+        if (roll < 5 && url.size() > 2)
+            url[1 + number(random) % (url.size() - 1)] = 'x';
+        else if (roll < 10)
+            url += "/extra";
+        if (percent(random) < 15)
+            url += queries[number(random) % 4];
+        urls.push_back(std::move(url));
+    }
+    return urls;
+}
+
+template <typename Router>
+static double run(const char* name, const Router& router, const std::vector<std::string>& urls)
+{
+    const int passes = 20;
+    size_t checksum = 0;
+    Params params;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+        for (const std::string& url : urls)
+            checksum += router.match(url.c_str(), params) + params.count;
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    double ns = elapsed.count() / (passes * urls.size());
+    std::printf("%-5s %8.1f ns/lookup %8.2f M lookups/s   (checksum %zu)\n", name, ns, 1000 / ns,
+                checksum);
+    return ns;
+}
+
+template <typename Router>
+static bool check(const char* name, const Router& router, const MapRouter& reference,
+                  const std::vector<std::string>& urls)
+{
+    for (const std::string& url : urls)
+    {
+        Params expected, params;
+        int expected_route = reference.match(url.c_str(), expected);
+        int route = router.match(url.c_str(), params);
+        bool same = route == expected_route && params.count == expected.count;
+        for (int n = 0; same && n < params.count; n++)
+            same = params.values[n] == expected.values[n];
+        if (!same)
+        {
+            std::fprintf(stderr, "%s: %s matched route %d, expected %d\n", name, url.c_str(),
+                         route, expected_route);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string spec = argc > 1 ? argv[1] : "routes.spec";
+    size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+
+    std::vector<route_spec::Route> routes;
+    try
+    {
+        routes = route_spec::load(spec);
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "router_bench: %s: %s\n", spec.c_str(), e.what());
+        return 1;
+    }
+    if (routes.empty())
+        return 1;
+
+    std::vector<std::string> urls = make_urls(routes, count);
+    MapRouter map(routes);
+    TrieRouter trie(routes);
+    size_t misses = 0;
+    for (const std::string& url : urls)
+    {
+        Params params;
+        misses += map.match(url.c_str(), params) < 0;
+    }
+    std::printf("%zu routes, %zu urls, %zu misses\n", routes.size(), urls.size(), misses);
+
+    if (!check("trie", trie, map, urls))
+        return 1;
+#ifdef ROUTER_BENCH_RE2C
+    Re2cRouter re2c;
+    if (!check("re2c", re2c, map, urls))
+        return 1;
+#endif
+
+    run("map", map, urls);
+    run("trie", trie, urls);
+#ifdef ROUTER_BENCH_RE2C
+    run("re2c", re2c, urls);
+#endif
+    return 0;
+}
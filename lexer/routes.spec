@@ -0,0 +1,34 @@
+# Example route spec for route_gen and router_bench
+#
+# METHOD[,METHOD...]  PATH                                   HANDLER
+GET,HEAD              /                                      index_get
+GET                   /health                                health_get
+GET                   /metrics                               metrics_get
+GET                   /endpoint_one                          endpoint_one_get
+DELETE                /endpoint_one                          endpoint_one_del
+GET                   /endpoint_two                          endpoint_two_get
+POST                  /endpoint_three                        endpoint_three_post
+POST                  /api/v1/login                          login_post
+POST                  /api/v1/logout                         logout_post
+GET                   /api/v1/users                          users_get
+POST                  /api/v1/users                          users_post
+GET                   /api/v1/users/me                       user_me_get
+GET                   /api/v1/users/{id}                     user_get
+PUT,PATCH             /api/v1/users/{id}                     user_put
+DELETE                /api/v1/users/{id}                     user_del
+GET                   /api/v1/users/{id}/posts               user_posts_get
+GET                   /api/v1/users/{id}/posts/{post}        user_post_get
+GET                   /api/v1/users/{id}/followers           user_followers_get
+GET                   /api/v1/posts                          posts_get
+POST                  /api/v1/posts                          posts_post
+GET                   /api/v1/posts/{post}                   post_get
+GET                   /api/v1/posts/{post}/comments          post_comments_get
+POST                  /api/v1/posts/{post}/comments          post_comments_post
+GET                   /api/v1/posts/{post}/comments/{comment} post_comment_get
+GET                   /api/v1/search                         search_get
+GET                   /api/v1/orders                         orders_get
+GET                   /api/v1/orders/{order}                 order_get
+POST                  /api/v1/orders/{order}/cancel          order_cancel_post
+GET                   /api/v1/orders/{order}/items/{item}    order_item_get
+GET                   /api/v2/catalog/{category}/{product}   product_get
+GET                   /static/{file}                         static_get
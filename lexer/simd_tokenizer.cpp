@@ -0,0 +1,509 @@
+// SIMD kernels of the Tokenizer, see simd_tokenizer.h
+//
+// The kernels are compiled with target attributes, so the file builds without -mavx2 and the CPU
+// is asked at runtime which of them can run.
+
+#include "simd_tokenizer.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+namespace
+{
+enum ByteClass : uint8_t
+{
+    WORD_BYTE,
+    SPACE_BYTE,
+    NEWLINE_BYTE,
+    QUOTE_BYTE,
+    DELIM_BYTE,
+};
+
+constexpr bool is_delimiter(unsigned c)
+{
+    if (c < 0x20)
+        return c != '\t' && c != '\r' && c != '\n';
+    switch (c)
+    {
+    case '(':
+    case ')':
+    case '<':
+    case '>':
+    case '@':
+    case ',':
+    case ';':
+    case ':':
+    case '\\':
+    case '/':
+    case '[':
+    case ']':
+    case '?':
+    case '=':
+    case '{':
+    case '}':
+        return true;
+    default:
+        return false;
+    }
+}
+
+struct ClassTable
+{
+    uint8_t classes[256] = {};
+
+    constexpr ClassTable()
+    {
+        for (unsigned c = 0; c < 256; c++)
+        {
+            if (c == ' ' || c == '\t' || c == '\r')
+                classes[c] = SPACE_BYTE;
+            else if (c == '\n')
+                classes[c] = NEWLINE_BYTE;
+            else if (c == '"')
+                classes[c] = QUOTE_BYTE;
+            else if (is_delimiter(c))
+                classes[c] = DELIM_BYTE;
+            else
+                classes[c] = WORD_BYTE;
+        }
+    }
+};
+
+constexpr ClassTable class_table;
+
+inline void push(std::vector<Token>& tokens, size_t offset, size_t length, TokenType type)
+{
+    tokens.push_back({static_cast<uint32_t>(offset), static_cast<uint32_t>(length), type});
+}
+
+// End of the quoted string from inside of it, position after the closing quote or size
+size_t scalar_quoted_end(const char* data, size_t position, size_t size)
+{
+    while (position < size)
+    {
+        char c = data[position++];
+        if (c == '\\')
+            position++;
+        else if (c == '"')
+            return position;
+    }
+    return size;
+}
+
+// The complex state: escapes inside a quoted string
+inline size_t complex_quoted_end(const char* data, size_t position, size_t size)
+{
+#ifdef TOKENIZER_RE2C
+    return re2c_quoted_end(data, position, size);
+#else
+    return scalar_quoted_end(data, position, size);
+#endif
+}
+
+void scalar_tokens(const char* data, size_t position, size_t size, std::vector<Token>& tokens)
+{
+    while (position < size)
+    {
+        size_t start = position;
+        switch (class_table.classes[static_cast<uint8_t>(data[position])])
+        {
+        case SPACE_BYTE:
+            position++;
+            break;
+        case NEWLINE_BYTE:
+            push(tokens, position++, 1, TokenType::NEWLINE);
+            break;
+        case DELIM_BYTE:
+            push(tokens, position++, 1, TokenType::DELIM);
+            break;
+        case QUOTE_BYTE:
+            position = scalar_quoted_end(data, position + 1, size);
+            push(tokens, start, position - start, TokenType::QUOTED);
+            break;
+        default:
+            while (++position < size &&
+                   class_table.classes[static_cast<uint8_t>(data[position])] == WORD_BYTE)
+                ;
+            push(tokens, start, position - start, TokenType::WORD);
+            break;
+        }
+    }
+}
+
+#ifdef TOKENIZER_X86
+
+// Bitmasks of 64 bytes, bit n for byte n
+struct Masks
+{
+    uint64_t space;
+    uint64_t newline;
+    uint64_t quote;
+    uint64_t delim;
+
+    uint64_t word() const
+    {
+        return ~(space | newline | quote | delim);
+    }
+};
+
+// Nibble tables of the delimiters: byte c is a delimiter if lo[c & 15] & hi[c >> 4] is not 0.
+// Every high nibble with delimiters gets a bit of its own, at most 8 of them.
+struct NibbleTables
+{
+    alignas(16) uint8_t lo[16] = {};
+    alignas(16) uint8_t hi[16] = {};
+
+    constexpr NibbleTables()
+    {
+        int groups = 0;
+        for (unsigned h = 0; h < 16; h++)
+        {
+            uint8_t bit = 0;
+            for (unsigned l = 0; l < 16; l++)
+                if (is_delimiter(h << 4 | l))
+                {
+                    if (!bit)
+                        bit = static_cast<uint8_t>(1 << groups++);
+                    lo[l] |= bit;
+                }
+            hi[h] = bit;
+        }
+    }
+
+    constexpr int count_groups() const
+    {
+        int groups = 0;
+        for (unsigned h = 0; h < 16; h++)
+            groups += hi[h] != 0;
+        return groups;
+    }
+};
+
+constexpr NibbleTables nibble_tables;
+static_assert(nibble_tables.count_groups() <= 8, "delimiters span more than 8 high nibbles");
+
+inline unsigned trailing_zeros(uint64_t mask)
+{
+    return static_cast<unsigned>(__builtin_ctzll(mask));
+}
+
+struct Sse42Kernel
+{
+    __attribute__((target("sse4.2"))) static void classify16(const char* data, Masks& masks,
+                                                             unsigned shift)
+    {
+        const __m128i lo_table = _mm_load_si128(reinterpret_cast<const __m128i*>(nibble_tables.lo));
+        const __m128i hi_table = _mm_load_si128(reinterpret_cast<const __m128i*>(nibble_tables.hi));
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+                                                  _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t'))),
+                                     _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')));
+        __m128i lo = _mm_shuffle_epi8(lo_table, _mm_and_si128(bytes, nibble));
+        __m128i hi = _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+        __m128i not_delim = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+
+        masks.space |= static_cast<uint64_t>(_mm_movemask_epi8(space)) << shift;
+        masks.newline |=
+            static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))))
+            << shift;
+        masks.quote |=
+            static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"'))))
+            << shift;
+        masks.delim |= static_cast<uint64_t>(~_mm_movemask_epi8(not_delim) & 0xffff) << shift;
+    }
+
+    __attribute__((target("sse4.2"))) static Masks classify(const char* data)
+    {
+        Masks masks = {};
+        for (unsigned n = 0; n < 4; n++)
+            classify16(data + 16 * n, masks, 16 * n);
+        return masks;
+    }
+
+    // Position of the first quote or backslash, or size
+    __attribute__((target("sse4.2"))) static size_t find_quote_or_backslash(const char* data,
+                                                                           size_t position,
+                                                                           size_t size)
+    {
+        const __m128i needles = _mm_setr_epi8('"', '\\', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        for (; position + 16 <= size; position += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position));
+            // Explicit lengths, the input may contain NUL bytes
+            int index = _mm_cmpestri(needles, 2, bytes, 16,
+                                     _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                                         _SIDD_LEAST_SIGNIFICANT);
+            if (index < 16)
+                return position + index;
+        }
+        for (; position < size; position++)
+            if (data[position] == '"' || data[position] == '\\')
+                return position;
+        return size;
+    }
+};
+
+struct Avx2Kernel
+{
+    __attribute__((target("avx2"))) static void classify32(const char* data, Masks& masks,
+                                                           unsigned shift)
+    {
+        const __m256i lo_table = _mm256_broadcastsi128_si256(
+            _mm_load_si128(reinterpret_cast<const __m128i*>(nibble_tables.lo)));
+        const __m256i hi_table = _mm256_broadcastsi128_si256(
+            _mm_load_si128(reinterpret_cast<const __m128i*>(nibble_tables.hi)));
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        __m256i space =
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+                                            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t'))),
+                            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r')));
+        __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(bytes, nibble));
+        __m256i hi =
+            _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+        __m256i not_delim = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+
+        __m256i newline = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'));
+        __m256i quote = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"'));
+
+        masks.space |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(space)))
+                       << shift;
+        masks.newline |=
+            static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(newline))) << shift;
+        masks.quote |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(quote)))
+                       << shift;
+        masks.delim |=
+            static_cast<uint64_t>(~static_cast<uint32_t>(_mm256_movemask_epi8(not_delim)))
+            << shift;
+    }
+
+    __attribute__((target("avx2"))) static Masks classify(const char* data)
+    {
+        Masks masks = {};
+        classify32(data, masks, 0);
+        classify32(data + 32, masks, 32);
+        return masks;
+    }
+
+    __attribute__((target("avx2"))) static size_t find_quote_or_backslash(const char* data,
+                                                                         size_t position,
+                                                                         size_t size)
+    {
+        for (; position + 32 <= size; position += 32)
+        {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + position));
+            __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"')),
+                                           _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\')));
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+            if (mask)
+                return position + __builtin_ctz(mask);
+        }
+        for (; position < size; position++)
+            if (data[position] == '"' || data[position] == '\\')
+                return position;
+        return size;
+    }
+};
+
+template <typename Kernel>
+size_t quoted_end(const char* data, size_t position, size_t size)
+{
+    size_t hit = Kernel::find_quote_or_backslash(data, position, size);
+    if (hit >= size)
+        return size;
+    if (data[hit] == '"')
+        return hit + 1;
+    return complex_quoted_end(data, hit, size);
+}
+
+// Appends tokens without the capacity check of push_back(), reserve() makes room for a block
+class TokenWriter
+{
+  public:
+    explicit TokenWriter(std::vector<Token>& tokens) : m_tokens(tokens)
+    {
+        m_next = m_end = tokens.data() + tokens.size();
+    }
+    TokenWriter(const TokenWriter&) = delete;
+    TokenWriter& operator=(const TokenWriter&) = delete;
+    ~TokenWriter()
+    {
+        m_tokens.resize(m_next - m_tokens.data());
+    }
+
+    void reserve(size_t count)
+    {
+        if (static_cast<size_t>(m_end - m_next) >= count)
+            return;
+        size_t used = m_next - m_tokens.data();
+        m_tokens.resize(std::max(used + count, 2 * m_tokens.size()));
+        m_next = m_tokens.data() + used;
+        m_end = m_tokens.data() + m_tokens.size();
+    }
+
+    void push(size_t offset, size_t length, TokenType type)
+    {
+        *m_next++ = {static_cast<uint32_t>(offset), static_cast<uint32_t>(length), type};
+    }
+
+  private:
+    std::vector<Token>& m_tokens;
+    Token* m_next;
+    Token* m_end;
+};
+
+// Walks the bitmasks of 64 byte blocks: every token starts at a bit of the start mask, a word
+// runs to the next bit not in the word mask and may continue into the next block. The blocks are
+// loaded again from the end of a quoted string.
+template <typename Kernel>
+size_t simd_blocks(const char* data, size_t size, std::vector<Token>& tokens)
+{
+    size_t position = 0;
+    // Start of the word open at the end of the previous block
+    size_t open_word = SIZE_MAX;
+    TokenWriter writer(tokens);
+    while (position + 64 <= size)
+    {
+        // At most a token per byte
+        writer.reserve(64);
+        Masks masks = Kernel::classify(data + position);
+        uint64_t word = masks.word();
+        uint64_t starts = (word & ~(word << 1)) | masks.delim | masks.newline | masks.quote;
+
+        if (open_word != SIZE_MAX)
+        {
+            if (!~word)
+            {
+                position += 64;
+                continue;
+            }
+            // A word byte at bit 0 continues the open word
+            starts &= ~(word & 1);
+            size_t end = position + trailing_zeros(~word);
+            writer.push(open_word, end - open_word, TokenType::WORD);
+            open_word = SIZE_MAX;
+        }
+
+        size_t next = position + 64;
+        while (starts)
+        {
+            unsigned index = trailing_zeros(starts);
+            starts &= starts - 1;
+            uint64_t bit = 1ull << index;
+
+            if (word & bit)
+            {
+                uint64_t other = ~word & (~0ull << index);
+                if (!other)
+                {
+                    open_word = position + index;
+                    break;
+                }
+                writer.push(position + index, trailing_zeros(other) - index, TokenType::WORD);
+            }
+            else if (masks.quote & bit)
+            {
+                size_t start = position + index;
+                next = quoted_end<Kernel>(data, start + 1, size);
+                writer.push(start, next - start, TokenType::QUOTED);
+                break;
+            }
+            else
+                writer.push(position + index, 1,
+                            masks.newline & bit ? TokenType::NEWLINE : TokenType::DELIM);
+        }
+        position = next;
+    }
+
+    if (open_word != SIZE_MAX)
+    {
+        while (position < size &&
+               class_table.classes[static_cast<uint8_t>(data[position])] == WORD_BYTE)
+            position++;
+        writer.reserve(1);
+        writer.push(open_word, position - open_word, TokenType::WORD);
+    }
+    return position;
+}
+
+// The blocks, then the tail byte by byte
+template <typename Kernel>
+void simd_tokens(const char* data, size_t size, std::vector<Token>& tokens)
+{
+    scalar_tokens(data, simd_blocks<Kernel>(data, size, tokens), size, tokens);
+}
+
+#endif // TOKENIZER_X86
+} // namespace
+
+Tokenizer::Tokenizer(Kernel kernel) : m_kernel(kernel)
+{
+#ifdef TOKENIZER_X86
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool sse42 = __builtin_cpu_supports("sse4.2");
+#else
+    bool avx2 = false;
+    bool sse42 = false;
+#endif
+#ifdef TOKENIZER_RE2C
+    bool re2c = true;
+#else
+    bool re2c = false;
+#endif
+
+    if (m_kernel == Kernel::AUTO)
+        m_kernel = avx2 ? Kernel::AVX2 : sse42 ? Kernel::SSE42 : Kernel::SCALAR;
+    if ((m_kernel == Kernel::AVX2 && !avx2) || (m_kernel == Kernel::SSE42 && !sse42) ||
+        (m_kernel == Kernel::RE2C && !re2c))
+        m_kernel = Kernel::SCALAR;
+}
+
+const char* Tokenizer::kernel_name(Kernel kernel)
+{
+    switch (kernel)
+    {
+    case Kernel::AUTO:
+        return "auto";
+    case Kernel::SCALAR:
+        return "scalar";
+    case Kernel::SSE42:
+        return "sse4.2";
+    case Kernel::AVX2:
+        return "avx2";
+    case Kernel::RE2C:
+        return "re2c";
+    }
+    return "?";
+}
+
+size_t Tokenizer::tokenize(const char* data, size_t size, std::vector<Token>& tokens) const
+{
+    size_t count = tokens.size();
+    switch (m_kernel)
+    {
+#ifdef TOKENIZER_X86
+    case Kernel::AVX2:
+        simd_tokens<Avx2Kernel>(data, size, tokens);
+        break;
+    case Kernel::SSE42:
+        simd_tokens<Sse42Kernel>(data, size, tokens);
+        break;
+#endif
+#ifdef TOKENIZER_RE2C
+    case Kernel::RE2C:
+        re2c_tokenize(data, size, tokens);
+        break;
+#endif
+    default:
+        scalar_tokens(data, 0, size, tokens);
+        break;
+    }
+    return tokens.size() - count;
+}
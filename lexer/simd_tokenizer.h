@@ -0,0 +1,91 @@
+// Tokenizer for log lines and HTTP headers with SIMD kernels
+//
+// Splits the input into tokens:
+//   WORD     - run of any bytes but whitespace, delimiters, quotes and control characters
+//   QUOTED   - "..." including the quotes, a backslash escapes the next byte. An unterminated
+//              string ends with the input.
+//   DELIM    - one of ()<>@,;:\/[]?={} (the RFC 7230 delimiters) or a control character
+//   NEWLINE  - \n
+// Spaces, tabs and \r separate tokens and are skipped.
+//
+// Kernels, picked at runtime by CPU dispatch unless asked for:
+//   AVX2     - classifies 64 bytes per step into bitmasks of whitespace, delimiters, quotes and
+//              newlines (delimiters by a pshufb nibble lookup) and walks them with bit scans
+//   SSE42    - the same on 4 x 16 bytes, quoted strings are scanned with pcmpestri
+//   SCALAR   - byte by byte over a class table, also the tail of the input
+//   RE2C     - the DFA generated by re2c from tokenizer.re, only if built with -DTOKENIZER_RE2C
+// The SIMD kernels stop at the first backslash inside a quoted string and leave the rest of the
+// string, the complex state, to the re2c DFA (or the scalar loop without re2c).
+//
+// Usage example:
+//
+// Tokenizer tokenizer;
+// std::vector<Token> tokens;
+// tokenizer.tokenize(line.data(), line.size(), tokens);
+// for (const Token& token : tokens)
+//     std::string_view text(line.data() + token.offset, token.length);
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class TokenType : uint8_t
+{
+    WORD,
+    QUOTED,
+    DELIM,
+    NEWLINE,
+};
+
+struct Token
+{
+    uint32_t offset;
+    uint32_t length;
+    TokenType type;
+
+    bool operator==(const Token& other) const
+    {
+        return offset == other.offset && length == other.length && type == other.type;
+    }
+};
+
+class Tokenizer
+{
+  public:
+    enum class Kernel
+    {
+        AUTO,
+        SCALAR,
+        SSE42,
+        AVX2,
+        RE2C,
+    };
+
+    // AUTO picks the best kernel of the CPU, a kernel the CPU or the build lacks falls back to
+    // SCALAR
+    explicit Tokenizer(Kernel kernel = Kernel::AUTO);
+
+    Kernel kernel() const
+    {
+        return m_kernel;
+    }
+    static const char* kernel_name(Kernel kernel);
+
+    // Append the tokens of the input, returns the number of tokens appended. The input must be
+    // shorter than 4 GiB. In a build with TOKENIZER_RE2C every kernel needs a NUL byte after it,
+    // not only RE2C: the SIMD kernels take the escapes inside quoted strings with the re2c DFA.
+    size_t tokenize(const char* data, size_t size, std::vector<Token>& tokens) const;
+
+  private:
+    Kernel m_kernel;
+};
+
+#ifdef TOKENIZER_RE2C
+// Generated by re2c from tokenizer.re
+size_t re2c_tokenize(const char* data, size_t size, std::vector<Token>& tokens);
+// End of the quoted string from inside of it, position after the closing quote or size. Never
+// more than size, data[size] must be NUL.
+size_t re2c_quoted_end(const char* data, size_t position, size_t size);
+#endif
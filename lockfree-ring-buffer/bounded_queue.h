@@ -0,0 +1,292 @@
+// 1). Bounded lock-free queues living next to RingBuffer. Unlike RingBuffer,
+// which always hands the reader the latest slot, these are lossless FIFOs: a
+// push fails when the queue is full instead of overwriting unread data.
+//
+// 2). SpscQueue - single producer, single consumer. Each index has a single
+// owner, so the slots need no metadata. Both sides keep a cached copy of the
+// other side's index and only touch the shared one when the cache says the
+// queue is full/empty.
+//
+// 3). MpmcQueue - multiple producers, multiple consumers. Every slot carries a
+// turn counter: for ticket t and lap = t / capacity the slot is free for the
+// producer when turn == 2 * lap and full for the consumer when
+// turn == 2 * lap + 1. Producers and consumers claim tickets by CAS on the
+// head/tail indexes and only ever wait on their own slot.
+//
+// 4). try_push_n()/try_pop_n() claim a whole range of tickets with one atomic
+// operation on the shared index. In MpmcQueue a claimed slot can still be
+// finishing a previous operation by another thread (claimed but not yet
+// published), in that case the batch spins on that single slot's turn.
+//
+// 5). Slots and indexes are padded with the same Layout policies as RingBuffer
+// (see slot_layout.h). The capacity must be a power of two.
+//
+// Usage example:
+//
+// MpmcQueue<Message, 1024> queue;
+// if (!queue.try_push(msg)) { // queue full, apply backpressure }
+//
+// std::array<Message, 32> batch;
+// size_t n = queue.try_pop_n(batch.begin(), batch.size());
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "slot_layout.h"
+
+namespace detail {
+
+// Uninitialized storage for a single queue element
+template <typename T>
+struct SlotStorage {
+  alignas(T) unsigned char bytes[sizeof(T)];
+
+  template <typename... Args>
+  void construct(Args&&... args) {
+    new (bytes) T(std::forward<Args>(args)...);
+  }
+  T& get() { return *std::launder(reinterpret_cast<T*>(bytes)); }
+  // Move the element out and end its lifetime
+  T take() {
+    T value(std::move(get()));
+    get().~T();
+    return value;
+  }
+};
+
+}  // namespace detail
+
+template <typename T, size_t capacity, typename Layout = CacheLineLayout>
+class SpscQueue {
+  static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0,
+                "SpscQueue capacity must be a power of two.");
+  static_assert(std::is_nothrow_move_constructible<T>::value,
+                "SpscQueue element must be nothrow move constructible.");
+
+ public:
+  SpscQueue() = default;
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+  ~SpscQueue() {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    for (size_t tail = m_tail.load(std::memory_order_relaxed); tail != head;
+         tail++)
+      m_slots[tail & mask].storage.get().~T();
+  }
+
+  // Producer side
+  template <typename... Args>
+  bool try_emplace(Args&&... args) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail_cache == capacity) {
+      m_tail_cache = m_tail.load(std::memory_order_acquire);
+      if (head - m_tail_cache == capacity) return false;
+    }
+    m_slots[head & mask].storage.construct(std::forward<Args>(args)...);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  bool try_push(const T& value) { return try_emplace(value); }
+  bool try_push(T&& value) { return try_emplace(std::move(value)); }
+
+  // Move up to n elements from first, returns the number pushed
+  template <typename InputIt>
+  size_t try_push_n(InputIt first, size_t n) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (capacity - (head - m_tail_cache) < n)
+      m_tail_cache = m_tail.load(std::memory_order_acquire);
+    size_t count = std::min(n, capacity - (head - m_tail_cache));
+    for (size_t i = 0; i < count; i++, ++first)
+      m_slots[(head + i) & mask].storage.construct(std::move(*first));
+    if (count) m_head.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  // Consumer side
+  bool try_pop(T& value) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head_cache) {
+      m_head_cache = m_head.load(std::memory_order_acquire);
+      if (tail == m_head_cache) return false;
+    }
+    value = m_slots[tail & mask].storage.take();
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Move up to n elements to out, returns the number popped
+  template <typename OutputIt>
+  size_t try_pop_n(OutputIt out, size_t n) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (m_head_cache - tail < n)
+      m_head_cache = m_head.load(std::memory_order_acquire);
+    size_t count = std::min(n, m_head_cache - tail);
+    for (size_t i = 0; i < count; i++, ++out)
+      *out = m_slots[(tail + i) & mask].storage.take();
+    if (count) m_tail.store(tail + count, std::memory_order_release);
+    return count;
+  }
+
+  // Approximate number of elements, exact only when both sides are idle
+  size_t size() const {
+    return m_head.load(std::memory_order_acquire) -
+           m_tail.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr size_t mask = capacity - 1;
+
+  struct alignas(Layout::slot_align) Slot {
+    detail::SlotStorage<T> storage;
+  };
+
+  Slot m_slots[capacity];
+  // -- Written by the producer --
+  alignas(Layout::index_align) std::atomic_size_t m_head = {0};
+  size_t m_tail_cache = 0;
+  // -- Written by the consumer --
+  alignas(Layout::index_align) std::atomic_size_t m_tail = {0};
+  size_t m_head_cache = 0;
+};
+
+template <typename T, size_t capacity, typename Layout = CacheLineLayout>
+class MpmcQueue {
+  static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0,
+                "MpmcQueue capacity must be a power of two.");
+  static_assert(std::is_nothrow_move_constructible<T>::value,
+                "MpmcQueue element must be nothrow move constructible.");
+
+ public:
+  MpmcQueue() = default;
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+  ~MpmcQueue() {
+    // Odd turn marks a slot holding an element
+    for (Slot& slot : m_slots)
+      if (slot.turn.load(std::memory_order_relaxed) & 1)
+        slot.storage.get().~T();
+  }
+
+  template <typename... Args>
+  bool try_emplace(Args&&... args) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = m_slots[head & mask];
+      if (slot.turn.load(std::memory_order_acquire) == push_turn(head)) {
+        if (m_head.compare_exchange_weak(head, head + 1,
+                                         std::memory_order_relaxed)) {
+          slot.storage.construct(std::forward<Args>(args)...);
+          slot.turn.store(push_turn(head) + 1, std::memory_order_release);
+          return true;
+        }
+      } else {
+        // Slot still holds an element from the previous lap, the queue is
+        // full unless another producer moved the head in the meantime
+        size_t prev_head = head;
+        head = m_head.load(std::memory_order_relaxed);
+        if (head == prev_head) return false;
+      }
+    }
+  }
+  bool try_push(const T& value) { return try_emplace(value); }
+  bool try_push(T&& value) { return try_emplace(std::move(value)); }
+
+  // Move up to n elements from first, returns the number pushed
+  template <typename InputIt>
+  size_t try_push_n(InputIt first, size_t n) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t count;
+    do {
+      size_t used = head - m_tail.load(std::memory_order_acquire);
+      // Stale head behind a newer tail, the CAS below would fail anyway
+      if (used > capacity) used = 0;
+      count = std::min(n, capacity - used);
+      if (count == 0) return 0;
+    } while (!m_head.compare_exchange_weak(head, head + count,
+                                           std::memory_order_relaxed));
+    for (size_t i = 0; i < count; i++, ++first) {
+      Slot& slot = m_slots[(head + i) & mask];
+      size_t turn = push_turn(head + i);
+      // Consumer of the previous lap has claimed the slot but not freed it yet
+      while (slot.turn.load(std::memory_order_acquire) != turn)
+        detail::cpu_relax();
+      slot.storage.construct(std::move(*first));
+      slot.turn.store(turn + 1, std::memory_order_release);
+    }
+    return count;
+  }
+
+  bool try_pop(T& value) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = m_slots[tail & mask];
+      if (slot.turn.load(std::memory_order_acquire) == push_turn(tail) + 1) {
+        if (m_tail.compare_exchange_weak(tail, tail + 1,
+                                         std::memory_order_relaxed)) {
+          value = slot.storage.take();
+          slot.turn.store(push_turn(tail) + 2, std::memory_order_release);
+          return true;
+        }
+      } else {
+        size_t prev_tail = tail;
+        tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == prev_tail) return false;
+      }
+    }
+  }
+
+  // Move up to n elements to out, returns the number popped
+  template <typename OutputIt>
+  size_t try_pop_n(OutputIt out, size_t n) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t count;
+    do {
+      size_t used = m_head.load(std::memory_order_acquire) - tail;
+      if (used > capacity) used = 0;
+      count = std::min(n, used);
+      if (count == 0) return 0;
+    } while (!m_tail.compare_exchange_weak(tail, tail + count,
+                                           std::memory_order_relaxed));
+    for (size_t i = 0; i < count; i++, ++out) {
+      Slot& slot = m_slots[(tail + i) & mask];
+      size_t turn = push_turn(tail + i) + 1;
+      // Producer has claimed the slot but not published the element yet
+      while (slot.turn.load(std::memory_order_acquire) != turn)
+        detail::cpu_relax();
+      *out = slot.storage.take();
+      slot.turn.store(turn + 1, std::memory_order_release);
+    }
+    return count;
+  }
+
+  // Approximate number of elements, includes claimed but unpublished slots
+  size_t size() const {
+    size_t head = m_head.load(std::memory_order_acquire);
+    size_t tail = m_tail.load(std::memory_order_acquire);
+    return head > tail ? head - tail : 0;
+  }
+
+ private:
+  static constexpr size_t mask = capacity - 1;
+
+  // Turn at which the slot of the given ticket is free for the producer
+  static constexpr size_t push_turn(size_t ticket) {
+    return 2 * (ticket / capacity);
+  }
+
+  struct alignas(Layout::slot_align) Slot {
+    alignas(Layout::meta_align) std::atomic_size_t turn = {0};
+    alignas(Layout::meta_align) detail::SlotStorage<T> storage;
+  };
+
+  Slot m_slots[capacity];
+  // Next ticket for producers
+  alignas(Layout::index_align) std::atomic_size_t m_head = {0};
+  // Next ticket for consumers
+  alignas(Layout::index_align) std::atomic_size_t m_tail = {0};
+};
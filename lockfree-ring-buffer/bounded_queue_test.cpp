@@ -0,0 +1,145 @@
+// Stress test of SpscQueue and MpmcQueue
+//
+// Producers push values tagged with their id and a per-producer sequence
+// number, one at a time and in batches through try_push_n(), while consumers
+// pop them with try_pop() and try_pop_n(). Every value must come out exactly
+// once (count and checksum match what was pushed) and a consumer must see the
+// values of each producer in the order they were pushed. The queues are kept
+// small so the producers and consumers wrap around and meet on the same slots
+// all the time.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o bounded_queue_test bounded_queue_test.cpp
+//   ./bounded_queue_test [values per producer]
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "test_util.h"
+
+namespace {
+
+constexpr size_t capacity = 64;
+constexpr size_t batch_size = 8;
+
+uint64_t make_value(uint64_t producer, uint64_t seq) {
+  return producer << 40 | seq;
+}
+uint64_t value_producer(uint64_t value) { return value >> 40; }
+uint64_t value_seq(uint64_t value) { return value & ((uint64_t(1) << 40) - 1); }
+
+// Per-consumer bookkeeping, merged once the consumer is done
+struct Received {
+  uint64_t count = 0;
+  uint64_t checksum = 0;
+  uint64_t out_of_order = 0;
+  // Next sequence number expected from each producer, values of a producer
+  // may go to other consumers in between so only growth is checked
+  std::vector<uint64_t> next;
+
+  explicit Received(int producers) : next(producers, 0) {}
+
+  void add(uint64_t value) {
+    uint64_t producer = value_producer(value);
+    uint64_t seq = value_seq(value);
+    if (producer >= next.size() || seq < next[producer])
+      out_of_order++;
+    else
+      next[producer] = seq + 1;
+    count++;
+    checksum += value * 0x9e3779b97f4a7c15ull;
+  }
+};
+
+// Pushes values, every other round as a batch
+template <typename Queue>
+void produce(Queue& queue, uint64_t producer, uint64_t values) {
+  uint64_t batch[batch_size];
+  uint64_t seq = 0;
+  for (unsigned round = 0; seq < values; round++) {
+    if (round & 1) {
+      size_t n = 0;
+      for (; n < batch_size && seq + n < values; n++)
+        batch[n] = make_value(producer, seq + n);
+      // A partial batch pushes a prefix, the rest goes in the next round
+      seq += queue.try_push_n(batch, n);
+    } else if (queue.try_push(make_value(producer, seq))) {
+      seq++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Pops until total values have been popped by all consumers together
+template <typename Queue>
+void consume(Queue& queue, Received& received, std::atomic_ullong& popped,
+             uint64_t total) {
+  uint64_t batch[batch_size];
+  for (unsigned round = 0; popped.load(std::memory_order_relaxed) < total;
+       round++) {
+    size_t n = 0;
+    if (round & 1) {
+      n = queue.try_pop_n(batch, batch_size);
+    } else if (queue.try_pop(batch[0])) {
+      n = 1;
+    }
+    if (n == 0) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (size_t i = 0; i < n; i++) received.add(batch[i]);
+    popped.fetch_add(n, std::memory_order_relaxed);
+  }
+}
+
+template <typename Queue>
+void run(const char* name, int producers, int consumers, uint64_t values) {
+  auto queue = std::make_unique<Queue>();
+  uint64_t total = values * producers;
+  std::atomic_ullong popped = {0};
+  std::vector<Received> received(consumers, Received(producers));
+  std::vector<std::thread> threads;
+  for (int n = 0; n < consumers; n++)
+    threads.emplace_back([&, n] {
+      consume(*queue, received[n], popped, total);
+    });
+  for (int n = 0; n < producers; n++)
+    threads.emplace_back([&, n] { produce(*queue, n, values); });
+  for (std::thread& thread : threads) thread.join();
+
+  uint64_t expected_checksum = 0;
+  for (int p = 0; p < producers; p++)
+    for (uint64_t seq = 0; seq < values; seq++)
+      expected_checksum += make_value(p, seq) * 0x9e3779b97f4a7c15ull;
+  uint64_t count = 0, checksum = 0, out_of_order = 0;
+  for (const Received& r : received) {
+    count += r.count;
+    checksum += r.checksum;
+    out_of_order += r.out_of_order;
+  }
+  printf("%s %dx%d: %llu values, %llu out of order\n", name, producers,
+         consumers, static_cast<unsigned long long>(count),
+         static_cast<unsigned long long>(out_of_order));
+  CHECK(count == total);
+  CHECK(checksum == expected_checksum);
+  CHECK(out_of_order == 0);
+  CHECK(queue->size() == 0);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  uint64_t values = argc > 1 ? strtoull(argv[1], nullptr, 10) : 500000;
+  run<SpscQueue<uint64_t, capacity>>("spsc", 1, 1, values);
+  run<MpmcQueue<uint64_t, capacity>>("mpmc", 1, 1, values);
+  run<MpmcQueue<uint64_t, capacity>>("mpmc", 4, 1, values);
+  run<MpmcQueue<uint64_t, capacity>>("mpmc", 1, 4, values);
+  run<MpmcQueue<uint64_t, capacity>>("mpmc", 4, 4, values);
+  return test_result();
+}
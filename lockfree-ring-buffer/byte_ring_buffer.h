@@ -0,0 +1,168 @@
+// 1). Byte oriented single producer, single consumer ring for variable length
+// messages. Records are length prefixed and take only as much of the ring as
+// they need, unlike RingBuffer where every message costs a buf_size slot.
+//
+// 2). The producer gets a writable span straight into the ring with reserve()
+// and publishes it with commit(), so messages can be serialized in place
+// without a callback or an intermediate copy. The consumer gets a span of the
+// oldest record with peek() and gives the space back with release().
+//
+// 3). Records never wrap. When a record does not fit between the write
+// position and the end of the ring, a padding record is written to fill the
+// rest and the record starts at offset 0. Records are 8 byte aligned, the
+// header is 8 bytes so the payload is 8 byte aligned too. A record takes at
+// most half of the ring, so with the padding it still fits an empty ring.
+//
+// 4). A reserve() must be followed by commit() before the next reserve(), a
+// peek() by release() before the next peek(). The producer and the consumer
+// can each be a different thread.
+//
+// Usage example:
+//
+// ByteRingBuffer<1 << 20> ring;
+//
+// ** Producer:
+// std::span<uint8_t> buf = ring.reserve(max_len);
+// if (buf.data()) ring.commit(serialize(buf.data(), buf.size()));
+//
+// ** Consumer:
+// std::span<const uint8_t> msg = ring.peek();
+// if (msg.data()) { handle(msg); ring.release(); }
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "slot_layout.h"
+
+template <size_t capacity, typename Layout = CacheLineLayout>
+class ByteRingBuffer {
+  static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0,
+                "ByteRingBuffer capacity must be a power of two.");
+  static_assert(capacity >= 4 * sizeof(uint64_t),
+                "ByteRingBuffer capacity must hold at least one record.");
+
+ public:
+  // Largest payload a single record can carry. A record of at most half the
+  // ring plus the padding in front of it always fits once the ring is empty,
+  // so a producer that retries a record of this size cannot spin forever.
+  static constexpr size_t max_record_size = capacity / 2 - sizeof(uint64_t);
+
+  // Producer: get space for a record of up to len bytes.
+  // Returns a span with data() == nullptr if there is not enough free space,
+  // or always if len exceeds max_record_size.
+  std::span<uint8_t> reserve(size_t len) {
+    if (len > max_record_size) return {};
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t offset = head & mask;
+    size_t total = record_size(len);
+    // Record would cross the end of the ring, pad up to the end
+    size_t padding = (offset + total > capacity) ? capacity - offset : 0;
+    if (!has_space(head, padding + total)) return {};
+
+    if (padding) {
+      write_header(offset, padding_record);
+      head += padding;
+      offset = 0;
+    }
+    m_reserved_head = head;
+    m_reserved_len = len;
+    return {m_data + offset + header_size, len};
+  }
+
+  // Producer: publish the reserved record, trimmed to len bytes (len must not
+  // exceed the reserved length)
+  void commit(size_t len) {
+    write_header(m_reserved_head & mask, len);
+    m_head.store(m_reserved_head + record_size(len), std::memory_order_release);
+  }
+  void commit() { commit(m_reserved_len); }
+
+  // Producer: copy a whole message into the ring
+  bool push(const void* data, size_t len) {
+    std::span<uint8_t> buf = reserve(len);
+    if (buf.data() == nullptr) return false;
+    std::memcpy(buf.data(), data, len);
+    commit();
+    return true;
+  }
+
+  // Consumer: get the oldest record, span with data() == nullptr if there is
+  // none
+  std::span<const uint8_t> peek() {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head_cache) {
+      m_head_cache = m_head.load(std::memory_order_acquire);
+      if (tail == m_head_cache) return {};
+    }
+    size_t offset = tail & mask;
+    uint64_t len = read_header(offset);
+    m_peeked_size = 0;
+    if (len == padding_record) {
+      // Padding is always followed by the record it was inserted for
+      m_peeked_size = capacity - offset;
+      offset = 0;
+      len = read_header(offset);
+    }
+    m_peeked_size += record_size(len);
+    return {m_data + offset + header_size, static_cast<size_t>(len)};
+  }
+
+  // Consumer: give the space of the peeked record back to the producer
+  void release() {
+    m_tail.store(m_tail.load(std::memory_order_relaxed) + m_peeked_size,
+                 std::memory_order_release);
+  }
+
+  // Approximate number of bytes in use, exact only when both sides are idle
+  size_t size() const {
+    return m_head.load(std::memory_order_acquire) -
+           m_tail.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr size_t mask = capacity - 1;
+  static constexpr size_t header_size = sizeof(uint64_t);
+  static constexpr uint64_t padding_record = ~uint64_t(0);
+
+  // Bytes taken by a record with a payload of len bytes
+  static constexpr size_t record_size(size_t len) {
+    return (header_size + len + header_size - 1) & ~(header_size - 1);
+  }
+
+  bool has_space(size_t head, size_t needed) {
+    if (capacity - (head - m_tail_cache) >= needed) return true;
+    m_tail_cache = m_tail.load(std::memory_order_acquire);
+    return capacity - (head - m_tail_cache) >= needed;
+  }
+
+  // Records start at multiples of header_size, masking the offset with
+  // header_mask changes nothing but shows the compiler that a header never
+  // runs past the end of m_data
+  static constexpr size_t header_mask = mask & ~(header_size - 1);
+
+  void write_header(size_t offset, uint64_t len) {
+    std::memcpy(m_data + (offset & header_mask), &len, sizeof(len));
+  }
+  uint64_t read_header(size_t offset) const {
+    uint64_t len;
+    std::memcpy(&len, m_data + (offset & header_mask), sizeof(len));
+    return len;
+  }
+
+  alignas(Layout::slot_align) uint8_t m_data[capacity];
+
+  // -- Written by the producer --
+  alignas(Layout::index_align) std::atomic_size_t m_head = {0};
+  size_t m_tail_cache = 0;
+  size_t m_reserved_head = 0;
+  size_t m_reserved_len = 0;
+
+  // -- Written by the consumer --
+  alignas(Layout::index_align) std::atomic_size_t m_tail = {0};
+  size_t m_head_cache = 0;
+  size_t m_peeked_size = 0;
+};
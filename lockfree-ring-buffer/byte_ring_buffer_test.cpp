@@ -0,0 +1,99 @@
+// Test of ByteRingBuffer records that wrap around the end of the ring
+//
+// Pushes records of sizes up to max_record_size at offsets close to the end
+// of the ring, so most of them need padding, and checks that each one fits
+// the drained ring and comes back intact. A producer thread then
+// streams large records to a consumer thread.
+//
+// Build & run:
+//   g++ -std=c++20 -O2 -pthread -o byte_ring_buffer_test
+//       byte_ring_buffer_test.cpp
+//   ./byte_ring_buffer_test
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "byte_ring_buffer.h"
+#include "test_util.h"
+
+namespace {
+
+constexpr size_t capacity = 4096;
+using Ring = ByteRingBuffer<capacity>;
+
+void fill(std::vector<uint8_t>& data, size_t len, unsigned seed) {
+  data.resize(len);
+  for (size_t n = 0; n < len; n++) data[n] = static_cast<uint8_t>(seed + n);
+}
+
+bool pop_equal(Ring& ring, const std::vector<uint8_t>& expected) {
+  std::span<const uint8_t> msg = ring.peek();
+  if (!msg.data()) return false;
+  bool equal = msg.size() == expected.size() &&
+               memcmp(msg.data(), expected.data(), msg.size()) == 0;
+  ring.release();
+  return equal;
+}
+
+// Bytes a record takes in the ring, as ByteRingBuffer::record_size()
+size_t record_size(size_t len) { return (8 + len + 7) & ~size_t(7); }
+
+void test_large_record_wraps() {
+  auto ring = std::make_unique<Ring>();
+  std::vector<uint8_t> data;
+  CHECK(!ring->reserve(Ring::max_record_size + 1).data());
+
+  const uint8_t empty = 0;
+  size_t offset = 0;
+  for (size_t len = 1; len <= Ring::max_record_size; len += 7) {
+    // Move the write offset close to the end of the ring with empty records
+    size_t target = capacity - 8 * (1 + len % 97);
+    while (offset != target) {
+      CHECK(ring->push(&empty, 0));
+      CHECK(ring->peek().size() == 0);
+      ring->release();
+      offset = (offset + 8) % capacity;
+    }
+    // The ring is empty, the record must fit whether it wraps or not
+    fill(data, len, static_cast<unsigned>(len));
+    CHECK(ring->size() == 0);
+    CHECK(ring->push(data.data(), data.size()));
+    CHECK(pop_equal(*ring, data));
+    offset = offset + record_size(len) > capacity
+                 ? record_size(len)
+                 : (offset + record_size(len)) % capacity;
+  }
+}
+
+void test_stream_large_records() {
+  auto ring = std::make_unique<Ring>();
+  const unsigned messages = 200000;
+  std::thread producer([&] {
+    std::vector<uint8_t> data;
+    for (unsigned n = 0; n < messages; n++) {
+      fill(data, Ring::max_record_size - n % 512, n);
+      while (!ring->push(data.data(), data.size())) std::this_thread::yield();
+    }
+  });
+  std::vector<uint8_t> expected;
+  for (unsigned n = 0; n < messages; n++) {
+    fill(expected, Ring::max_record_size - n % 512, n);
+    std::span<const uint8_t> msg;
+    while (!(msg = ring->peek()).data()) std::this_thread::yield();
+    CHECK(msg.size() == expected.size() &&
+          memcmp(msg.data(), expected.data(), msg.size()) == 0);
+    ring->release();
+  }
+  producer.join();
+}
+
+}  // namespace
+
+int main() {
+  test_large_record_wraps();
+  test_stream_large_records();
+  return test_result();
+}
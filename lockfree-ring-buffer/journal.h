@@ -0,0 +1,466 @@
+// 1). Record/replay journal of RingBuffer traffic. The slots of the ring are
+// overwritten on the next wrap, the journal keeps every buffer that flowed
+// through it so an incident can be replayed offline (see journal_replay.cpp).
+//
+// 2). JournalConsumer polls the ring with ReadSlot() and appends the buffers
+// written since the last poll, in sequence_num order, to a JournalWriter. A
+// sequence number that was overwritten before it could be captured is counted
+// as lost. With several writers a poll stops at a gap while a slot is still
+// being written and the missing buffer may be in it, the next poll picks it
+// up. A missing buffer at least a ring behind the newest one seen was
+// overwritten and is counted as lost at once, so sustained writes do not
+// stall the journal.
+//
+// 3). JournalWriter appends records to memory-mapped segment files
+// <dir>/<prefix>-<first sequence_num>.journal. A segment is sized up front and
+// records are copied straight into the mapping, so appending makes no system
+// call. The number of bytes used is published in the segment header once per
+// batch (commit()). A segment that is full is truncated to its used size and
+// the next one is created, that is the only time files are touched.
+//
+// 4). Segment layout:
+//     a) JournalSegmentHeader - magic, version, buf_size of the ring, first
+//                               sequence number and the bytes of records used
+//     b) records              - JournalRecord followed by the payload, each
+//                               record padded to 8 bytes
+//
+// 5). The timestamp of a record is the wall clock time of the poll that
+// captured it, so replay timing has the resolution of the polling interval.
+//
+// All the functions return 0 (or a count) on success and -errno on error.
+//
+// Usage example:
+//
+// using Ring = RingBuffer<64, 1024, CacheLineLayout, FutexWait>;
+//
+// ** Journaling thread:
+// JournalWriter writer;
+// if (writer.open("/var/journal", "orders", Ring::buffer_size) != 0) { ... }
+// JournalConsumer<Ring> journal(ring, writer);
+// unsigned int last = 0;
+// while (running) {
+//   ring.WaitRead([](const uint8_t*, size_t, unsigned long long) { return 0; },
+//                 last);
+//   journal.Poll();
+// }
+//
+// ** Reading it back:
+// JournalReader reader;
+// reader.open("/var/journal", "orders");
+// JournalRecordView record;
+// while (reader.next(record) > 0) replay(record.data, record.size);
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Header at the start of a segment file
+struct JournalSegmentHeader {
+  static constexpr uint64_t magic_value = 0x314e52554f4a4252ULL;  // RBJOURN1
+  static constexpr uint32_t version_value = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  // buf_size of the journaled ring, the largest record payload
+  uint64_t buf_size;
+  uint64_t first_sequence_num;
+  // Bytes of records after the header, stored with release after a batch
+  std::atomic_uint64_t used;
+  // Set once the segment is complete
+  std::atomic_uint32_t closed;
+  uint32_t reserved;
+};
+
+// Header of a record, the payload follows
+struct JournalRecord {
+  uint64_t sequence_num;
+  // Wall clock time of the capture, ns since the epoch
+  int64_t timestamp_ns;
+  uint32_t size;
+  uint32_t reserved;
+};
+
+// Record read back from a journal, data points into the mapped segment
+struct JournalRecordView {
+  unsigned long long sequence_num;
+  long long timestamp_ns;
+  const uint8_t* data;
+  size_t size;
+};
+
+namespace detail {
+
+constexpr size_t journal_record_size(size_t payload) {
+  return (sizeof(JournalRecord) + payload + 7) & ~size_t(7);
+}
+
+inline long long wall_clock_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace detail
+
+class JournalWriter {
+ public:
+  static constexpr size_t default_segment_size = 64 << 20;
+
+  JournalWriter() = default;
+  JournalWriter(const JournalWriter&) = delete;
+  JournalWriter& operator=(const JournalWriter&) = delete;
+  ~JournalWriter() { close(); }
+
+  // Journal into dir, which must exist. The first segment is created by the
+  // first record. A segment holds at least one record of buf_size.
+  int open(const char* dir, const char* prefix, size_t buf_size,
+           size_t segment_size = default_segment_size) {
+    close();
+    if (segment_size <
+        sizeof(JournalSegmentHeader) + detail::journal_record_size(buf_size))
+      return -EINVAL;
+    m_dir = dir;
+    m_prefix = prefix;
+    m_buf_size = buf_size;
+    m_segment_size = segment_size;
+    return 0;
+  }
+
+  // Room for the payload of the next record, nullptr on error (error is set
+  // to -errno). Starts a new segment when the current one is full.
+  uint8_t* reserve(size_t size, unsigned long long sequence_num, int& error) {
+    if (size > m_buf_size) {
+      error = -EMSGSIZE;
+      return nullptr;
+    }
+    if (!m_base || m_position + detail::journal_record_size(size) > m_size) {
+      error = rotate(sequence_num);
+      if (error != 0) return nullptr;
+    }
+    return m_base + m_position + sizeof(JournalRecord);
+  }
+
+  // Append the record whose payload was filled in after reserve()
+  void append(unsigned long long sequence_num, long long timestamp_ns,
+              size_t size) {
+    JournalRecord* record =
+        reinterpret_cast<JournalRecord*>(m_base + m_position);
+    record->sequence_num = sequence_num;
+    record->timestamp_ns = timestamp_ns;
+    record->size = static_cast<uint32_t>(size);
+    record->reserved = 0;
+    m_position += detail::journal_record_size(size);
+    m_records++;
+  }
+
+  // Publish the records appended so far to readers of the segment
+  void commit() {
+    if (m_base)
+      header()->used.store(m_position - sizeof(JournalSegmentHeader),
+                           std::memory_order_release);
+  }
+
+  // Start writing the dirty pages back, without waiting for them
+  int flush() {
+    if (!m_base) return 0;
+    return msync(m_base, m_position, MS_ASYNC) == 0 ? 0 : -errno;
+  }
+
+  // Complete the current segment, the next record starts a new one
+  int close() {
+    if (!m_base) return 0;
+    commit();
+    header()->closed.store(1, std::memory_order_release);
+    munmap(m_base, m_size);
+    int retval = ftruncate(m_fd, m_position) == 0 ? 0 : -errno;
+    ::close(m_fd);
+    m_base = nullptr;
+    m_fd = -1;
+    return retval;
+  }
+
+  size_t buf_size() const { return m_buf_size; }
+  unsigned long long records() const { return m_records; }
+  unsigned long long segments() const { return m_segments; }
+
+ private:
+  JournalSegmentHeader* header() const {
+    return reinterpret_cast<JournalSegmentHeader*>(m_base);
+  }
+
+  // Complete the current segment and create the one starting at sequence_num
+  int rotate(unsigned long long sequence_num) {
+    int retval = close();
+    if (retval != 0) return retval;
+    if (m_dir.empty()) return -EBADF;
+
+    char name[32];
+    snprintf(name, sizeof(name), "-%020llu.journal", sequence_num);
+    std::string path = m_dir + "/" + m_prefix + name;
+    m_fd = ::open(path.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (m_fd < 0) return -errno;
+    m_size = m_segment_size;
+    void* base = MAP_FAILED;
+    if (ftruncate(m_fd, m_size) == 0)
+      base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (base == MAP_FAILED) {
+      retval = -errno;
+      ::close(m_fd);
+      unlink(path.c_str());
+      m_fd = -1;
+      return retval;
+    }
+    m_base = static_cast<uint8_t*>(base);
+
+    JournalSegmentHeader* hdr = new (m_base) JournalSegmentHeader();
+    hdr->magic = JournalSegmentHeader::magic_value;
+    hdr->version = JournalSegmentHeader::version_value;
+    hdr->header_size = sizeof(JournalSegmentHeader);
+    hdr->buf_size = m_buf_size;
+    hdr->first_sequence_num = sequence_num;
+    m_position = sizeof(JournalSegmentHeader);
+    m_segments++;
+    return 0;
+  }
+
+  std::string m_dir;
+  std::string m_prefix;
+  size_t m_buf_size = 0;
+  size_t m_segment_size = 0;
+  // Current segment
+  int m_fd = -1;
+  uint8_t* m_base = nullptr;
+  size_t m_size = 0;
+  size_t m_position = 0;
+  unsigned long long m_records = 0;
+  unsigned long long m_segments = 0;
+};
+
+// Reads the segments of a journal in sequence_num order. A segment that is
+// still being written is read up to its last commit at the time it is opened.
+class JournalReader {
+ public:
+  JournalReader() = default;
+  JournalReader(const JournalReader&) = delete;
+  JournalReader& operator=(const JournalReader&) = delete;
+  ~JournalReader() { unmap(); }
+
+  int open(const char* dir, const char* prefix) {
+    unmap();
+    m_dir = dir;
+    m_segments.clear();
+    m_next_segment = 0;
+    DIR* directory = opendir(dir);
+    if (!directory) return -errno;
+    std::string start = std::string(prefix) + "-";
+    const std::string end = ".journal";
+    while (const dirent* entry = readdir(directory)) {
+      std::string name = entry->d_name;
+      if (name.size() > start.size() + end.size() &&
+          name.compare(0, start.size(), start) == 0 &&
+          name.compare(name.size() - end.size(), end.size(), end) == 0)
+        m_segments.push_back(name);
+    }
+    closedir(directory);
+    // Sequence numbers are zero padded, so the names sort in journal order
+    std::sort(m_segments.begin(), m_segments.end());
+    return m_segments.empty() ? -ENOENT : 0;
+  }
+
+  // Read the next record, returns 1 for a record, 0 at the end of the journal
+  int next(JournalRecordView& record) {
+    while (!m_base || m_position == m_end) {
+      if (m_next_segment == m_segments.size()) return 0;
+      int retval = map(m_dir + "/" + m_segments[m_next_segment++]);
+      if (retval != 0) return retval;
+    }
+    if (m_end - m_position < sizeof(JournalRecord)) return -EBADMSG;
+    const JournalRecord* header =
+        reinterpret_cast<const JournalRecord*>(m_base + m_position);
+    size_t size = detail::journal_record_size(header->size);
+    if (header->size > m_buf_size || size > m_end - m_position)
+      return -EBADMSG;
+    record.sequence_num = header->sequence_num;
+    record.timestamp_ns = header->timestamp_ns;
+    record.data = m_base + m_position + sizeof(JournalRecord);
+    record.size = header->size;
+    m_position += size;
+    return 1;
+  }
+
+  // buf_size of the journaled ring, valid after the first record
+  size_t buf_size() const { return m_buf_size; }
+  size_t segments() const { return m_segments.size(); }
+
+ private:
+  int map(const std::string& path) {
+    unmap();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -errno;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      int retval = -errno;
+      ::close(fd);
+      return retval;
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(JournalSegmentHeader)) {
+      ::close(fd);
+      return -EBADMSG;
+    }
+    m_size = st.st_size;
+    void* base = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) return -errno;
+    m_base = static_cast<const uint8_t*>(base);
+
+    const JournalSegmentHeader* hdr =
+        reinterpret_cast<const JournalSegmentHeader*>(m_base);
+    if (hdr->magic != JournalSegmentHeader::magic_value) return -EBADMSG;
+    if (hdr->version != JournalSegmentHeader::version_value) return -EPROTO;
+    if (hdr->header_size != sizeof(JournalSegmentHeader)) return -EBADMSG;
+    uint64_t used = hdr->used.load(std::memory_order_acquire);
+    if (used > m_size - sizeof(JournalSegmentHeader)) return -EBADMSG;
+    m_buf_size = hdr->buf_size;
+    m_position = sizeof(JournalSegmentHeader);
+    m_end = m_position + used;
+    return 0;
+  }
+
+  void unmap() {
+    if (m_base) munmap(const_cast<uint8_t*>(m_base), m_size);
+    m_base = nullptr;
+    m_size = m_position = m_end = 0;
+  }
+
+  std::string m_dir;
+  std::vector<std::string> m_segments;
+  size_t m_next_segment = 0;
+  // Current segment
+  const uint8_t* m_base = nullptr;
+  size_t m_size = 0;
+  size_t m_position = 0;
+  size_t m_end = 0;
+  size_t m_buf_size = 0;
+};
+
+template <typename Ring>
+class JournalConsumer {
+ public:
+  // Bytes of a buffer worth keeping, the whole buffer by default
+  typedef std::function<size_t(const uint8_t*, size_t)> size_callback;
+
+  JournalConsumer(const Ring& ring, JournalWriter& writer,
+                  size_callback size_fn = nullptr)
+      : m_ring(ring), m_writer(writer), m_size_fn(std::move(size_fn)) {}
+
+  // Append the buffers written since the last poll and commit them. Returns
+  // the number of records appended or -errno.
+  int Poll() {
+    // Sequence numbers of the slots, without their data
+    size_t count = 0;
+    bool busy = false;
+    unsigned long long newest = 0;
+    for (size_t index = 0; index < Ring::num_buffers; index++) {
+      unsigned long long sequence_num = 0;
+      int retval;
+      typename Ring::SlotState state = m_ring.ReadSlot(
+          index,
+          [&](const uint8_t*, size_t, unsigned long long seq) {
+            sequence_num = seq;
+            return 0;
+          },
+          retval);
+      if (state == Ring::SLOT_BUSY) busy = true;
+      if (state != Ring::SLOT_READ) continue;
+      newest = std::max(newest, sequence_num);
+      if (m_started && sequence_num < m_next) continue;
+      m_pending[count++] = {sequence_num, index};
+    }
+    std::sort(m_pending.begin(), m_pending.begin() + count);
+    if (count && !m_started) {
+      m_started = true;
+      m_next = m_pending[0].sequence_num;
+    }
+
+    // Copy in order straight into the journal
+    long long timestamp_ns = detail::wall_clock_ns();
+    int appended = 0;
+    for (size_t n = 0; n < count; n++) {
+      const Pending& pending = m_pending[n];
+      if (pending.sequence_num != m_next) {
+        // The missing buffer may still be in a slot being written, unless a
+        // whole ring was written after it
+        if (busy && m_next + Ring::num_buffers > newest) break;
+        m_lost += pending.sequence_num - m_next;
+        m_next = pending.sequence_num;
+      }
+      int error;
+      uint8_t* payload =
+          m_writer.reserve(Ring::buffer_size, pending.sequence_num, error);
+      if (!payload) {
+        m_writer.commit();
+        return error;
+      }
+      size_t size = 0;
+      int retval;
+      typename Ring::SlotState state = m_ring.ReadSlot(
+          pending.index,
+          [&](const uint8_t* data, size_t buf_size, unsigned long long seq) {
+            if (seq != pending.sequence_num) return 1;
+            size = m_size_fn ? std::min(m_size_fn(data, buf_size), buf_size)
+                             : buf_size;
+            memcpy(payload, data, size);
+            return 0;
+          },
+          retval);
+      // Overwritten since the first pass, the next poll counts it as lost
+      if (state != Ring::SLOT_READ || retval != 0) break;
+      m_writer.append(pending.sequence_num, timestamp_ns, size);
+      m_next = pending.sequence_num + 1;
+      appended++;
+    }
+    m_writer.commit();
+    return appended;
+  }
+
+  // Sequence number of the next buffer to journal
+  unsigned long long next_sequence_num() const { return m_next; }
+  // Buffers overwritten before they could be journaled
+  unsigned long long lost() const { return m_lost; }
+
+ private:
+  struct Pending {
+    unsigned long long sequence_num;
+    size_t index;
+
+    bool operator<(const Pending& other) const {
+      return sequence_num < other.sequence_num;
+    }
+  };
+
+  const Ring& m_ring;
+  JournalWriter& m_writer;
+  size_callback m_size_fn;
+  std::array<Pending, Ring::num_buffers> m_pending;
+  bool m_started = false;
+  unsigned long long m_next = 0;
+  unsigned long long m_lost = 0;
+};
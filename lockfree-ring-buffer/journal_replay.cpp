@@ -0,0 +1,234 @@
+// Record and replay RingBuffer traffic with the journal (see journal.h)
+//
+// record - a writer publishes synthetic orders into a ring at a given rate
+//          while a journaling thread captures them. Prints the journal
+//          throughput and the number of buffers lost to ring wraps.
+// replay - feeds a journal back through RingBuffer::Write() at the original
+//          timing, scaled by --speed, or as fast as possible with --max.
+//          Reader threads consume the ring with WaitRead() and report how many
+//          buffers they saw, so consumers can be measured on recorded traffic.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o journal_replay journal_replay.cpp
+//   ./journal_replay record DIR PREFIX [messages] [rate_per_s]
+//   ./journal_replay replay DIR PREFIX [--speed X | --max] [--readers N]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "journal.h"
+#include "ring_buffer.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Ring = RingBuffer<256, 1024, CacheLineLayout, FutexWait>;
+
+struct Order {
+  long long timestamp_ns;
+  unsigned long long id;
+  double price;
+  unsigned int quantity;
+  char symbol[8];
+};
+
+long long now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+int ignore(const uint8_t*, size_t, unsigned long long) { return 0; }
+
+int record(const char* dir, const char* prefix, size_t messages, double rate) {
+  auto ring = std::make_unique<Ring>();
+  JournalWriter writer;
+  int retval = writer.open(dir, prefix, Ring::buffer_size);
+  if (retval != 0) {
+    fprintf(stderr, "journal_replay: %s: %s\n", dir, strerror(-retval));
+    return 1;
+  }
+  // Only the order is worth keeping, not the whole slot
+  JournalConsumer<Ring> journal(
+      *ring, writer, [](const uint8_t*, size_t) { return sizeof(Order); });
+
+  std::atomic_bool done = {false};
+  int error = 0;
+  std::thread journal_thread([&] {
+    unsigned int last = 0;
+    while (!done.load(std::memory_order_acquire)) {
+      ring->WaitRead(ignore, last);
+      int appended = journal.Poll();
+      if (appended < 0) {
+        error = appended;
+        return;
+      }
+    }
+    // The last write may still be in progress, it cannot be overwritten
+    while (journal.next_sequence_num() < messages) {
+      int appended = journal.Poll();
+      if (appended < 0) {
+        error = appended;
+        return;
+      }
+      if (appended == 0) std::this_thread::yield();
+    }
+  });
+
+  static const char* const symbols[] = {"AAPL", "MSFT", "NVDA", "AMZN"};
+  long long interval_ns = rate > 0 ? static_cast<long long>(1e9 / rate) : 0;
+  auto start = Clock::now();
+  for (size_t n = 0; n < messages; n++) {
+    if (interval_ns)
+      std::this_thread::sleep_until(start +
+                                    std::chrono::nanoseconds(n * interval_ns));
+    // The last write wakes the journal thread up to see the done flag
+    if (n == messages - 1) done.store(true, std::memory_order_release);
+    ring->Write([&](uint8_t* buf, size_t) {
+      Order order = {};
+      order.timestamp_ns = now_ns();
+      order.id = n;
+      order.price = 100 + (n % 1000) * 0.01;
+      order.quantity = 1 + n % 100;
+      memcpy(order.symbol, symbols[n % 4], 4);
+      memcpy(buf, &order, sizeof(order));
+      return 0;
+    });
+  }
+  journal_thread.join();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  writer.close();
+
+  if (error != 0) {
+    fprintf(stderr, "journal_replay: %s: %s\n", dir, strerror(-error));
+    return 1;
+  }
+  printf("%zu written, %llu journaled, %llu lost, %llu segments\n", messages,
+         writer.records(), journal.lost(), writer.segments());
+  printf("%.3f s, %.2f M records/s\n", elapsed.count(),
+         writer.records() / elapsed.count() / 1e6);
+  return 0;
+}
+
+int replay(const char* dir, const char* prefix, double speed, int readers) {
+  JournalReader reader;
+  int retval = reader.open(dir, prefix);
+  if (retval != 0) {
+    fprintf(stderr, "journal_replay: %s: %s\n", dir, strerror(-retval));
+    return 1;
+  }
+
+  auto ring = std::make_unique<Ring>();
+  std::atomic_bool done = {false};
+  std::vector<unsigned long long> reads(readers, 0);
+  std::vector<std::thread> threads;
+  for (int n = 0; n < readers; n++)
+    threads.emplace_back([&, n] {
+      unsigned int last = 0;
+      while (true) {
+        ring->WaitRead(ignore, last);
+        if (done.load(std::memory_order_acquire)) break;
+        reads[n]++;
+      }
+    });
+
+  JournalRecordView record = {};
+  unsigned long long records = 0;
+  long long first_ns = 0;
+  long long max_late_ns = 0;
+  auto start = Clock::now();
+  while ((retval = reader.next(record)) > 0) {
+    if (record.size > Ring::buffer_size) {
+      retval = -EMSGSIZE;
+      break;
+    }
+    if (records == 0) first_ns = record.timestamp_ns;
+    if (speed > 0) {
+      auto due = start + std::chrono::nanoseconds(static_cast<long long>(
+                             (record.timestamp_ns - first_ns) / speed));
+      std::this_thread::sleep_until(due);
+      long long late_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                               due)
+              .count();
+      if (late_ns > max_late_ns) max_late_ns = late_ns;
+    }
+    ring->Write([&](uint8_t* buf, size_t) {
+      memcpy(buf, record.data, record.size);
+      return 0;
+    });
+    records++;
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  // Wake the readers up to see the done flag
+  done.store(true, std::memory_order_release);
+  ring->Write([](uint8_t*, size_t) { return 0; });
+  for (std::thread& thread : threads) thread.join();
+
+  if (retval < 0) {
+    fprintf(stderr, "journal_replay: %s: %s\n", dir, strerror(-retval));
+    return 1;
+  }
+  printf("%llu records from %zu segments, %.3f s, %.2f M records/s\n", records,
+         reader.segments(), elapsed.count(),
+         records / elapsed.count() / 1e6);
+  if (speed > 0) printf("max lateness %.1f us\n", max_late_ns / 1e3);
+  for (int n = 0; n < readers; n++)
+    printf("reader %d: %llu reads (%.1f%%)\n", n, reads[n],
+           records ? 100.0 * reads[n] / records : 0.0);
+  return 0;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: journal_replay record DIR PREFIX [messages] [rate_per_s]\n"
+          "       journal_replay replay DIR PREFIX [--speed X | --max] "
+          "[--readers N]\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 4) {
+    usage();
+    return 2;
+  }
+  if (strcmp(argv[1], "record") == 0) {
+    size_t messages = argc > 4 ? strtoul(argv[4], nullptr, 10) : 1000000;
+    double rate = argc > 5 ? strtod(argv[5], nullptr) : 0;
+    if (messages == 0) {
+      usage();
+      return 2;
+    }
+    return record(argv[2], argv[3], messages, rate);
+  }
+  if (strcmp(argv[1], "replay") == 0) {
+    double speed = 1;
+    int readers = 1;
+    for (int n = 4; n < argc; n++) {
+      if (strcmp(argv[n], "--max") == 0) {
+        speed = 0;
+      } else if (strcmp(argv[n], "--speed") == 0 && n + 1 < argc) {
+        speed = strtod(argv[++n], nullptr);
+      } else if (strcmp(argv[n], "--readers") == 0 && n + 1 < argc) {
+        readers = atoi(argv[++n]);
+      } else {
+        usage();
+        return 2;
+      }
+    }
+    if (speed < 0 || readers < 0) {
+      usage();
+      return 2;
+    }
+    return replay(argv[2], argv[3], speed, readers);
+  }
+  usage();
+  return 2;
+}
@@ -0,0 +1,240 @@
+// Test of the journal (see journal.h) against sustained writes
+//
+// Writer threads fill a ring without pause while a journaling thread polls
+// it. Every writer stores its id and its own message count at both ends of
+// a buffer. The journal read back must hold consistent records in strictly
+// increasing sequence_num order with the count of every writer increasing,
+// and the records plus the buffers counted as lost must cover every write.
+// The journal must keep capturing records while the writes go on instead of
+// waiting at a gap for a buffer that was long overwritten, also when another
+// slot is stuck in the middle of a write.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o journal_test journal_test.cpp
+//   ./journal_test [writes]
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "journal.h"
+#include "ring_buffer.h"
+#include "test_util.h"
+
+namespace {
+
+constexpr size_t buf_size = 64;
+
+struct Message {
+  unsigned long long writer;
+  unsigned long long count;
+};
+
+int write_message(uint8_t* buf, size_t size, const Message& message) {
+  memcpy(buf, &message, sizeof(message));
+  memcpy(buf + size - sizeof(message), &message, sizeof(message));
+  return 0;
+}
+
+// Temporary journal directory, removed with its segments
+struct TempDir {
+  std::string path;
+
+  TempDir() {
+    char name[] = "/tmp/journal_test.XXXXXX";
+    if (mkdtemp(name)) path = name;
+  }
+  ~TempDir() {
+    if (path.empty()) return;
+    if (DIR* directory = opendir(path.c_str())) {
+      while (const dirent* entry = readdir(directory))
+        if (entry->d_name[0] != '.')
+          unlink((path + "/" + entry->d_name).c_str());
+      closedir(directory);
+    }
+    rmdir(path.c_str());
+  }
+};
+
+// Read the journal back, returns the number of records and the sequence_num
+// of the first one
+unsigned long long check_journal(const char* dir, const char* prefix,
+                                 int writers, unsigned long long& first_seq) {
+  JournalReader reader;
+  CHECK(reader.open(dir, prefix) == 0);
+  std::vector<long long> counts(writers, -1);
+  JournalRecordView record = {};
+  unsigned long long records = 0;
+  unsigned long long previous = 0;
+  int retval;
+  while ((retval = reader.next(record)) > 0) {
+    CHECK(record.size == buf_size);
+    if (record.size != buf_size) break;
+    Message first, last;
+    memcpy(&first, record.data, sizeof(first));
+    memcpy(&last, record.data + record.size - sizeof(last), sizeof(last));
+    CHECK(first.writer == last.writer && first.count == last.count);
+    CHECK(first.writer < static_cast<unsigned long long>(writers));
+    if (first.writer >= static_cast<unsigned long long>(writers)) break;
+    CHECK(static_cast<long long>(first.count) > counts[first.writer]);
+    counts[first.writer] = first.count;
+    CHECK(records == 0 || record.sequence_num > previous);
+    if (records == 0) first_seq = record.sequence_num;
+    previous = record.sequence_num;
+    records++;
+  }
+  CHECK(retval == 0);
+  return records;
+}
+
+// Writes to part of the ring, the empty slots are neither data nor busy
+void test_unfilled_ring() {
+  constexpr size_t n_buffers = 16;
+  using Ring = RingBuffer<n_buffers, buf_size>;
+  TempDir dir;
+  CHECK(!dir.path.empty());
+  auto ring = std::make_unique<Ring>();
+  JournalWriter writer;
+  CHECK(writer.open(dir.path.c_str(), "unfilled", buf_size) == 0);
+  JournalConsumer<Ring> journal(*ring, writer);
+  CHECK(journal.Poll() == 0);
+
+  for (unsigned long long n = 0; n < n_buffers / 2; n++)
+    ring->Write([&](uint8_t* buf, size_t size) {
+      return write_message(buf, size, {0, n});
+    });
+  CHECK(journal.Poll() == static_cast<int>(n_buffers / 2));
+  CHECK(journal.Poll() == 0);
+  CHECK(journal.next_sequence_num() == n_buffers / 2);
+  CHECK(journal.lost() == 0);
+  writer.close();
+  unsigned long long first_seq = 1;
+  CHECK(check_journal(dir.path.c_str(), "unfilled", 1, first_seq) ==
+        n_buffers / 2);
+  CHECK(first_seq == 0);
+}
+
+// A writer is stuck in the middle of a write while the buffer the journal
+// waits for was overwritten a lap ago, the poll must count it as lost and
+// carry on instead of waiting for the stuck write
+void test_gap_behind_busy_slot() {
+  constexpr size_t n_buffers = 4;
+  using Ring = RingBuffer<n_buffers, buf_size>;
+  TempDir dir;
+  CHECK(!dir.path.empty());
+  auto ring = std::make_unique<Ring>();
+  JournalWriter writer;
+  CHECK(writer.open(dir.path.c_str(), "gap", buf_size) == 0);
+  JournalConsumer<Ring> journal(*ring, writer);
+  auto write = [&](unsigned long long n) {
+    ring->Write([&](uint8_t* buf, size_t size) {
+      return write_message(buf, size, {0, n});
+    });
+  };
+
+  write(0);
+  CHECK(journal.Poll() == 1);
+  // 1 .. 4 are overwritten, the ring holds 5 .. 8
+  for (unsigned long long n = 1; n <= 2 * n_buffers; n++) write(n);
+
+  // Write 9 takes the slot of 5 and does not finish
+  std::atomic_bool writing = {false};
+  std::atomic_bool release = {false};
+  std::thread stuck([&] {
+    ring->Write([&](uint8_t* buf, size_t size) {
+      writing = true;
+      while (!release) std::this_thread::yield();
+      return write_message(buf, size, {0, 2 * n_buffers + 1});
+    });
+  });
+  while (!writing) std::this_thread::yield();
+  CHECK(journal.Poll() == static_cast<int>(n_buffers - 1));
+  CHECK(journal.lost() == n_buffers + 1);
+  CHECK(journal.next_sequence_num() == 2 * n_buffers + 1);
+
+  release = true;
+  stuck.join();
+  CHECK(journal.Poll() == 1);
+  CHECK(journal.next_sequence_num() == 2 * n_buffers + 2);
+  writer.close();
+  unsigned long long first_seq = 1;
+  CHECK(check_journal(dir.path.c_str(), "gap", 1, first_seq) == n_buffers + 1);
+  CHECK(first_seq == 0);
+}
+
+void test_sustained_writes(unsigned long long writes, int writers) {
+  using Ring = RingBuffer<1024, buf_size>;
+  TempDir dir;
+  CHECK(!dir.path.empty());
+  auto ring = std::make_unique<Ring>();
+  JournalWriter writer;
+  CHECK(writer.open(dir.path.c_str(), "sustained", buf_size) == 0);
+  JournalConsumer<Ring> journal(*ring, writer);
+
+  std::atomic_int running = {writers};
+  std::vector<std::thread> threads;
+  for (int id = 0; id < writers; id++)
+    threads.emplace_back([&, id] {
+      for (unsigned long long n = 0; n < writes; n++) {
+        ring->Write([&](uint8_t* buf, size_t size) {
+          return write_message(buf, size, {static_cast<unsigned long long>(id),
+                                           n});
+        });
+        // Some work between the messages, the journal can keep up then
+        for (int spin = 0; spin < 64; spin++) detail::cpu_relax();
+      }
+      running--;
+    });
+
+  // Records captured while every writer was still writing
+  unsigned long long captured = 0;
+  int error = 0;
+  while (running.load() == writers) {
+    int appended = journal.Poll();
+    if (appended < 0) error = appended;
+    if (appended <= 0) continue;
+    captured += appended;
+  }
+  for (std::thread& thread : threads) thread.join();
+  unsigned long long total = writes * writers;
+  while (journal.next_sequence_num() < total) {
+    int appended = journal.Poll();
+    if (appended < 0) {
+      error = appended;
+      break;
+    }
+  }
+  CHECK(error == 0);
+  writer.close();
+
+  // The journal starts at the oldest buffer of its first poll, which may be
+  // lost before the first record
+  unsigned long long first_seq = 0;
+  unsigned long long records =
+      check_journal(dir.path.c_str(), "sustained", writers, first_seq);
+  CHECK(records == writer.records());
+  CHECK(records + journal.lost() <= total);
+  CHECK(first_seq + records + journal.lost() >= total);
+  // Well below what the journal keeps up with, but a stalled one captures
+  // next to nothing
+  CHECK(captured >= total / 1000);
+  printf("%d writers, %llu writes: %llu journaled (%llu while writing), "
+         "%llu lost\n",
+         writers, total, records, captured, journal.lost());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  unsigned long long writes =
+      argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  test_unfilled_ring();
+  test_gap_behind_busy_slot();
+  test_sustained_writes(writes, 1);
+  test_sustained_writes(writes, 4);
+  return test_result();
+}
@@ -1,31 +1,68 @@
 // 1). This implementation of a simple circular buffer
+//
+// 2). Every slot is guarded by a single sequence counter (seqlock). A writer
+// makes the counter odd before it touches the slot and even again once it is
+// done, so a reader that sees the same even value before and after its read
+// knows that the data was not modified underneath it.
+//
+// 3). Write() and Read() take the callback as a template parameter so lambdas
+// are inlined on the hot path. The write_callback and read_callback
+// std::function typedefs are still accepted, they are just another callable.
+//
+// 4). Readers never write to the ring, so Read() is const and works on a
+// read-only mapping of the ring (see shm_ring_buffer.h).
+//
+// 5). The Layout template parameter (see slot_layout.h) controls the padding
+// of the slots and of the shared indexes. The default keeps every hot counter
+// on its own cache line, PackedLayout restores the original compact layout.
+//
+// 6). The Wait template parameter (see wait_strategy.h) lets readers block in
+// WaitRead() until a writer publishes a new buffer. With the default NoWait
+// writers do no extra work.
+//
+// 7). ReadSlot() reads one slot by index whatever its age, so a consumer that
+// must see every write (the journal in journal.h) can scan the whole ring.
+//
+// Usage example:
+//
+// RingBuffer<16, 4096> ring;
+// ring.Write([&](uint8_t* buf, size_t size) { return serialize(buf, size); });
+//
+// ** Retry until a consistent snapshot is read:
+// ring.Read([&](const uint8_t* buf, size_t size, unsigned long long seq)
+//           { return deserialize(buf, size, seq); });
+//
+// ** Single attempt, caller decides what to do with a torn read:
+// bool corrupt;
+// ring.Read(read_fn, corrupt);
+//
+// ** Block until the next write (needs a blocking Wait strategy):
+// unsigned int last = 0;
+// ring.WaitRead(read_fn, last);
 #pragma once
 
 #include <array>
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 
-template <size_t n_buffers, size_t buf_size>
+#include "slot_layout.h"
+#include "wait_strategy.h"
+
+template <size_t n_buffers, size_t buf_size, typename Layout = CacheLineLayout,
+          typename Wait = NoWait>
 class RingBuffer {
  private:
-  // Single buffer
-  struct Buf {
-    std::array<uint8_t, buf_size> data;
-    // data sequence number (unique, monotonic increment)
+  // Single buffer, metadata first so the payload can start on a fresh line
+  struct alignas(Layout::slot_align) Buf {
+    // seqlock counter, odd while a write to the buffer is in progress
+    alignas(Layout::meta_align) std::atomic_ullong version;
+    // data sequence number (unique, monotonic increment), guarded by version
     std::atomic_ullong sequence_num;
-    // flog to check if write to buffer is active
-    std::atomic_bool write_active;
-    // number write operations
-    std::atomic_uint num_write_ops;
-    // number of active readers
-    std::atomic_uint num_readers;
-
-    constexpr Buf()
-        : sequence_num(0),
-          write_active(false),
-          num_write_ops(0),
-          num_readers(0) {}
+    alignas(Layout::meta_align) std::array<uint8_t, buf_size> data;
+
+    constexpr Buf() : version(0), sequence_num(0) {}
   };
 
  public:
@@ -38,62 +75,162 @@ class RingBuffer {
   typedef std::function<int(const uint8_t*, size_t, unsigned long long)>
       read_callback;
 
+  static constexpr size_t num_buffers = n_buffers;
+  static constexpr size_t buffer_size = buf_size;
+  using layout = Layout;
+  using wait_strategy = Wait;
+
+  // Result of ReadSlot()
+  enum SlotState {
+    // Consistent read, retval is set
+    SLOT_READ,
+    // Never written
+    SLOT_EMPTY,
+    // Being written, or written again during the read
+    SLOT_BUSY,
+  };
+
   // Write using callback
-  int Write(write_callback write) {
-    // Get next sequence num in atomic increments
-    unsigned long long sequence_num = m_seq_num++;
-    // Select buffer to write
-    unsigned int write_index = advance_head();
-    Buf& buf_to_write = m_circular_buffer.at(write_index);
-    // Do the write by setting write active and writing to buffer
-    // TODO (Related to processor architecture ARM vs x86) c++ can technically
-    // reorder these operations, being atomic they will get written to memory,
-    // but perhaps in opposite order. Investigate usage of
-    // std::memory_thread_fence(std::memory_order_release) or modify the store()
-    // and load() calls using memory_order_release and memory_order_acquire.
-    buf_to_write.write_active.store(true);
-    buf_to_write.num_write_ops++;
+  template <typename WriteFn>
+  int Write(WriteFn&& write) {
+    // Get next sequence num, only uniqueness is required so relaxed is enough
+    unsigned long long sequence_num =
+        m_seq_num.fetch_add(1, std::memory_order_relaxed);
+    // Take the next buffer by making its version odd before the head points
+    // to it, then publish the data with an even version. The release store
+    // orders the data before the version.
+    unsigned long long version;
+    Buf& buf_to_write = m_circular_buffer[advance_head(version)];
     // Store write success or fail
     int retval = write(buf_to_write.data.data(), buf_size);
-    buf_to_write.seq_num.store(sequence_num);
-    // Increment number of writes at the end and reset write_active flag
-    buf_to_write.num_write_ops++;
-    buf_to_write.write_active.store(false);
+    buf_to_write.sequence_num.store(sequence_num, std::memory_order_relaxed);
+    buf_to_write.version.store(version + 2, std::memory_order_release);
+    if constexpr (Wait::blocking) {
+      m_published.fetch_add(1, std::memory_order_seq_cst);
+      Wait::notify(m_published, m_waiters);
+    }
+    return retval;
+  }
+
+  // Read using callback, retries until the read was not torn by a writer
+  template <typename ReadFn>
+  int Read(ReadFn&& read) const {
+    int retval;
+    while (!try_read(read, retval)) detail::cpu_relax();
     return retval;
   }
 
-  // Read using callback
-  int Read(read_callback read, bool& corrupt) {
-    // Select buffer to read (head-1)
-    unsigned int head = m_head.load();
-    unsigned int read_index = (head == 0) ? (n_buffers - 1) : (head - 1);
-    Buf& buf_to_read = m_circular_buffer.at(read_index);
-    // Do the read and detect whether writing happend during reading
-    bool write_at_start = buf_to_read.write_active.load();
-    unsigned int ops_at_start = buf_to_read.num_write_ops.load();
-    buf_to_read.num_readers++;
-    int retval = read(buf_to_read.data.data(), buf_size, buf_to_read.seq_num);
-    buf_to_read.num_readers--;
-    unsigned int ops_at_end = buf_to_read.num_writeops.load();
-    bool write_at_end = buf_to_read.write_active.load();
-    corrupt = (write_at_start || write_at_end || (ops_at_start != ops_at_end));
+  // Read using callback, single attempt. The corrupt flag is set when a write
+  // happened during reading and the callback may have seen a torn buffer.
+  template <typename ReadFn>
+  int Read(ReadFn&& read, bool& corrupt) const {
+    int retval = 0;
+    corrupt = !try_read(read, retval);
     return retval;
   }
 
+  // Read the slot at index (0 .. n_buffers - 1), single attempt. The callback
+  // is not called for an empty slot, on SLOT_BUSY it may have seen a torn
+  // buffer.
+  template <typename ReadFn>
+  SlotState ReadSlot(size_t index, ReadFn&& read, int& retval) const {
+    const Buf& buf_to_read = m_circular_buffer[index];
+    unsigned long long version_at_start =
+        buf_to_read.version.load(std::memory_order_acquire);
+    if (version_at_start == 0) return SLOT_EMPTY;
+    if (version_at_start & 1) return SLOT_BUSY;
+    retval = read(buf_to_read.data.data(), buf_size,
+                  buf_to_read.sequence_num.load(std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return buf_to_read.version.load(std::memory_order_relaxed) ==
+                   version_at_start
+               ? SLOT_READ
+               : SLOT_BUSY;
+  }
+
+  // Wait until a write newer than last_published completes and read it.
+  // last_published is updated, start with 0 to wait for the first write.
+  template <typename ReadFn>
+  int WaitRead(ReadFn&& read, unsigned int& last_published) const {
+    static_assert(Wait::blocking,
+                  "WaitRead() needs a blocking Wait strategy.");
+    last_published = Wait::wait(m_published, last_published, m_waiters);
+    return Read(read);
+  }
+
  private:
-  // Advance the head pointer in a thread-safe way
-  unsigned int advance_head() {
-    unsigned int next_head;
-    unsigned int current_head = m_head.load();
-    do {
-      next_head = (current_head == n_buffers - 1) ? 0 : current_head + 1;
-    } while (!m_head.compare_exchange_weak(current_head, next_head));
-    return next_head;
+  // Single read attempt of the latest written buffer. That is the head, or
+  // head-1 while the head is still being written.
+  // Returns false if the read overlapped a write.
+  template <typename ReadFn>
+  bool try_read(ReadFn& read, int& retval) const {
+    unsigned int head = m_head.load(std::memory_order_acquire);
+    const Buf* buf = &m_circular_buffer[head];
+    unsigned long long version_at_start =
+        buf->version.load(std::memory_order_acquire);
+    if (version_at_start & 1) {
+      unsigned int read_index = (head == 0) ? (n_buffers - 1) : (head - 1);
+      buf = &m_circular_buffer[read_index];
+      version_at_start = buf->version.load(std::memory_order_acquire);
+    }
+    const Buf& buf_to_read = *buf;
+    // Writer is active, do not bother calling back on data being modified
+    if (version_at_start & 1) return false;
+    retval = read(buf_to_read.data.data(), buf_size,
+                  buf_to_read.sequence_num.load(std::memory_order_relaxed));
+    // Keep the reads of the data from moving below the version check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return buf_to_read.version.load(std::memory_order_relaxed) ==
+           version_at_start;
+  }
+
+  // Try to lock the buffer for writing by moving its version from even to
+  // odd. Fails if another writer holds the buffer. On success version is the
+  // even version.
+  bool try_lock_slot(Buf& buf, unsigned long long& version) {
+    version = buf.version.load(std::memory_order_relaxed);
+    if ((version & 1) ||
+        !buf.version.compare_exchange_strong(version, version + 1,
+                                             std::memory_order_relaxed))
+      return false;
+    // Odd version must be visible before any of the data stores
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+  }
+
+  // Advance the head pointer in a thread-safe way. The buffer is locked
+  // before the head is published, so a reader never finds a completed write
+  // of the previous lap under the head. A buffer held by another writer
+  // usually means the head has moved on, so the head is reloaded instead of
+  // waiting for that buffer. Returns the new head and the even version of
+  // its buffer.
+  unsigned int advance_head(unsigned long long& version) {
+    unsigned int current_head = m_head.load(std::memory_order_relaxed);
+    while (true) {
+      unsigned int next_head =
+          (current_head == n_buffers - 1) ? 0 : current_head + 1;
+      Buf& buf = m_circular_buffer[next_head];
+      if (!try_lock_slot(buf, version)) {
+        detail::cpu_relax();
+        current_head = m_head.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (m_head.compare_exchange_strong(current_head, next_head,
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_relaxed))
+        return next_head;
+      // Another writer moved the head, give the buffer back untouched
+      buf.version.store(version, std::memory_order_release);
+    }
   }
 
   std::array<Buf, n_buffers> m_circular_buffer;
   // Buff being written
-  std::atomic_uint m_head = {0};
+  alignas(Layout::index_align) std::atomic_uint m_head = {0};
   // sequence counter
-  std::atomic_ullong m_seq_num = {0};
-}
+  alignas(Layout::index_align) std::atomic_ullong m_seq_num = {0};
+  // Completed writes, the word blocking readers wait on (unused with NoWait)
+  alignas(Layout::index_align) std::atomic_uint m_published = {0};
+  // Number of readers parked on m_published
+  alignas(Layout::index_align) mutable std::atomic_uint m_waiters = {0};
+};
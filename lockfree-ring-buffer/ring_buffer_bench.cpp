@@ -0,0 +1,127 @@
+// Microbenchmark of RingBuffer slot layouts
+//
+// Runs the same mix of writer and reader threads over each layout policy and
+// prints time and hardware cache misses per operation. Cache misses are read
+// with perf_event_open(), if the kernel does not allow it (see
+// /proc/sys/kernel/perf_event_paranoid) only the time is reported.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o ring_buffer_bench ring_buffer_bench.cpp
+//   ./ring_buffer_bench [writers] [readers] [ops_per_thread]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ring_buffer.h"
+
+namespace {
+
+constexpr size_t n_buffers = 64;
+constexpr size_t buf_size = 64;
+
+// Cache miss counter for this process and all threads it spawns afterwards
+class CacheMissCounter {
+ public:
+  CacheMissCounter() {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    m_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~CacheMissCounter() {
+    if (m_fd >= 0) close(m_fd);
+  }
+
+  bool valid() const { return m_fd >= 0; }
+  void start() {
+    if (m_fd < 0) return;
+    ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  // Inherited counters are only summed into the parent once children exit,
+  // so this must be called after the worker threads are joined
+  unsigned long long stop() {
+    unsigned long long count = 0;
+    if (m_fd < 0) return 0;
+    ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(m_fd, &count, sizeof(count)) != sizeof(count)) return 0;
+    return count;
+  }
+
+ private:
+  long m_fd = -1;
+};
+
+template <typename Layout>
+void run(const char* name, unsigned writers, unsigned readers, size_t ops) {
+  auto ring = std::make_unique<RingBuffer<n_buffers, buf_size, Layout>>();
+  CacheMissCounter counter;
+  std::vector<std::thread> threads;
+
+  counter.start();
+  auto begin = std::chrono::steady_clock::now();
+  for (unsigned w = 0; w < writers; w++) {
+    threads.emplace_back([&ring, ops, w] {
+      for (size_t n = 0; n < ops; n++) {
+        ring->Write([w, n](uint8_t* buf, size_t size) {
+          memset(buf, static_cast<int>(w + n), size);
+          return 0;
+        });
+      }
+    });
+  }
+  for (unsigned r = 0; r < readers; r++) {
+    threads.emplace_back([&ring, ops] {
+      unsigned long long sum = 0;
+      for (size_t n = 0; n < ops; n++) {
+        ring->Read([&sum](const uint8_t* buf, size_t, unsigned long long seq) {
+          sum += buf[0] + seq;
+          return 0;
+        });
+      }
+      // Keep the reads from being optimised away
+      if (sum == 1) std::puts("");
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  auto end = std::chrono::steady_clock::now();
+  unsigned long long misses = counter.stop();
+
+  double total_ops = static_cast<double>(ops) * (writers + readers);
+  double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+  std::printf("%-16s ring=%7zu B  %8.1f ns/op", name, sizeof(*ring),
+              ns / total_ops);
+  if (counter.valid())
+    std::printf("  %6.2f cache-misses/op", misses / total_ops);
+  std::printf("\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  unsigned writers = argc > 1 ? std::atoi(argv[1]) : 8;
+  unsigned readers = argc > 2 ? std::atoi(argv[2]) : 2;
+  size_t ops = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1000000;
+
+  std::printf("writers=%u readers=%u ops/thread=%zu\n", writers, readers, ops);
+  run<PackedLayout>("PackedLayout", writers, readers, ops);
+  run<CacheLineLayout>("CacheLineLayout", writers, readers, ops);
+  run<PageLayout>("PageLayout", writers, readers, ops);
+  return EXIT_SUCCESS;
+}
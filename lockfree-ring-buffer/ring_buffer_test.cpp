@@ -0,0 +1,161 @@
+// Stress test of RingBuffer reads against concurrent writes
+//
+// A single writer stores its sequence number at both ends of every buffer
+// while reader threads read the latest buffer in a loop. Every read must be
+// consistent (both copies equal to the sequence number the ring reports) and
+// the sequence numbers one reader sees must never go backwards, a read of a
+// slot from the previous lap would. WaitRead() must return the write that
+// woke the reader or a newer one. With several writers the reads must still
+// be consistent.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o ring_buffer_test ring_buffer_test.cpp
+//   ./ring_buffer_test [writes]
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ring_buffer.h"
+#include "test_util.h"
+
+namespace {
+
+constexpr size_t n_buffers = 4;
+constexpr size_t buf_size = 64;
+
+int write_sequence(uint8_t* buf, size_t size, unsigned long long value) {
+  memcpy(buf, &value, sizeof(value));
+  memcpy(buf + size - sizeof(value), &value, sizeof(value));
+  return 0;
+}
+
+// Reads the latest buffer, returns its sequence number or -1 if it is torn
+template <typename Ring>
+long long read_sequence(const Ring& ring) {
+  long long result = -1;
+  ring.Read([&](const uint8_t* buf, size_t size, unsigned long long seq) {
+    unsigned long long first, last;
+    memcpy(&first, buf, sizeof(first));
+    memcpy(&last, buf + size - sizeof(last), sizeof(last));
+    // Attempts torn by a writer are retried, the last one counts
+    result = first == seq && last == seq ? static_cast<long long>(seq) : -1;
+    return 0;
+  });
+  return result;
+}
+
+template <typename Ring>
+void write_all(Ring& ring, unsigned long long writes,
+               std::atomic_ullong& sequence) {
+  for (unsigned long long n = 0; n < writes; n++)
+    ring.Write([&](uint8_t* buf, size_t size) {
+      // The ring assigns sequence numbers in the order Write() is entered
+      return write_sequence(buf, size, sequence.fetch_add(1));
+    });
+}
+
+void test_single_writer(unsigned long long writes, int readers) {
+  auto ring = std::make_unique<RingBuffer<n_buffers, buf_size>>();
+  // Sequence numbers start with 0 like the ring's own
+  std::atomic_ullong sequence = {0};
+  ring->Write([&](uint8_t* buf, size_t size) {
+    return write_sequence(buf, size, sequence.fetch_add(1));
+  });
+  std::atomic_bool done = {false};
+  std::atomic_ullong backwards = {0};
+  std::atomic_ullong torn = {0};
+  std::vector<std::thread> threads;
+  for (int n = 0; n < readers; n++)
+    threads.emplace_back([&] {
+      long long last = -1;
+      while (!done.load(std::memory_order_relaxed)) {
+        long long seq = read_sequence(*ring);
+        if (seq < 0)
+          torn++;
+        else if (seq < last)
+          backwards++;
+        else
+          last = seq;
+      }
+    });
+  write_all(*ring, writes, sequence);
+  done = true;
+  for (std::thread& thread : threads) thread.join();
+  printf("single writer: %llu torn, %llu backwards\n", torn.load(),
+         backwards.load());
+  CHECK(torn == 0);
+  CHECK(backwards == 0);
+}
+
+void test_wait_read(unsigned long long writes) {
+  auto ring =
+      std::make_unique<RingBuffer<n_buffers, buf_size, CacheLineLayout,
+                                  FutexWait>>();
+  std::atomic_ullong sequence = {0};
+  std::atomic_bool done = {false};
+  unsigned long long stale = 0;
+  std::thread reader([&] {
+    unsigned int last = 0;
+    while (!done.load(std::memory_order_acquire)) {
+      long long seq = -1;
+      ring->WaitRead(
+          [&](const uint8_t*, size_t, unsigned long long s) {
+            seq = static_cast<long long>(s);
+            return 0;
+          },
+          last);
+      // last is the number of completed writes, the one that woke the
+      // reader has sequence number last - 1
+      if (seq < static_cast<long long>(last) - 1) stale++;
+    }
+  });
+  write_all(*ring, writes, sequence);
+  done.store(true, std::memory_order_release);
+  ring->Write([](uint8_t*, size_t) { return 0; });
+  reader.join();
+  printf("wait read: %llu stale\n", stale);
+  CHECK(stale == 0);
+}
+
+void test_many_writers(unsigned long long writes, int writers) {
+  auto ring = std::make_unique<RingBuffer<n_buffers, buf_size>>();
+  std::atomic_bool done = {false};
+  unsigned long long torn = 0;
+  std::thread reader([&] {
+    while (!done.load(std::memory_order_relaxed))
+      // Each writer stores a value of its own, both copies must match
+      torn += ring->Read([](const uint8_t* buf, size_t size,
+                            unsigned long long) {
+        return memcmp(buf, buf + size - sizeof(uint64_t), sizeof(uint64_t)) !=
+               0;
+      });
+  });
+  std::vector<std::thread> threads;
+  for (int n = 0; n < writers; n++)
+    threads.emplace_back([&, n] {
+      for (unsigned long long i = 0; i < writes / writers; i++)
+        ring->Write([&](uint8_t* buf, size_t size) {
+          return write_sequence(buf, size, i * writers + n);
+        });
+    });
+  for (std::thread& thread : threads) thread.join();
+  done = true;
+  reader.join();
+  printf("%d writers: %llu torn\n", writers, torn);
+  CHECK(torn == 0);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  unsigned long long writes =
+      argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+  test_single_writer(writes, 2);
+  test_wait_read(writes / 10);
+  test_many_writers(writes, 3);
+  return test_result();
+}
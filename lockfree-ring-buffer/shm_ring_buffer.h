@@ -0,0 +1,260 @@
+// 1). Shared memory placement for RingBuffer, so a producer and a consumer in
+// different processes exchange data through the ring without any copy.
+//
+// 2). The segment is either a POSIX shm object (shm_open) that is attached by
+// name, or an anonymous memfd that is shared by fd (inherited over fork(),
+// passed with SCM_RIGHTS or opened through /proc/<pid>/fd/<fd>).
+//
+// 3). Segment layout:
+//     a) first page - ShmRingHeader with magic, version, the geometry and
+//                     layout of the ring and the tag of its Wait strategy, so
+//                     a process built with a different RingBuffer
+//                     instantiation refuses to attach
+//     b) next pages - the RingBuffer object itself, constructed in place by
+//                     the creator
+//
+// 4). RingBuffer readers never write to the ring, so the consumer can map the
+// segment read-only. Only the creator writes. The exception is a ring with a
+// blocking Wait strategy: a reader parked in WaitRead() registers itself in
+// the ring, so such a ring must be attached writable and a read-only attach
+// fails with -EINVAL.
+//
+// 5). With HUGE_PAGES the memfd is backed by hugetlbfs (MFD_HUGETLB, pages
+// must be reserved in /proc/sys/vm/nr_hugepages), a shm object is advised to
+// use transparent huge pages (MADV_HUGEPAGE).
+//
+// All the functions return 0 on success and -errno on error.
+//
+// Usage example:
+//
+// using Ring = RingBuffer<64, 1024>;
+//
+// ** Producer:
+// ShmRingBuffer<Ring> shm;
+// if (shm.create("/market_data") != 0) { // handle error }
+// shm.writer()->Write(write_fn);
+//
+// ** Consumer (another process):
+// ShmRingBuffer<Ring> shm;
+// if (shm.attach("/market_data") != 0) { // handle error }
+// shm.reader()->Read(read_fn);
+//
+// ** Anonymous segment shared with a child process:
+// ShmRingBuffer<Ring> shm;
+// shm.create_memfd("market_data");
+// if (fork() == 0) { ShmRingBuffer<Ring> child; child.attach_fd(shm.fd()); }
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ring_buffer.h"
+
+// Header at the start of the shared segment
+struct ShmRingHeader {
+  static constexpr uint64_t magic_value = 0x31465542474e4952ULL;  // RINGBUF1
+  static constexpr uint32_t version_value = 2;
+
+  // Written last by the creator, zero while the ring is being constructed
+  std::atomic_uint64_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  // Offset and size of the RingBuffer object within the segment
+  uint64_t ring_offset;
+  uint64_t ring_size;
+  // RingBuffer geometry
+  uint64_t n_buffers;
+  uint64_t buf_size;
+  // RingBuffer layout and wait strategy
+  uint64_t meta_align;
+  uint64_t slot_align;
+  uint64_t index_align;
+  uint32_t wait_tag;
+};
+
+template <typename Ring>
+class ShmRingBuffer {
+  static_assert(std::atomic_ullong::is_always_lock_free,
+                "Atomics in shared memory must be lock free.");
+
+ public:
+  enum Flags : unsigned {
+    NONE = 0,
+    HUGE_PAGES = 1 << 0,
+  };
+
+  ShmRingBuffer() = default;
+  ShmRingBuffer(const ShmRingBuffer&) = delete;
+  ShmRingBuffer& operator=(const ShmRingBuffer&) = delete;
+  ~ShmRingBuffer() { close(); }
+
+  // Create a new POSIX shm object, name has the form "/name"
+  int create(const char* name, unsigned flags = NONE) {
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return -errno;
+    m_name = name;
+    int retval = init(fd, flags);
+    if (retval != 0) unlink();
+    return retval;
+  }
+
+  // Create a new anonymous memfd segment, name is only used for debugging
+  int create_memfd(const char* name, unsigned flags = NONE) {
+    unsigned mfd_flags = (flags & HUGE_PAGES) ? MFD_HUGETLB : 0;
+    int fd = memfd_create(name, mfd_flags);
+    if (fd < 0) return -errno;
+    return init(fd, flags);
+  }
+
+  // Attach to an existing POSIX shm object. Rings with a blocking Wait
+  // strategy need a writable mapping, see 4).
+  int attach(const char* name, bool read_only = !blocking) {
+    if (read_only && blocking) return -EINVAL;
+    int fd = shm_open(name, read_only ? O_RDONLY : O_RDWR, 0);
+    if (fd < 0) return -errno;
+    return map_existing(fd, read_only);
+  }
+
+  // Attach to an existing segment by fd, the fd is duplicated so the caller
+  // keeps ownership of its own copy
+  int attach_fd(int fd, bool read_only = !blocking) {
+    if (read_only && blocking) return -EINVAL;
+    int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dup_fd < 0) return -errno;
+    return map_existing(dup_fd, read_only);
+  }
+
+  // Remove the shm object name, attached processes keep their mapping
+  int unlink() {
+    if (m_name.empty()) return 0;
+    int retval = shm_unlink(m_name.c_str()) == 0 ? 0 : -errno;
+    m_name.clear();
+    return retval;
+  }
+
+  // Unmap the segment, the creator does not destroy the ring as other
+  // processes may still be using it
+  void close() {
+    if (m_base) munmap(m_base, m_size);
+    if (m_fd >= 0) ::close(m_fd);
+    m_base = nullptr;
+    m_size = 0;
+    m_fd = -1;
+  }
+
+  int fd() const { return m_fd; }
+  // nullptr when not mapped, or mapped read-only for writer()
+  Ring* writer() { return m_read_only ? nullptr : ring(); }
+  const Ring* reader() const { return ring(); }
+
+ private:
+  static constexpr bool blocking = Ring::wait_strategy::blocking;
+  static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+  static constexpr size_t ring_offset =
+      (sizeof(ShmRingHeader) + page_size - 1) & ~(page_size - 1);
+
+  static_assert(alignof(Ring) <= page_size,
+                "Ring alignment must not exceed the page size.");
+
+  static size_t segment_size(unsigned flags) {
+    size_t align = (flags & HUGE_PAGES) ? huge_page_size : page_size;
+    return (ring_offset + sizeof(Ring) + align - 1) & ~(align - 1);
+  }
+
+  ShmRingHeader* header() const {
+    return static_cast<ShmRingHeader*>(m_base);
+  }
+  Ring* ring() const {
+    if (!m_base) return nullptr;
+    return std::launder(
+        reinterpret_cast<Ring*>(static_cast<uint8_t*>(m_base) + ring_offset));
+  }
+
+  // Size, map and construct the header and the ring in a new segment
+  int init(int fd, unsigned flags) {
+    m_fd = fd;
+    m_size = segment_size(flags);
+    if (ftruncate(fd, m_size) != 0) return fail();
+    m_base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m_base == MAP_FAILED) {
+      m_base = nullptr;
+      return fail();
+    }
+    if ((flags & HUGE_PAGES) && !m_name.empty())
+      madvise(m_base, m_size, MADV_HUGEPAGE);
+    m_read_only = false;
+
+    new (ring()) Ring();
+    ShmRingHeader* hdr = new (m_base) ShmRingHeader();
+    hdr->version = ShmRingHeader::version_value;
+    hdr->header_size = sizeof(ShmRingHeader);
+    hdr->ring_offset = ring_offset;
+    hdr->ring_size = sizeof(Ring);
+    hdr->n_buffers = Ring::num_buffers;
+    hdr->buf_size = Ring::buffer_size;
+    hdr->meta_align = Ring::layout::meta_align;
+    hdr->slot_align = Ring::layout::slot_align;
+    hdr->index_align = Ring::layout::index_align;
+    hdr->wait_tag = Ring::wait_strategy::tag;
+    // Ring and header must be complete before a consumer sees the magic
+    hdr->magic.store(ShmRingHeader::magic_value, std::memory_order_release);
+    return 0;
+  }
+
+  // Map an existing segment and validate its header
+  int map_existing(int fd, bool read_only) {
+    m_fd = fd;
+    struct stat st;
+    if (fstat(fd, &st) != 0) return fail();
+    if (static_cast<size_t>(st.st_size) < ring_offset + sizeof(Ring))
+      return fail(EINVAL);
+    m_size = st.st_size;
+    int prot = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    m_base = mmap(nullptr, m_size, prot, MAP_SHARED, fd, 0);
+    if (m_base == MAP_FAILED) {
+      m_base = nullptr;
+      return fail();
+    }
+    m_read_only = read_only;
+
+    const ShmRingHeader* hdr = header();
+    uint64_t magic = hdr->magic.load(std::memory_order_acquire);
+    // Creator has not finished constructing the ring yet
+    if (magic == 0) return fail(EAGAIN);
+    if (magic != ShmRingHeader::magic_value) return fail(EINVAL);
+    if (hdr->version != ShmRingHeader::version_value) return fail(EPROTO);
+    if (hdr->header_size != sizeof(ShmRingHeader) ||
+        hdr->ring_offset != ring_offset || hdr->ring_size != sizeof(Ring) ||
+        hdr->n_buffers != Ring::num_buffers ||
+        hdr->buf_size != Ring::buffer_size ||
+        hdr->meta_align != Ring::layout::meta_align ||
+        hdr->slot_align != Ring::layout::slot_align ||
+        hdr->index_align != Ring::layout::index_align ||
+        hdr->wait_tag != Ring::wait_strategy::tag)
+      return fail(EINVAL);
+    return 0;
+  }
+
+  // Release everything acquired so far and return -err
+  int fail(int err = errno) {
+    close();
+    return -err;
+  }
+
+  void* m_base = nullptr;
+  size_t m_size = 0;
+  int m_fd = -1;
+  bool m_read_only = true;
+  // Name of the shm object created by this process, empty for memfd
+  std::string m_name;
+};
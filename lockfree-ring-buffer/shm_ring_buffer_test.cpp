@@ -0,0 +1,213 @@
+// Test of ShmRingBuffer with the producer and the consumer in two processes
+//
+// The parent creates the segment and writes numbered messages, a child
+// started with fork() attaches to it and reads them. Every message carries
+// its number in the first and last word and a pattern derived from it in
+// between, the child checks each read against that and checks that the
+// numbers it sees never go backwards until it reads the stop message.
+// Covers a memfd shared by fd with a FutexWait ring read by WaitRead() and
+// a named shm object attached read-only with a polling Read(). Attaching with
+// a ring of the same size but another layout or Wait strategy must fail.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -o shm_ring_buffer_test shm_ring_buffer_test.cpp -lrt
+//   ./shm_ring_buffer_test [messages]
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "shm_ring_buffer.h"
+#include "test_util.h"
+
+namespace {
+
+constexpr size_t buf_size = 256;
+constexpr unsigned long long stop_message = ~0ULL;
+
+int write_message(uint8_t* buf, size_t size, unsigned long long number) {
+  memcpy(buf, &number, sizeof(number));
+  for (size_t n = sizeof(number); n < size - sizeof(number); n++)
+    buf[n] = static_cast<uint8_t>(number * 31 + n);
+  memcpy(buf + size - sizeof(number), &number, sizeof(number));
+  return 0;
+}
+
+// Consumer side of a message, tracks the last number seen
+struct Checker {
+  unsigned long long last = 0;
+  unsigned long long reads = 0;
+  bool stopped = false;
+  bool ok = true;
+
+  // Read callback, the message number must match the ring's sequence number
+  // as the parent is the only writer
+  int operator()(const uint8_t* buf, size_t size, unsigned long long seq) {
+    unsigned long long first, end;
+    memcpy(&first, buf, sizeof(first));
+    memcpy(&end, buf + size - sizeof(end), sizeof(end));
+    if (first != end) return 1;
+    if (first == stop_message) return 2;
+    if (first != seq) return 1;
+    for (size_t n = sizeof(first); n < size - sizeof(first); n++)
+      if (buf[n] != static_cast<uint8_t>(first * 31 + n)) return 1;
+    return 0;
+  }
+
+  // Result of a completed Read()
+  void check(int retval, unsigned long long seq) {
+    if (retval == 2) {
+      stopped = true;
+      return;
+    }
+    if (retval != 0 || seq < last) ok = false;
+    last = seq;
+    reads++;
+  }
+};
+
+// Exit status of the child, the messages were read back intact and in order
+template <typename Ring, typename Read>
+int read_until_stop(const char* test, const Ring& ring, Read&& read_next,
+                    unsigned long long messages) {
+  Checker checker;
+  unsigned long long seq = 0;
+  auto read = [&](const uint8_t* buf, size_t size, unsigned long long s) {
+    seq = s;
+    return checker(buf, size, s);
+  };
+  while (!checker.stopped) checker.check(read_next(ring, read), seq);
+  printf("%s: %llu reads of %llu messages\n", test, checker.reads, messages);
+  return checker.ok ? 0 : 1;
+}
+
+// The child writes a byte to the pipe once it is attached and reading
+void signal_ready(int ready[2]) {
+  char byte = 1;
+  close(ready[0]);
+  if (write(ready[1], &byte, 1) != 1) _exit(5);
+  close(ready[1]);
+}
+
+// Write the messages and the stop message once the child is ready, wait for
+// its verdict
+template <typename Ring>
+bool produce(Ring& ring, pid_t child, int ready[2], unsigned long long first,
+             unsigned long long messages) {
+  char byte;
+  close(ready[1]);
+  bool attached = read(ready[0], &byte, 1) == 1;
+  close(ready[0]);
+  if (!attached) {
+    waitpid(child, nullptr, 0);
+    return false;
+  }
+  for (unsigned long long n = first; n < messages; n++)
+    ring.Write(
+        [&](uint8_t* buf, size_t size) { return write_message(buf, size, n); });
+  ring.Write([](uint8_t* buf, size_t size) {
+    return write_message(buf, size, stop_message);
+  });
+  int status;
+  if (waitpid(child, &status, 0) != child) return false;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void test_memfd_wait_read(unsigned long long messages) {
+  using Ring = RingBuffer<16, buf_size, CacheLineLayout, FutexWait>;
+  ShmRingBuffer<Ring> shm;
+  CHECK(shm.create_memfd("shm_ring_buffer_test") == 0);
+  if (!shm.writer()) return;
+
+  int ready[2];
+  CHECK(pipe(ready) == 0);
+  pid_t child = fork();
+  if (child == 0) {
+    ShmRingBuffer<Ring> consumer;
+    // A parked reader writes to the ring, read-only is refused
+    if (consumer.attach_fd(shm.fd(), true) != -EINVAL) _exit(3);
+    if (consumer.attach_fd(shm.fd()) != 0) _exit(4);
+    signal_ready(ready);
+    unsigned int last = 0;
+    _exit(read_until_stop(
+        "memfd, WaitRead", *consumer.reader(),
+        [&](const Ring& ring, auto& read) { return ring.WaitRead(read, last); },
+        messages));
+  }
+  CHECK(child > 0);
+  CHECK(produce(*shm.writer(), child, ready, 0, messages));
+}
+
+void test_named_read_only(unsigned long long messages) {
+  using Ring = RingBuffer<16, buf_size>;
+  std::string name = "/shm_ring_buffer_test_" + std::to_string(getpid());
+  ShmRingBuffer<Ring> shm;
+  CHECK(shm.create(name.c_str()) == 0);
+  if (!shm.writer()) return;
+  // Polling reads need a written buffer, before it the ring holds no data
+  shm.writer()->Write(
+      [](uint8_t* buf, size_t size) { return write_message(buf, size, 0); });
+
+  int ready[2];
+  CHECK(pipe(ready) == 0);
+  pid_t child = fork();
+  if (child == 0) {
+    ShmRingBuffer<Ring> consumer;
+    if (consumer.attach(name.c_str()) != 0) _exit(4);
+    // The mapping is read-only
+    if (consumer.writer() != nullptr) _exit(3);
+    signal_ready(ready);
+    _exit(read_until_stop(
+        "shm object, Read", *consumer.reader(),
+        [](const Ring& ring, auto& read) { return ring.Read(read); },
+        messages));
+  }
+  CHECK(child > 0);
+  CHECK(produce(*shm.writer(), child, ready, 1, messages));
+  shm.unlink();
+}
+
+// Same size as CacheLineLayout for the rings below, only the metadata is
+// packed differently
+struct PackedMetaLayout {
+  static constexpr size_t meta_align = alignof(unsigned long long);
+  static constexpr size_t slot_align = cache_line_size;
+  static constexpr size_t index_align = cache_line_size;
+};
+
+void test_mismatched_attach() {
+  using Ring = RingBuffer<16, buf_size, CacheLineLayout, BusySpinWait>;
+  ShmRingBuffer<Ring> shm;
+  CHECK(shm.create_memfd("shm_ring_buffer_test") == 0);
+  if (!shm.writer()) return;
+
+  using OtherWait = RingBuffer<16, buf_size, CacheLineLayout, FutexWait>;
+  static_assert(sizeof(OtherWait) == sizeof(Ring));
+  ShmRingBuffer<OtherWait> other_wait;
+  CHECK(other_wait.attach_fd(shm.fd()) == -EINVAL);
+
+  using OtherLayout = RingBuffer<16, buf_size, PackedMetaLayout, BusySpinWait>;
+  static_assert(sizeof(OtherLayout) == sizeof(Ring));
+  ShmRingBuffer<OtherLayout> other_layout;
+  CHECK(other_layout.attach_fd(shm.fd()) == -EINVAL);
+
+  ShmRingBuffer<Ring> same;
+  CHECK(same.attach_fd(shm.fd()) == 0);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  unsigned long long messages =
+      argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  // Both processes print, keep the output in order
+  setvbuf(stdout, nullptr, _IONBF, 0);
+  test_memfd_wait_read(messages);
+  test_named_read_only(messages);
+  test_mismatched_attach();
+  return test_result();
+}
@@ -0,0 +1,73 @@
+// 1). Layout policies for the slots of the lock-free buffers in this directory
+//
+// 2). A policy decides how far apart hot data is placed in memory:
+//     a) meta_align  - alignment of the per-slot metadata (counters) and of
+//                      the payload that follows it, so the counters written on
+//                      every operation do not share a line with the payload
+//     b) slot_align  - alignment (and therefore padding) of the whole slot, so
+//                      two neighbouring slots never share a cache line/page
+//     c) index_align - alignment of the shared indexes (head, tail, sequence)
+//                      so each of them bounces between cores on its own
+//
+// 3). detail::cpu_relax() is the spin hint shared by the buffers.
+//
+// 4). PackedLayout reproduces the original layout where everything is back to
+// back, it is kept for memory constrained uses and for comparison.
+//
+// Usage example:
+//
+// RingBuffer<16, 256, PageLayout> ring;
+//
+// struct MyLayout {
+//   static constexpr size_t meta_align = 128;
+//   static constexpr size_t slot_align = 128;
+//   static constexpr size_t index_align = 128;
+// };
+#pragma once
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Size of the destructive interference range, std::hardware_destructive_
+// interference_size is not stable across compiler flags so it is pinned here
+constexpr size_t cache_line_size = 64;
+constexpr size_t page_size = 4096;
+
+// Everything back to back (original layout)
+struct PackedLayout {
+  static constexpr size_t meta_align = alignof(unsigned long long);
+  static constexpr size_t slot_align = alignof(unsigned long long);
+  static constexpr size_t index_align = alignof(unsigned long long);
+};
+
+// Metadata, payload, slots and indexes on separate cache lines
+struct CacheLineLayout {
+  static constexpr size_t meta_align = cache_line_size;
+  static constexpr size_t slot_align = cache_line_size;
+  static constexpr size_t index_align = cache_line_size;
+};
+
+// As CacheLineLayout, but each slot also takes at least a whole page. This
+// keeps writers on different slots off each other's TLB entries and lets the
+// slots be mapped and locked page by page.
+struct PageLayout {
+  static constexpr size_t meta_align = cache_line_size;
+  static constexpr size_t slot_align = page_size;
+  static constexpr size_t index_align = cache_line_size;
+};
+
+namespace detail {
+
+// Hint to the processor that the caller is spinning on a memory location
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+}  // namespace detail
@@ -0,0 +1,30 @@
+// Checks shared by the standalone tests of this directory
+//
+// CHECK(condition) reports a failed condition with its location and counts
+// it, the test goes on. main() ends with return test_result(), which prints
+// "ok" or the number of failed checks and gives the exit status. CHECK() may
+// be used from any thread.
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+
+inline std::atomic_int test_failures = {0};
+
+#define CHECK(condition)                                              \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__,       \
+              #condition);                                            \
+      test_failures++;                                                \
+    }                                                                 \
+  } while (0)
+
+inline int test_result() {
+  if (test_failures) {
+    fprintf(stderr, "%d checks failed\n", test_failures.load());
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
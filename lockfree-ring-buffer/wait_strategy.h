@@ -0,0 +1,123 @@
+// 1). Wait strategies for readers that block until a writer publishes data
+//
+// 2). A strategy waits on a 32 bit word (publish counter) to change from the
+// value the reader last saw, and is notified by the writer after every
+// publish:
+//     a) NoWait        - no blocking reads, the writer does no extra work
+//     b) BusySpinWait  - spin with the pause hint, lowest latency, burns a
+//                        core per reader
+//     c) SpinYieldWait - spin for a while, then yield the core to other
+//                        threads between checks
+//     d) FutexWait     - spin for a while, then park in futex(FUTEX_WAIT). The
+//                        writer issues FUTEX_WAKE only if a waiter registered,
+//                        so writes stay syscall free while readers keep up
+//
+// 3). The futexes are not FUTEX_PRIVATE, so waiting works across processes on
+// a shared mapping. Parking registers the waiter in the shared memory, so
+// FutexWait readers need a writable mapping.
+//
+// 4). Every strategy has a tag of its own. ShmRingBuffer records it in the
+// segment header, so processes whose rings wait differently (a FutexWait
+// reader would never be woken by a BusySpinWait writer) refuse to share a
+// segment. A custom strategy needs a tag not used by the ones below.
+//
+// Usage example:
+//
+// RingBuffer<64, 256, CacheLineLayout, FutexWait> ring;
+// unsigned int last = 0;
+// while (running) ring.WaitRead(read_fn, last);
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "slot_layout.h"
+
+namespace detail {
+
+inline void futex_wait(const std::atomic_uint* word, unsigned int old) {
+  syscall(SYS_futex, word, FUTEX_WAIT, old, nullptr, nullptr, 0);
+}
+
+inline void futex_wake_all(std::atomic_uint* word) {
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+}  // namespace detail
+
+struct NoWait {
+  static constexpr bool blocking = false;
+  static constexpr uint32_t tag = 0;
+};
+
+struct BusySpinWait {
+  static constexpr bool blocking = true;
+  static constexpr uint32_t tag = 1;
+
+  static unsigned int wait(const std::atomic_uint& word, unsigned int old,
+                           std::atomic_uint&) {
+    unsigned int current;
+    while ((current = word.load(std::memory_order_acquire)) == old)
+      detail::cpu_relax();
+    return current;
+  }
+  static void notify(std::atomic_uint&, const std::atomic_uint&) {}
+};
+
+struct SpinYieldWait {
+  static constexpr bool blocking = true;
+  static constexpr uint32_t tag = 2;
+  static constexpr int spin_count = 1000;
+
+  static unsigned int wait(const std::atomic_uint& word, unsigned int old,
+                           std::atomic_uint&) {
+    unsigned int current;
+    for (int n = 0; (current = word.load(std::memory_order_acquire)) == old;
+         n++) {
+      if (n < spin_count)
+        detail::cpu_relax();
+      else
+        std::this_thread::yield();
+    }
+    return current;
+  }
+  static void notify(std::atomic_uint&, const std::atomic_uint&) {}
+};
+
+struct FutexWait {
+  static constexpr bool blocking = true;
+  static constexpr uint32_t tag = 3;
+  static constexpr int spin_count = 1000;
+
+  static unsigned int wait(const std::atomic_uint& word, unsigned int old,
+                           std::atomic_uint& waiters) {
+    unsigned int current;
+    for (int n = 0; n < spin_count; n++) {
+      if ((current = word.load(std::memory_order_acquire)) != old)
+        return current;
+      detail::cpu_relax();
+    }
+    // Registration and the re-check are seq_cst, pairing with the publish
+    // and waiters check in notify(), so either the writer sees the waiter or
+    // the waiter sees the new word. The kernel re-checks the word as well.
+    while (true) {
+      waiters.fetch_add(1, std::memory_order_seq_cst);
+      current = word.load(std::memory_order_seq_cst);
+      if (current == old) detail::futex_wait(&word, old);
+      waiters.fetch_sub(1, std::memory_order_relaxed);
+      if (current != old) return current;
+      if ((current = word.load(std::memory_order_acquire)) != old)
+        return current;
+    }
+  }
+  static void notify(std::atomic_uint& word, const std::atomic_uint& waiters) {
+    if (waiters.load(std::memory_order_seq_cst) != 0)
+      detail::futex_wake_all(&word);
+  }
+};
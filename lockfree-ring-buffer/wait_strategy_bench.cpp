@@ -0,0 +1,94 @@
+// Latency benchmark of RingBuffer wait strategies
+//
+// A writer publishes a timestamp every interval, a reader blocked in
+// WaitRead() records how long after the write it got to read it. Prints the
+// wake-up latency percentiles for each strategy.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o wait_strategy_bench wait_strategy_bench.cpp
+//   ./wait_strategy_bench [messages] [interval_us]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ring_buffer.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Message {
+  long long timestamp_ns;
+  bool stop;
+};
+
+long long now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+template <typename Wait>
+void run(const char* name, size_t messages, long long interval_ns) {
+  auto ring = std::make_unique<RingBuffer<64, sizeof(Message), CacheLineLayout, Wait>>();
+  std::vector<long long> latencies;
+  latencies.reserve(messages);
+
+  std::thread reader([&] {
+    unsigned int last = 0;
+    unsigned long long last_seq = ~0ULL;
+    bool stop = false;
+    while (!stop) {
+      ring->WaitRead(
+          [&](const uint8_t* buf, size_t, unsigned long long seq) {
+            Message msg;
+            std::memcpy(&msg, buf, sizeof(msg));
+            stop = msg.stop;
+            if (!stop && seq != last_seq)
+              latencies.push_back(now_ns() - msg.timestamp_ns);
+            last_seq = seq;
+            return 0;
+          },
+          last);
+    }
+  });
+
+  for (size_t n = 0; n <= messages; n++) {
+    long long next = now_ns() + interval_ns;
+    while (now_ns() < next) {
+    }
+    ring->Write([n, messages](uint8_t* buf, size_t) {
+      Message msg = {now_ns(), n == messages};
+      std::memcpy(buf, &msg, sizeof(msg));
+      return 0;
+    });
+  }
+  reader.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    if (latencies.empty()) return 0LL;
+    return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+  };
+  std::printf("%-14s n=%-7zu p50=%7lld p90=%7lld p99=%7lld p99.9=%8lld max=%8lld ns\n",
+              name, latencies.size(), percentile(0.5), percentile(0.9),
+              percentile(0.99), percentile(0.999), percentile(1.0));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t messages = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+  long long interval_ns = (argc > 2 ? std::atoll(argv[2]) : 20) * 1000;
+
+  std::printf("messages=%zu interval=%lld us\n", messages, interval_ns / 1000);
+  run<BusySpinWait>("BusySpinWait", messages, interval_ns);
+  run<SpinYieldWait>("SpinYieldWait", messages, interval_ns);
+  run<FutexWait>("FutexWait", messages, interval_ns);
+  return EXIT_SUCCESS;
+}
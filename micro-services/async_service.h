@@ -0,0 +1,313 @@
+//   1). Async service calls with C++20 coroutines. A service method returns
+//   task<T> instead of taking the service mutex, and the caller co_awaits it,
+//   so a request can hop through several services without parking a thread
+//   at each hop: while a call is in flight the calling coroutine is suspended
+//   and its thread goes back to the Executor (see executor.h).
+//
+//   2) task<T> is lazy, the method body starts when the task is awaited. The
+//   first thing it does is co_await schedule(m_tasks), which suspends it and
+//   resumes it on the service's own TaskSource. With a serial TaskSource the
+//   method bodies of one service then run one at a time, like the calls into
+//   the single processor() thread of services.h. When the task completes its
+//   caller resumes on the same thread, a caller that needs its own service
+//   state co_awaits schedule() of its own TaskSource again.
+//
+//   3) Cancellation follows cancel() of the service: once its TaskSource is
+//   cancelled, co_await schedule() and schedule_after() on it throw
+//   task_cancelled, including for coroutines that were already queued, and
+//   the exception propagates up the chain of awaiting callers. A cancelled hop
+//   is resumed through Executor::post(), so the Executor has to outlive the
+//   services (which the ServiceManager dependencies ensure).
+//
+//   4) sync_wait() runs a task from plain code and blocks until it completes,
+//   spawn() starts a task<void> and lets it complete on its own.
+//
+// ** Example:
+//
+// class IServiceOne : public IService
+// {
+// public:
+//    virtual task<int> lookup(int key) = 0;
+// };
+//
+// task<int> ServiceOne::lookup(int key)
+// {
+//    co_await schedule(m_tasks);  // now on ServiceOne's TaskSource
+//    co_return m_table[key];
+// }
+//
+// task<void> ServiceTwo::handle(Request request)
+// {
+//    co_await schedule(m_tasks);
+//    int value = co_await m_parts->service_one->lookup(request.key);
+//    co_await schedule(m_tasks);  // back on ServiceTwo's TaskSource
+//    ...
+// }
+//
+// spawn(service_two->handle(request));
+
+#pragma once
+
+#if __cplusplus < 202002L
+#error "async_service.h requires C++20 coroutines"
+#endif
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "executor.h"
+
+// Thrown from co_await on the TaskSource of a cancelled service
+struct task_cancelled : std::exception {
+  const char* what() const noexcept override { return "service cancelled"; }
+};
+
+template <typename T = void>
+class task;
+
+namespace detail {
+
+struct task_promise_base {
+  // Resumes the awaiting coroutine when the task completes
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> handle) noexcept {
+      return handle.promise().continuation;
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { exception = std::current_exception(); }
+
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr exception;
+};
+
+template <typename T>
+struct task_promise : task_promise_base {
+  task<T> get_return_object();
+  void return_value(T value) { result.emplace(std::move(value)); }
+
+  T take() {
+    if (exception) std::rethrow_exception(exception);
+    return std::move(*result);
+  }
+
+  std::optional<T> result;
+};
+
+template <>
+struct task_promise<void> : task_promise_base {
+  task<void> get_return_object();
+  void return_void() {}
+
+  void take() {
+    if (exception) std::rethrow_exception(exception);
+  }
+};
+
+// Coroutine that starts right away and frees itself when it completes
+struct detached {
+  struct promise_type {
+    detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// Resumes the suspended coroutine when the TaskSource runs it. If the
+// TaskSource drops it instead (cancelled), the last copy going away marks the
+// hop cancelled and resumes the coroutine through the Executor.
+class resumer {
+ public:
+  resumer(std::coroutine_handle<> handle, bool* cancelled, Executor* executor)
+      : m_handle(handle), m_cancelled(cancelled), m_executor(executor) {}
+  resumer(const resumer&) = delete;
+  resumer& operator=(const resumer&) = delete;
+  ~resumer() {
+    if (m_resumed) return;
+    *m_cancelled = true;
+    std::coroutine_handle<> handle = m_handle;
+    m_executor->post([handle]() { handle.resume(); });
+  }
+
+  void resume() {
+    m_resumed = true;
+    m_handle.resume();
+  }
+
+ private:
+  std::coroutine_handle<> m_handle;
+  bool* m_cancelled;
+  Executor* m_executor;
+  bool m_resumed = false;
+};
+
+class schedule_awaiter {
+ public:
+  schedule_awaiter(TaskSource& source,
+                   std::optional<Executor::Clock::duration> delay)
+      : m_source(source), m_delay(delay) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    auto hop = std::make_shared<resumer>(handle, &m_cancelled,
+                                         m_source.executor());
+    auto fn = [hop = std::move(hop)]() { hop->resume(); };
+    // The coroutine may run on a worker as soon as it is posted, nothing of
+    // this awaiter can be touched afterwards. A failed post resumes it as
+    // cancelled.
+    if (m_delay)
+      m_source.schedule_after(*m_delay, std::move(fn));
+    else
+      m_source.post(std::move(fn));
+  }
+
+  void await_resume() const {
+    if (m_cancelled) throw task_cancelled();
+  }
+
+ private:
+  TaskSource& m_source;
+  std::optional<Executor::Clock::duration> m_delay;
+  bool m_cancelled = false;
+};
+
+template <typename T>
+struct sync_wait_state {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  std::optional<T> result;
+  std::exception_ptr exception;
+};
+
+}  // namespace detail
+
+// Result of an async service call, see 2). at the top
+template <typename T>
+class [[nodiscard]] task {
+ public:
+  using promise_type = detail::task_promise<T>;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  task(task&& other) noexcept
+      : m_handle(std::exchange(other.m_handle, nullptr)) {}
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      if (m_handle) m_handle.destroy();
+      m_handle = std::exchange(other.m_handle, nullptr);
+    }
+    return *this;
+  }
+  ~task() {
+    if (m_handle) m_handle.destroy();
+  }
+
+  // Starts the task on the awaiting thread (symmetric transfer) and resumes
+  // the awaiting coroutine when it completes
+  auto operator co_await() & noexcept { return awaiter{m_handle}; }
+  auto operator co_await() && noexcept { return awaiter{m_handle}; }
+
+ private:
+  friend promise_type;
+
+  struct awaiter {
+    bool await_ready() const noexcept { return !handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<> caller) noexcept {
+      handle.promise().continuation = caller;
+      return handle;
+    }
+    T await_resume() { return handle.promise().take(); }
+
+    handle_type handle;
+  };
+
+  explicit task(handle_type handle) : m_handle(handle) {}
+
+  handle_type m_handle;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> task_promise<T>::get_return_object() {
+  return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() {
+  return task<void>(
+      std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+template <typename T, typename Result>
+detached sync_wait_run(task<T>& work, sync_wait_state<Result>& state) {
+  try {
+    if constexpr (std::is_void<T>::value) {
+      co_await work;
+      state.result.emplace(true);
+    } else {
+      state.result.emplace(co_await work);
+    }
+  } catch (...) {
+    state.exception = std::current_exception();
+  }
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.done = true;
+  state.cv.notify_one();
+}
+
+inline detached spawn_run(task<void> work) {
+  try {
+    co_await work;
+  } catch (const task_cancelled&) {
+  }
+}
+
+}  // namespace detail
+
+// Resume the awaiting coroutine on the source, throws task_cancelled if the
+// source is cancelled
+inline detail::schedule_awaiter schedule(TaskSource& source) {
+  return detail::schedule_awaiter(source, std::nullopt);
+}
+
+// Resume the awaiting coroutine on the source once delay passed
+inline detail::schedule_awaiter schedule_after(
+    TaskSource& source, Executor::Clock::duration delay) {
+  return detail::schedule_awaiter(source, delay);
+}
+
+// Block the calling thread until the task completes, must not be called from
+// an Executor worker
+template <typename T>
+T sync_wait(task<T> work) {
+  using Result = std::conditional_t<std::is_void<T>::value, bool, T>;
+  detail::sync_wait_state<Result> state;
+  detail::sync_wait_run(work, state);
+
+  std::unique_lock<std::mutex> lock(state.mutex);
+  state.cv.wait(lock, [&state]() { return state.done; });
+  if (state.exception) std::rethrow_exception(state.exception);
+  if constexpr (!std::is_void<T>::value) return std::move(*state.result);
+}
+
+// Start the task and let it complete on its own, a task_cancelled exception
+// ends it quietly, any other exception terminates
+inline void spawn(task<void> work) { detail::spawn_run(std::move(work)); }
@@ -0,0 +1,246 @@
+// Test of the coroutine service calls of async_service.h
+//
+// Two serial TaskSources stand for two services. Calls that hop from one
+// service to the other and back are awaited from several threads at once
+// and must return the right values, with the bodies of each service never
+// running concurrently. An exception thrown in a callee must reach the
+// awaiting caller and sync_wait(). Cancelling a service must resume its
+// suspended coroutines (scheduled far in the future) with task_cancelled,
+// make later hops throw right away, and destroy every coroutine frame: the
+// test counts live objects held by the frames. A task that is never awaited
+// must free its frame too. Meant to be run under ASan and TSan as well.
+//
+// Build & run:
+//   g++ -std=c++20 -O2 -pthread -o async_service_test async_service_test.cpp
+//   ./async_service_test [calls per thread]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "async_service.h"
+#include "test_util.h"
+
+namespace {
+
+constexpr unsigned int workers = 4;
+constexpr int callers = 4;
+
+// Counts the live instances, held by coroutine frames
+std::atomic<long> live_trackers = {0};
+
+struct Tracker {
+  Tracker() { live_trackers++; }
+  Tracker(const Tracker&) { live_trackers++; }
+  ~Tracker() { live_trackers--; }
+};
+
+// Serial TaskSource standing for a service, flags overlapping bodies
+struct Service {
+  explicit Service(Executor* executor) : tasks(executor) {}
+
+  void enter() {
+    if (running.exchange(true)) overlaps++;
+  }
+  void leave() { running = false; }
+
+  TaskSource tasks;
+  std::atomic_bool running = {false};
+  std::atomic<long> overlaps = {0};
+};
+
+task<int> lookup(Service& service, int key) {
+  Tracker tracker;
+  co_await schedule(service.tasks);
+  service.enter();
+  int value = key * 2;
+  service.leave();
+  co_return value;
+}
+
+// Hops to its own service, calls into the other one and comes back
+task<int> handle(Service& self, Service& other, int key) {
+  Tracker tracker;
+  co_await schedule(self.tasks);
+  self.enter();
+  self.leave();
+  int value = co_await lookup(other, key);
+  co_await schedule(self.tasks);
+  self.enter();
+  value += 1;
+  self.leave();
+  co_return value;
+}
+
+task<void> fail(Service& service) {
+  Tracker tracker;
+  co_await schedule(service.tasks);
+  throw std::runtime_error("lookup failed");
+}
+
+task<int> recover(Service& self, Service& other) {
+  co_await schedule(self.tasks);
+  try {
+    co_await fail(other);
+  } catch (const std::runtime_error&) {
+    co_return -1;
+  }
+  co_return 0;
+}
+
+task<int> rethrow(Service& self, Service& other) {
+  co_await schedule(self.tasks);
+  co_await fail(other);
+  co_return 0;
+}
+
+task<void> sleep_forever(Service& service, std::atomic<long>& cancelled) {
+  Tracker tracker;
+  try {
+    co_await schedule_after(service.tasks, std::chrono::hours(1));
+  } catch (const task_cancelled&) {
+    cancelled++;
+    throw;
+  }
+}
+
+task<int> call_sleeper(Service& self, Service& other,
+                       std::atomic<long>& cancelled) {
+  Tracker tracker;
+  co_await schedule(self.tasks);
+  co_await sleep_forever(other, cancelled);
+  co_return 0;
+}
+
+task<void> never_awaited(Tracker) { co_return; }
+
+void test_chained_calls(long calls) {
+  Executor executor(nullptr, workers);
+  executor.start(nullptr);
+  {
+    Service one(&executor);
+    Service two(&executor);
+    std::atomic<long> wrong = {0};
+    std::vector<std::thread> threads;
+    for (int n = 0; n < callers; n++)
+      threads.emplace_back([&, n] {
+        for (long i = 0; i < calls; i++) {
+          int key = static_cast<int>(i * callers + n);
+          // Half of the calls go the other way round
+          int value = n & 1 ? sync_wait(handle(one, two, key))
+                            : sync_wait(handle(two, one, key));
+          if (value != key * 2 + 1) wrong++;
+        }
+      });
+    for (std::thread& thread : threads) thread.join();
+    printf("chained calls: %ld, %ld wrong, %ld overlaps\n", callers * calls,
+           wrong.load(), one.overlaps + two.overlaps);
+    CHECK(wrong == 0);
+    CHECK(one.overlaps == 0 && two.overlaps == 0);
+  }
+  CHECK(live_trackers == 0);
+  executor.cancel();
+  executor.join();
+}
+
+void test_exceptions() {
+  Executor executor(nullptr, workers);
+  executor.start(nullptr);
+  {
+    Service one(&executor);
+    Service two(&executor);
+    CHECK(sync_wait(recover(one, two)) == -1);
+    bool thrown = false;
+    try {
+      sync_wait(rethrow(one, two));
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    CHECK(thrown);
+  }
+  CHECK(live_trackers == 0);
+  executor.cancel();
+  executor.join();
+}
+
+// Coroutines suspended on a service are resumed with task_cancelled when it
+// is cancelled, their frames are destroyed
+void test_cancel_suspended(int sleepers) {
+  Executor executor(nullptr, workers);
+  executor.start(nullptr);
+  {
+    Service one(&executor);
+    Service two(&executor);
+    std::atomic<long> cancelled = {0};
+    for (int n = 0; n < sleepers; n++) spawn(sleep_forever(two, cancelled));
+
+    // A caller blocked in sync_wait() on a chain through the sleeping service
+    std::atomic<int> result = {0};
+    std::thread waiter([&] {
+      try {
+        sync_wait(call_sleeper(one, two, cancelled));
+        result = 1;
+      } catch (const task_cancelled&) {
+        result = 2;
+      }
+    });
+
+    // Every sleeper holds a tracker, the chain one more in call_sleeper()
+    auto deadline = Executor::Clock::now() + std::chrono::seconds(10);
+    while (live_trackers < sleepers + 2 && Executor::Clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(live_trackers == sleepers + 2);
+    CHECK(cancelled == 0);
+
+    std::thread canceller([&] { two.tasks.cancel(); });
+    canceller.join();
+    waiter.join();
+    CHECK(result == 2);
+    // The spawned coroutines are resumed on the workers
+    while (cancelled < sleepers + 1 && Executor::Clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    printf("cancel: %ld of %d suspended coroutines cancelled\n",
+           cancelled.load(), sleepers + 1);
+    CHECK(cancelled == sleepers + 1);
+    while (live_trackers != 0 && Executor::Clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(live_trackers == 0);
+
+    // Hops onto a cancelled service throw right away
+    bool thrown = false;
+    try {
+      sync_wait(lookup(two, 1));
+    } catch (const task_cancelled&) {
+      thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(live_trackers == 0);
+    // The other service still works
+    CHECK(sync_wait(lookup(one, 4)) == 8);
+  }
+  executor.cancel();
+  executor.join();
+}
+
+void test_never_awaited() {
+  {
+    task<void> work = never_awaited(Tracker());
+    // The parameter copy lives in the frame
+    CHECK(live_trackers == 1);
+  }
+  CHECK(live_trackers == 0);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  long calls = argc > 1 ? strtol(argv[1], nullptr, 10) : 20000;
+  test_chained_calls(calls);
+  test_exceptions();
+  test_cancel_suspended(100);
+  test_never_awaited();
+  return test_result();
+}
@@ -0,0 +1,741 @@
+//   1). Executor is an opt-in service that runs the tasks of other services on
+//   a shared work-stealing thread pool, so a service does not need to own
+//   m_loop_thread and a condition variable loop (see services.h). With dozens
+//   of services this keeps the number of threads at the number of cores.
+//
+//   2) Every worker owns a Chase-Lev deque: tasks posted from a worker are
+//   pushed to and taken from the bottom of its own deque without a lock, idle
+//   workers steal from the top of the other deques. Tasks posted from other
+//   threads go to a shared injection queue. Workers without work park on a
+//   condition variable, posting only signals it if a worker is parked.
+//
+//   3) Options:
+//      a) threads     - number of workers, hardware_concurrency() by default
+//      b) pin_threads - pin worker n to the n-th CPU of the process affinity
+//      c) numa_aware  - assign the workers to CPUs node by node (read from
+//                       /sys/devices/system/node) and steal from workers of
+//                       the same node first
+//
+//   4) Services use the Executor through a TaskSource, which keeps the
+//   start/cancel/join/destroy lifecycle of the service:
+//      a) post()           - run a task as soon as possible
+//      b) schedule_after() - run a task after a delay
+//      c) cancel()         - drop the queued and scheduled tasks, no new tasks
+//                            are accepted
+//      d) join()           - wait until no task of the source is queued or
+//                            running
+//   A serial TaskSource (the default) runs its tasks one at a time in post
+//   order, like the single processor() thread it replaces, so the service
+//   state touched only by its tasks needs no lock.
+//
+//   5) The Executor has to be started before and stopped after the services
+//   that use it, e.g. by listing parts->executor in their dependencies() (see
+//   service_manager.h). Tasks still queued when it is cancelled are dropped.
+//
+//   6) With parts->metrics set when it starts (see metrics.h), the Executor
+//   records under the "executor" service:
+//      a) queue_depth - tasks posted and not run yet (a gauge)
+//      b) queue_ns    - time from post to the start of a task
+//      c) task_ns     - run time of a task, a drain task of a serial source
+//                       counts as one task for its whole batch
+//
+// ** Example:
+//    a) CREATE_SERVICE_PART(new_executor, Executor, executor)
+//    b) ServiceOne::start(const Parts* parts)
+//       { m_parts = parts; m_tasks = TaskSource(parts->executor); }
+//    c) ServiceOne::cancel() { m_tasks.cancel(); }
+//    d) ServiceOne::join() { m_tasks.join(); }
+//    e) ServiceOne::function_one()
+//       { m_tasks.post([this]() { // code for processing the task }); }
+//    f) ServiceOne::dependencies(const Parts* parts) const
+//       { return {parts->executor}; }
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "metrics.h"
+#include "services.h"
+
+namespace detail {
+
+// State shared by a TaskSource and its queued tasks
+struct TaskSourceState {
+  explicit TaskSourceState(bool serial) : serial(serial) {}
+
+  // Called once per posted task, when it ran or was dropped. The last one
+  // decrements under the mutex, join() may free the state once it sees 0.
+  void finish() {
+    size_t count = pending.load(std::memory_order_relaxed);
+    while (count > 1)
+      if (pending.compare_exchange_weak(count, count - 1,
+                                        std::memory_order_acq_rel))
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.fetch_sub(1, std::memory_order_acq_rel);
+    idle.notify_all();
+  }
+
+  const bool serial;
+  std::atomic_bool cancelled{false};
+  // Tasks posted or scheduled and not finished yet, plus the drain task
+  std::atomic<size_t> pending{0};
+
+  std::mutex mutex;
+  // Signalled when pending drops to 0
+  std::condition_variable idle;
+
+  // ---- Serial sources only, locked by mutex ----
+  std::deque<std::function<void()>> queue;
+  // A drain task is queued or running in the Executor
+  bool draining = false;
+};
+
+struct ExecutorTask {
+  std::function<void()> fn;
+  // nullptr for tasks posted directly to the Executor
+  TaskSourceState* source;
+  // Runs the queue of the serial source
+  bool drain;
+  // Set on submit when the Executor records metrics
+  std::chrono::steady_clock::time_point queued{};
+};
+
+// Chase-Lev work-stealing deque of task pointers ("Correct and Efficient
+// Work-Stealing for Weak Memory Models", Le et al.). The owner pushes and
+// takes at the bottom, thieves steal at the top. Grown arrays are kept until
+// the deque is destroyed, a thief may still read the old one.
+class WorkStealingDeque {
+ public:
+  WorkStealingDeque() { m_array.store(grow(nullptr, 0, 0)); }
+
+  // Owner only
+  void push(ExecutorTask* task) {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_acquire);
+    Array* array = m_array.load(std::memory_order_relaxed);
+    if (bottom - top > array->mask) {
+      array = grow(array, top, bottom);
+      m_array.store(array, std::memory_order_release);
+    }
+    array->put(bottom, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only, LIFO
+  ExecutorTask* take() {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    Array* array = m_array.load(std::memory_order_relaxed);
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+
+    ExecutorTask* task = nullptr;
+    if (top <= bottom) {
+      task = array->get(bottom);
+      if (top == bottom) {
+        // Last task, race the thieves for it
+        if (!m_top.compare_exchange_strong(top, top + 1,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed))
+          task = nullptr;
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+      }
+    } else {
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  // Any thread, FIFO. nullptr if empty or lost the race to another thread.
+  ExecutorTask* steal() {
+    int64_t top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom) return nullptr;
+
+    ExecutorTask* task = m_array.load(std::memory_order_acquire)->get(top);
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+      return nullptr;
+    return task;
+  }
+
+  bool empty() const {
+    return m_top.load(std::memory_order_seq_cst) >=
+           m_bottom.load(std::memory_order_seq_cst);
+  }
+
+ private:
+  // The slots are stored with release and loaded with acquire, so a thief
+  // that reads a task pointer also sees the task it points to. The fences on
+  // m_bottom only order the indexes and are not modelled by TSan.
+  struct Array {
+    explicit Array(int64_t size) : mask(size - 1), slots(new Slot[size]) {}
+
+    ExecutorTask* get(int64_t index) const {
+      return slots[index & mask].load(std::memory_order_acquire);
+    }
+    void put(int64_t index, ExecutorTask* task) {
+      slots[index & mask].store(task, std::memory_order_release);
+    }
+
+    using Slot = std::atomic<ExecutorTask*>;
+    const int64_t mask;
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  static constexpr int64_t initial_size = 256;
+
+  Array* grow(const Array* array, int64_t top, int64_t bottom) {
+    int64_t size = array ? 2 * (array->mask + 1) : initial_size;
+    m_arrays.push_back(std::make_unique<Array>(size));
+    Array* grown = m_arrays.back().get();
+    for (int64_t index = top; index < bottom; index++)
+      grown->put(index, array->get(index));
+    return grown;
+  }
+
+  alignas(64) std::atomic<int64_t> m_top{0};
+  alignas(64) std::atomic<int64_t> m_bottom{0};
+  std::atomic<Array*> m_array{nullptr};
+  // Owner only
+  std::vector<std::unique_ptr<Array>> m_arrays;
+};
+
+// CPUs of a "0-3,8-11" list from sysfs
+inline std::vector<int> parse_cpu_list(const char* path) {
+  std::vector<int> cpus;
+  FILE* file = std::fopen(path, "r");
+  if (!file) return cpus;
+  int first, last;
+  char separator;
+  while (std::fscanf(file, "%d", &first) == 1) {
+    last = first;
+    separator = static_cast<char>(std::fgetc(file));
+    if (separator == '-') {
+      if (std::fscanf(file, "%d", &last) != 1) break;
+      separator = static_cast<char>(std::fgetc(file));
+    }
+    for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    if (separator != ',') break;
+  }
+  std::fclose(file);
+  return cpus;
+}
+
+}  // namespace detail
+
+// See 3). at the top
+struct ExecutorOptions {
+  // 0 for std::thread::hardware_concurrency()
+  unsigned int threads = 0;
+  bool pin_threads = false;
+  bool numa_aware = false;
+};
+
+class Executor : public IService {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  using Options = ExecutorOptions;
+
+  explicit Executor(const Parts* parts = nullptr, Options options = Options())
+      : m_parts(parts), m_options(options) {}
+  Executor(const Parts* parts, unsigned int threads)
+      : Executor(parts, Options{threads}) {}
+
+  DECLARE_SERVICE(Executor)
+
+  // Run fn on a worker as soon as possible, any thread
+  void post(std::function<void()> fn) {
+    submit(new detail::ExecutorTask{std::move(fn), nullptr, false});
+  }
+
+  // Run fn on a worker once delay passed, any thread
+  void schedule_after(Clock::duration delay, std::function<void()> fn) {
+    schedule(Clock::now() + delay, std::move(fn), nullptr);
+  }
+
+  unsigned int threads() const {
+    return static_cast<unsigned int>(m_workers.size());
+  }
+
+ private:
+  friend class TaskSource;
+
+  struct alignas(64) Worker {
+    Executor* owner;
+    detail::WorkStealingDeque deque;
+    // -1 if not pinned
+    int cpu = -1;
+    int node = 0;
+    // Workers to steal from, the same NUMA node first
+    std::vector<size_t> victims;
+    std::thread thread;
+  };
+
+  struct Timer {
+    Clock::time_point deadline;
+    std::function<void()> fn;
+    detail::TaskSourceState* source;
+
+    bool operator>(const Timer& other) const {
+      return deadline > other.deadline;
+    }
+  };
+
+  static Worker*& current_worker() {
+    static thread_local Worker* worker = nullptr;
+    return worker;
+  }
+
+  // Place the workers on CPUs, node by node if numa_aware
+  void assign_cpus() {
+    std::vector<std::pair<int, int>> cpus;  // (node, cpu)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    if (m_options.numa_aware) {
+      for (int node = 0;; node++) {
+        std::string path = "/sys/devices/system/node/node" +
+                           std::to_string(node) + "/cpulist";
+        std::vector<int> node_cpus = detail::parse_cpu_list(path.c_str());
+        if (node_cpus.empty()) break;
+        for (int cpu : node_cpus)
+          if (CPU_ISSET(cpu, &allowed)) cpus.push_back({node, cpu});
+      }
+    }
+    if (cpus.empty()) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &allowed)) cpus.push_back({0, cpu});
+    }
+    if (cpus.empty()) return;
+
+    for (size_t n = 0; n < m_workers.size(); n++) {
+      const auto& placement = cpus[n % cpus.size()];
+      m_workers[n]->node = placement.first;
+      if (m_options.pin_threads || m_options.numa_aware)
+        m_workers[n]->cpu = placement.second;
+    }
+  }
+
+  void assign_victims() {
+    size_t count = m_workers.size();
+    for (size_t n = 0; n < count; n++) {
+      Worker& worker = *m_workers[n];
+      for (size_t offset = 1; offset < count; offset++)
+        worker.victims.push_back((n + offset) % count);
+      std::stable_partition(
+          worker.victims.begin(), worker.victims.end(),
+          [this, &worker](size_t victim) {
+            return m_workers[victim]->node == worker.node;
+          });
+    }
+  }
+
+  void submit(detail::ExecutorTask* task) {
+    if (m_queue_depth) {
+      m_queue_depth->add(1);
+      task->queued = Clock::now();
+    }
+    Worker* worker = current_worker();
+    if (worker && worker->owner == this) {
+      worker->deque.push(task);
+    } else {
+      std::lock_guard<std::mutex> lock(m_injected_mutex);
+      m_injected.push_back(task);
+      m_injected_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake();
+  }
+
+  // Queue fn of a serial source, posting a drain task if there is none
+  void submit_serial(detail::TaskSourceState* source,
+                     std::function<void()> fn) {
+    bool drain;
+    {
+      std::lock_guard<std::mutex> lock(source->mutex);
+      source->queue.push_back(std::move(fn));
+      drain = !std::exchange(source->draining, true);
+    }
+    if (drain) {
+      source->pending.fetch_add(1, std::memory_order_relaxed);
+      submit(new detail::ExecutorTask{nullptr, source, true});
+    }
+  }
+
+  void schedule(Clock::time_point deadline, std::function<void()> fn,
+                detail::TaskSourceState* source) {
+    {
+      std::lock_guard<std::mutex> lock(m_timer_mutex);
+      // TaskSource::cancel() sets cancelled before it sweeps the timers under
+      // this lock, a timer of a cancelled source pushed after the sweep would
+      // hold its join() until the deadline
+      if (source && source->cancelled.load(std::memory_order_relaxed)) {
+        source->finish();
+        return;
+      }
+      m_timers.push({deadline, std::move(fn), source});
+      m_next_deadline.store(m_timers.top().deadline.time_since_epoch().count(),
+                            std::memory_order_relaxed);
+    }
+    // A parked worker recomputes how long to sleep
+    wake();
+  }
+
+  // Signal a parked worker, no syscall if none is parked. The fence pairs
+  // with the registration in park(): either the worker sees the new task or
+  // this sees the worker.
+  void wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers.load(std::memory_order_relaxed) != 0) {
+      std::lock_guard<std::mutex> lock(m_park_mutex);
+      m_park_cv.notify_one();
+    }
+  }
+
+  bool has_work() const {
+    if (m_injected_count.load(std::memory_order_seq_cst) != 0) return true;
+    for (const auto& worker : m_workers)
+      if (!worker->deque.empty()) return true;
+    return Clock::now().time_since_epoch().count() >=
+           m_next_deadline.load(std::memory_order_seq_cst);
+  }
+
+  void park() {
+    std::unique_lock<std::mutex> lock(m_park_mutex);
+    m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+    if (!m_stopping.load(std::memory_order_relaxed) && !has_work()) {
+      int64_t deadline = m_next_deadline.load(std::memory_order_relaxed);
+      if (deadline == INT64_MAX)
+        m_park_cv.wait(lock);
+      else
+        m_park_cv.wait_until(
+            lock, Clock::time_point(Clock::duration(deadline)));
+    }
+    m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // Move the due timers to the deque of the worker
+  void poll_timers() {
+    if (Clock::now().time_since_epoch().count() <
+        m_next_deadline.load(std::memory_order_relaxed))
+      return;
+    std::vector<Timer> due;
+    {
+      std::unique_lock<std::mutex> lock(m_timer_mutex, std::try_to_lock);
+      if (!lock.owns_lock()) return;
+      auto now = Clock::now();
+      while (!m_timers.empty() && m_timers.top().deadline <= now) {
+        due.push_back(std::move(const_cast<Timer&>(m_timers.top())));
+        m_timers.pop();
+      }
+      m_next_deadline.store(
+          m_timers.empty() ? INT64_MAX
+                           : m_timers.top().deadline.time_since_epoch().count(),
+          std::memory_order_relaxed);
+    }
+    for (Timer& timer : due) {
+      if (timer.source && timer.source->serial)
+        submit_serial(timer.source, std::move(timer.fn));
+      else
+        submit(new detail::ExecutorTask{std::move(timer.fn), timer.source,
+                                        false});
+    }
+  }
+
+  detail::ExecutorTask* take_injected() {
+    if (m_injected_count.load(std::memory_order_relaxed) == 0) return nullptr;
+    std::lock_guard<std::mutex> lock(m_injected_mutex);
+    if (m_injected.empty()) return nullptr;
+    detail::ExecutorTask* task = m_injected.front();
+    m_injected.pop_front();
+    m_injected_count.fetch_sub(1, std::memory_order_relaxed);
+    return task;
+  }
+
+  detail::ExecutorTask* steal(const Worker& worker) {
+    for (size_t victim : worker.victims)
+      if (auto* task = m_workers[victim]->deque.steal()) return task;
+    return nullptr;
+  }
+
+  // Run the queued functions of a serial source, one batch per drain task so
+  // other sources get their turn
+  void drain(detail::TaskSourceState* source) {
+    std::deque<std::function<void()>> batch;
+    {
+      std::lock_guard<std::mutex> lock(source->mutex);
+      batch.swap(source->queue);
+    }
+    for (auto& fn : batch) {
+      if (!source->cancelled.load(std::memory_order_relaxed)) fn();
+      source->finish();
+    }
+    bool more;
+    {
+      std::lock_guard<std::mutex> lock(source->mutex);
+      more = !source->queue.empty();
+      source->draining = more;
+    }
+    if (more) {
+      source->pending.fetch_add(1, std::memory_order_relaxed);
+      submit(new detail::ExecutorTask{nullptr, source, true});
+    }
+    // Last, the source may be freed once its pending count is 0
+    source->finish();
+  }
+
+  void run(detail::ExecutorTask* task) {
+    Clock::time_point begin;
+    if (m_task_latency) {
+      begin = Clock::now();
+      // Tasks posted before start() were not counted
+      if (task->queued != Clock::time_point()) {
+        m_queue_depth->add(-1);
+        m_queue_latency->record(elapsed_ns(task->queued, begin));
+      }
+    }
+    if (task->drain) {
+      drain(task->source);
+    } else {
+      if (!task->source ||
+          !task->source->cancelled.load(std::memory_order_relaxed))
+        task->fn();
+      if (task->source) task->source->finish();
+    }
+    delete task;
+    if (m_task_latency) m_task_latency->record(elapsed_ns(begin, Clock::now()));
+  }
+
+  static uint64_t elapsed_ns(Clock::time_point begin, Clock::time_point end) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+            .count());
+  }
+
+  // Drop a task that will never run, so joins of its source return
+  void discard(detail::ExecutorTask* task) {
+    if (m_queue_depth && task->queued != Clock::time_point())
+      m_queue_depth->add(-1);
+    if (task->drain) {
+      std::deque<std::function<void()>> queue;
+      {
+        std::lock_guard<std::mutex> lock(task->source->mutex);
+        queue.swap(task->source->queue);
+        task->source->draining = false;
+      }
+      for (size_t n = 0; n <= queue.size(); n++) task->source->finish();
+    } else if (task->source) {
+      task->source->finish();
+    }
+    delete task;
+  }
+
+  void worker_loop(Worker& worker) {
+    current_worker() = &worker;
+    if (worker.cpu >= 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(worker.cpu, &cpus);
+      pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    while (!m_stopping.load(std::memory_order_acquire)) {
+      poll_timers();
+      detail::ExecutorTask* task = worker.deque.take();
+      if (!task) task = take_injected();
+      if (!task) task = steal(worker);
+      if (task)
+        run(task);
+      else
+        park();
+    }
+    current_worker() = nullptr;
+  }
+
+  const Parts* m_parts;
+  Options m_options;
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::atomic_bool m_stopping{false};
+
+  std::mutex m_injected_mutex;
+  // Locked by m_injected_mutex
+  std::deque<detail::ExecutorTask*> m_injected;
+  std::atomic<size_t> m_injected_count{0};
+
+  std::mutex m_timer_mutex;
+  // Locked by m_timer_mutex
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> m_timers;
+  // Earliest timer deadline in Clock ticks, INT64_MAX if there is none
+  std::atomic<int64_t> m_next_deadline{INT64_MAX};
+
+  std::mutex m_park_mutex;
+  std::condition_variable m_park_cv;
+  std::atomic_uint m_sleepers{0};
+
+  // See 6). at the top, all nullptr without parts->metrics
+  Gauge* m_queue_depth = nullptr;
+  Histogram* m_queue_latency = nullptr;
+  Histogram* m_task_latency = nullptr;
+};
+
+inline void Executor::start(const Parts* parts) {
+  m_parts = parts;
+  if (parts && parts->metrics) {
+    m_queue_depth = &parts->metrics->gauge("executor", "queue_depth");
+    m_queue_latency = &parts->metrics->histogram("executor", "queue_ns");
+    m_task_latency = &parts->metrics->histogram("executor", "task_ns");
+  }
+  unsigned int threads = m_options.threads;
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned int n = 0; n < threads; n++) {
+    m_workers.push_back(std::make_unique<Worker>());
+    m_workers.back()->owner = this;
+  }
+  assign_cpus();
+  assign_victims();
+  // All the workers exist before any of them can steal
+  for (auto& worker : m_workers)
+    worker->thread =
+        std::thread(&Executor::worker_loop, this, std::ref(*worker));
+}
+
+inline void Executor::cancel() {
+  m_stopping.store(true, std::memory_order_release);
+  std::lock_guard<std::mutex> lock(m_park_mutex);
+  m_park_cv.notify_all();
+}
+
+inline void Executor::join() {
+  for (auto& worker : m_workers)
+    if (worker->thread.joinable()) worker->thread.join();
+
+  // Drop what was not run, so the TaskSources can be joined
+  for (auto& worker : m_workers)
+    while (auto* task = worker->deque.take()) discard(task);
+  while (auto* task = take_injected()) discard(task);
+  std::lock_guard<std::mutex> lock(m_timer_mutex);
+  while (!m_timers.empty()) {
+    if (m_timers.top().source) m_timers.top().source->finish();
+    m_timers.pop();
+  }
+}
+
+inline void Executor::destroy() { delete this; }
+
+// Handle of a service to the Executor, see 4). at the top. Destroying it
+// cancels and joins it.
+class TaskSource {
+ public:
+  TaskSource() = default;
+  explicit TaskSource(Executor* executor, bool serial = true)
+      : m_executor(executor),
+        m_state(std::make_unique<detail::TaskSourceState>(serial)) {}
+  TaskSource(TaskSource&&) = default;
+  TaskSource& operator=(TaskSource&& other) {
+    reset();
+    m_executor = other.m_executor;
+    m_state = std::move(other.m_state);
+    return *this;
+  }
+  ~TaskSource() { reset(); }
+
+  // Returns false if the source was cancelled
+  bool post(std::function<void()> fn) {
+    if (!accept()) return false;
+    if (m_state->serial)
+      m_executor->submit_serial(m_state.get(), std::move(fn));
+    else
+      m_executor->submit(
+          new detail::ExecutorTask{std::move(fn), m_state.get(), false});
+    return true;
+  }
+
+  // Returns false if the source was cancelled
+  bool schedule_after(Executor::Clock::duration delay,
+                      std::function<void()> fn) {
+    if (!accept()) return false;
+    m_executor->schedule(Executor::Clock::now() + delay, std::move(fn),
+                         m_state.get());
+    return true;
+  }
+
+  // Drop the queued and scheduled tasks, a running task completes
+  void cancel() {
+    if (!m_state ||
+        m_state->cancelled.exchange(true, std::memory_order_acq_rel))
+      return;
+
+    // Scheduled tasks would hold join() until their deadline
+    // and are destroyed outside of the timer lock
+    std::vector<Executor::Timer> kept, dropped;
+    {
+      std::lock_guard<std::mutex> lock(m_executor->m_timer_mutex);
+      auto& timers = m_executor->m_timers;
+      while (!timers.empty()) {
+        auto& timer = const_cast<Executor::Timer&>(timers.top());
+        if (timer.source == m_state.get())
+          dropped.push_back(std::move(timer));
+        else
+          kept.push_back(std::move(timer));
+        timers.pop();
+      }
+      for (auto& timer : kept) timers.push(std::move(timer));
+    }
+    size_t count = dropped.size();
+    dropped.clear();
+    for (size_t n = 0; n < count; n++) m_state->finish();
+  }
+
+  Executor* executor() const { return m_executor; }
+
+  // Wait until no task of this source is queued or running. Must not be
+  // called from a task of this source.
+  void join() {
+    if (!m_state) return;
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    m_state->idle.wait(lock, [this]() {
+      return m_state->pending.load(std::memory_order_acquire) == 0;
+    });
+  }
+
+ private:
+  bool accept() {
+    if (!m_state || m_state->cancelled.load(std::memory_order_acquire))
+      return false;
+    m_state->pending.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void reset() {
+    if (!m_state) return;
+    cancel();
+    join();
+    m_state.reset();
+  }
+
+  Executor* m_executor = nullptr;
+  std::unique_ptr<detail::TaskSourceState> m_state;
+};
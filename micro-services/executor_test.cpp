@@ -0,0 +1,239 @@
+// Stress test of Executor and TaskSource
+//
+// Threads outside the pool post to the Executor and to serial and concurrent
+// TaskSources while tasks running on the workers post more tasks, so tasks
+// go through the injection queue, the worker deques and stealing. Every task
+// must run exactly once, the tasks of a serial source one at a time and in
+// post order. Scheduled tasks must not run before their delay. cancel() from
+// another thread while tasks are being posted must drop the scheduled tasks
+// and let join() return, and stopping the Executor with tasks still queued
+// must let the TaskSources be joined. Meant to be run under TSan as well.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o executor_test executor_test.cpp
+//   ./executor_test [tasks per thread]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "executor.h"
+#include "test_util.h"
+
+namespace {
+
+constexpr unsigned int workers = 4;
+constexpr int posters = 4;
+
+using Clock = Executor::Clock;
+
+// Wait for a counter updated by tasks, false on timeout
+bool wait_for(const std::atomic<long>& counter, long value) {
+  auto deadline = Clock::now() + std::chrono::seconds(30);
+  while (counter.load() < value) {
+    if (Clock::now() > deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+// Tasks posted from outside, and from tasks to the worker deques
+void test_post(long tasks) {
+  Executor executor(nullptr, workers);
+  executor.start(nullptr);
+  std::atomic<long> ran = {0};
+  std::vector<std::thread> threads;
+  for (int n = 0; n < posters; n++)
+    threads.emplace_back([&] {
+      for (long i = 0; i < tasks; i++)
+        executor.post([&] {
+          ran++;
+          // The nested post goes to the deque of this worker and is stolen
+          // by idle ones
+          executor.post([&] { ran++; });
+        });
+    });
+  for (std::thread& thread : threads) thread.join();
+  CHECK(wait_for(ran, 2 * posters * tasks));
+  executor.cancel();
+  executor.join();
+  printf("post: %ld tasks\n", ran.load());
+  CHECK(ran == 2 * posters * tasks);
+}
+
+// Several threads post to one serial source, tasks must not overlap and
+// each poster's tasks run in its post order
+void test_serial(long tasks) {
+  Executor executor(nullptr, workers);
+  executor.start(nullptr);
+  std::atomic<long> ran = {0};
+  long overlaps = 0;
+  long out_of_order = 0;
+  std::vector<long> next(posters, 0);
+  std::atomic_bool running = {false};
+  {
+    TaskSource source(&executor);
+    std::vector<std::thread> threads;
+    for (int n = 0; n < posters; n++)
+      threads.emplace_back([&, n] {
+        for (long i = 0; i < tasks; i++)
+          CHECK(source.post([&, n, i] {
+            if (running.exchange(true)) overlaps++;
+            // Plain data, only safe because the tasks are serial
+            if (next[n] != i) out_of_order++;
+            next[n] = i + 1;
+            running = false;
+            ran++;
+          }));
+      });
+    for (std::thread& thread : threads) thread.join();
+    source.join();
+  }
+  executor.cancel();
+  executor.join();
+  printf("serial: %ld tasks, %ld overlaps, %ld out of order\n", ran.load(),
+         overlaps, out_of_order);
+  CHECK(ran == posters * tasks);
+  CHECK(overlaps == 0);
+  CHECK(out_of_order == 0);
+}
+
+// Concurrent source, tasks post more tasks to the same source
+void test_concurrent_source(long tasks) {
+  Executor executor(nullptr, workers);
+  executor.start(nullptr);
+  std::atomic<long> ran = {0};
+  {
+    TaskSource source(&executor, false);
+    std::vector<std::thread> threads;
+    for (int n = 0; n < posters; n++)
+      threads.emplace_back([&] {
+        for (long i = 0; i < tasks; i++)
+          source.post([&] {
+            ran++;
+            source.post([&] { ran++; });
+          });
+      });
+    for (std::thread& thread : threads) thread.join();
+    // Also waits for the tasks posted by tasks
+    source.join();
+    CHECK(ran == 2 * posters * tasks);
+  }
+  executor.cancel();
+  executor.join();
+}
+
+void test_schedule_after() {
+  Executor executor(nullptr, workers);
+  executor.start(nullptr);
+  constexpr int timers = 200;
+  std::atomic<long> ran = {0};
+  std::atomic<long> early = {0};
+  TaskSource source(&executor, false);
+  std::vector<std::thread> threads;
+  for (int n = 0; n < posters; n++)
+    threads.emplace_back([&, n] {
+      for (int i = 0; i < timers; i++) {
+        auto delay = std::chrono::microseconds(100 * ((i * 7 + n) % 50));
+        auto deadline = Clock::now() + delay;
+        auto fn = [&, deadline] {
+          if (Clock::now() < deadline) early++;
+          ran++;
+        };
+        if (i & 1)
+          executor.schedule_after(delay, fn);
+        else
+          source.schedule_after(delay, fn);
+      }
+    });
+  for (std::thread& thread : threads) thread.join();
+  CHECK(wait_for(ran, posters * timers));
+  source.join();
+  executor.cancel();
+  executor.join();
+  printf("schedule_after: %ld tasks, %ld early\n", ran.load(), early.load());
+  CHECK(early == 0);
+}
+
+// cancel() from another thread while tasks are posted and scheduled far in
+// the future, join() must not wait for the scheduled ones
+void test_cancel(long tasks) {
+  Executor executor(nullptr, workers);
+  executor.start(nullptr);
+  for (int round = 0; round < 20; round++) {
+    std::atomic<long> ran = {0};
+    std::atomic<long> after_join = {0};
+    std::atomic_bool joined = {false};
+    TaskSource source(&executor, round & 1);
+    std::thread poster([&] {
+      for (long i = 0; i < tasks / 10; i++) {
+        bool accepted = source.post([&] {
+          if (joined) after_join++;
+          ran++;
+        });
+        if (!accepted) break;
+        source.schedule_after(std::chrono::hours(1), [&] { ran++; });
+      }
+    });
+    std::thread canceller([&] {
+      std::this_thread::sleep_for(std::chrono::microseconds(100 * round));
+      source.cancel();
+    });
+    canceller.join();
+    poster.join();
+    auto start = Clock::now();
+    source.join();
+    joined = true;
+    CHECK(Clock::now() - start < std::chrono::seconds(10));
+    CHECK(!source.post([] {}));
+    CHECK(!source.schedule_after(std::chrono::seconds(0), [] {}));
+    // A dropped task never runs later
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(after_join == 0);
+  }
+  executor.cancel();
+  executor.join();
+}
+
+// Stopping the Executor drops what is queued, the sources can still be
+// joined and destroyed
+void test_stop_with_queued_tasks(long tasks) {
+  Executor executor(nullptr, 1);
+  executor.start(nullptr);
+  TaskSource serial(&executor);
+  TaskSource concurrent(&executor, false);
+  std::atomic_bool release = {false};
+  // Keeps the only worker busy while the queues fill up
+  executor.post([&] {
+    while (!release) std::this_thread::yield();
+  });
+  for (long i = 0; i < tasks / 10; i++) {
+    serial.post([] {});
+    concurrent.post([] {});
+    concurrent.schedule_after(std::chrono::hours(1), [] {});
+  }
+  std::thread stopper([&] {
+    executor.cancel();
+    release = true;
+    executor.join();
+  });
+  stopper.join();
+  serial.join();
+  concurrent.join();
+  CHECK(true);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  long tasks = argc > 1 ? strtol(argv[1], nullptr, 10) : 20000;
+  test_post(tasks);
+  test_serial(tasks);
+  test_concurrent_source(tasks);
+  test_schedule_after();
+  test_cancel(tasks);
+  test_stop_with_queued_tasks(tasks);
+  return test_result();
+}
@@ -0,0 +1,180 @@
+//   1). Mailbox<Message> is a lock-free MPSC inbox for the processor() thread
+//   of a service (see services.h). It replaces the m_mutex + m_cv_task pattern
+//   for asynchronous calls: function_one() posts a message instead of taking
+//   the service lock, and the processor() loop handles the messages.
+//
+//   2) Posting never blocks: the message is pushed onto a linked list with a
+//   single CAS, and the consumer is woken with a futex only if it is parked,
+//   so while the processor() thread is busy a call costs one allocation and
+//   one CAS, no lock and no syscall.
+//
+//   3) The processor() thread takes all messages posted so far with a single
+//   exchange and handles them in post order (batch drain). Only when the inbox
+//   is empty it spins for a while and then parks on a futex.
+//
+//   4) stop() makes run() return once the messages posted before stop() are
+//   handled. Messages still in the inbox when it is destroyed are dropped.
+//
+// ** Example: (ServiceOne of services.h with a mailbox)
+//
+// struct Task { enum Kind { ONE, TWO } kind; int arg; };
+//
+// class ServiceOne : public IServiceOne
+// {
+//    ...
+// private:
+//    mutable Mailbox<Task> m_inbox;
+//    std::thread m_loop_thread;
+//    void processor();
+// }
+//
+//    a) ServiceOne::start(const Parts* parts)
+//       { m_parts = parts; m_loop_thread = std::thread(&ServiceOne::processor,
+//                                                      this); }
+//    b) ServiceOne::cancel() { m_inbox.stop(); }
+//    c) ServiceOne::join() { m_loop_thread.join(); }
+//    d) ServiceOne::function_one() { m_inbox.post(Task{Task::ONE, 1}); }
+//    e) ServiceOne::function_two() const { m_inbox.post(Task{Task::TWO, 2}); }
+//    f) processor()
+//       {
+//         m_inbox.run([this](Task& task) { // code for processing the task });
+//       }
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+template <typename Message>
+class Mailbox {
+ public:
+  // Checks of the inbox before the consumer parks on the futex
+  static constexpr int spin_count = 1000;
+
+  Mailbox() = default;
+  Mailbox(const Mailbox&) = delete;
+  Mailbox& operator=(const Mailbox&) = delete;
+
+  ~Mailbox() {
+    Node* node = m_head.exchange(nullptr, std::memory_order_acquire);
+    while (node) delete std::exchange(node, node->next);
+  }
+
+  // Any thread, never blocks
+  template <typename... Args>
+  void post(Args&&... args) {
+    Node* node = new Node{Message{std::forward<Args>(args)...}, nullptr};
+    node->next = m_head.load(std::memory_order_relaxed);
+    // seq_cst pairs with the parking in wait(), see notify()
+    while (!m_head.compare_exchange_weak(node->next, node,
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+    }
+    notify();
+  }
+
+  // Consumer thread only. Calls fn(Message&) for every message posted so far
+  // in post order, returns the number of messages handled.
+  template <typename Fn>
+  size_t drain(Fn&& fn) {
+    Node* node = m_head.exchange(nullptr, std::memory_order_acquire);
+    if (!node) return 0;
+
+    // The list is newest first
+    Node* reversed = nullptr;
+    while (node) {
+      Node* next = node->next;
+      node->next = reversed;
+      reversed = node;
+      node = next;
+    }
+
+    size_t count = 0;
+    while (reversed) {
+      fn(reversed->message);
+      delete std::exchange(reversed, reversed->next);
+      count++;
+    }
+    return count;
+  }
+
+  // Consumer thread only. The processor() loop: handles the messages with
+  // fn(Message&) and parks while the inbox is empty, until stop() is called.
+  template <typename Fn>
+  void run(Fn&& fn) {
+    while (true) {
+      // Messages posted before stop() are visible to the drain that follows
+      bool stopped = m_stopped.load(std::memory_order_acquire);
+      if (drain(fn) == 0) {
+        if (stopped) return;
+        wait();
+      }
+    }
+  }
+
+  // Consumer thread only. Returns once the inbox is not empty or stop() was
+  // called, may return spuriously.
+  void wait() {
+    for (int n = 0; n < spin_count; n++) {
+      if (m_head.load(std::memory_order_relaxed) ||
+          m_stopped.load(std::memory_order_relaxed))
+        return;
+      cpu_relax();
+    }
+    // Either the producer sees m_waiting set after its CAS, or the re-check
+    // here sees the posted message
+    m_waiting.store(1, std::memory_order_seq_cst);
+    if (!m_head.load(std::memory_order_seq_cst) &&
+        !m_stopped.load(std::memory_order_seq_cst))
+      syscall(SYS_futex, &m_waiting, FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr,
+              0);
+    m_waiting.store(0, std::memory_order_relaxed);
+  }
+
+  // Make run() return once the messages posted so far are handled
+  void stop() {
+    m_stopped.store(true, std::memory_order_seq_cst);
+    notify();
+  }
+
+  bool empty() const {
+    return m_head.load(std::memory_order_relaxed) == nullptr;
+  }
+
+ private:
+  struct Node {
+    Message message;
+    Node* next;
+  };
+
+  // Spin hint while polling the inbox, keeps this header self-contained
+  static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+  }
+
+  // Wake the consumer if it is parked, the syscall is skipped otherwise
+  void notify() {
+    if (m_waiting.load(std::memory_order_seq_cst) != 0 &&
+        m_waiting.exchange(0, std::memory_order_seq_cst) != 0)
+      syscall(SYS_futex, &m_waiting, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr,
+              0);
+  }
+
+  // Producers and the consumer touch different lines, except on wake up
+  alignas(64) std::atomic<Node*> m_head{nullptr};
+  alignas(64) std::atomic_uint m_waiting{0};
+  std::atomic_bool m_stopped{false};
+};
@@ -0,0 +1,124 @@
+// Throughput benchmark of cross-service calls
+//
+// Caller threads invoke function_one() of a service as fast as they can, the
+// service's processor() thread handles every call. Compares the mutex +
+// condition variable pattern documented in services.h with Mailbox, and
+// prints calls/sec for each.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o mailbox_bench mailbox_bench.cpp
+//   ./mailbox_bench [callers] [calls_per_caller]
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mailbox.h"
+
+namespace {
+
+struct Task {
+  long long arg;
+};
+
+// m_mutex + m_cv_task pattern of services.h
+class MutexService {
+ public:
+  void start() { m_loop_thread = std::thread(&MutexService::processor, this); }
+  void cancel() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_cv_task.notify_all();
+  }
+  void join() { m_loop_thread.join(); }
+
+  void function_one(long long arg) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back({arg});
+    m_cv_task.notify_one();
+  }
+
+  long long sum() const { return m_sum; }
+
+ private:
+  void processor() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_cv_task.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+      if (m_tasks.empty()) return;
+      Task task = m_tasks.front();
+      m_tasks.pop_front();
+      m_sum += task.arg;
+    }
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv_task;
+  std::deque<Task> m_tasks;
+  bool m_stop = false;
+  long long m_sum = 0;
+  std::thread m_loop_thread;
+};
+
+class MailboxService {
+ public:
+  void start() {
+    m_loop_thread = std::thread(&MailboxService::processor, this);
+  }
+  void cancel() { m_inbox.stop(); }
+  void join() { m_loop_thread.join(); }
+
+  void function_one(long long arg) { m_inbox.post(Task{arg}); }
+
+  long long sum() const { return m_sum; }
+
+ private:
+  void processor() {
+    m_inbox.run([this](Task& task) { m_sum += task.arg; });
+  }
+
+  Mailbox<Task> m_inbox;
+  long long m_sum = 0;
+  std::thread m_loop_thread;
+};
+
+template <typename Service>
+void run(const char* name, int callers, long long calls) {
+  Service service;
+  service.start();
+
+  auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int n = 0; n < callers; n++) {
+    threads.emplace_back([&service, calls]() {
+      for (long long call = 1; call <= calls; call++)
+        service.function_one(call);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  service.cancel();
+  service.join();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+
+  long long expected = callers * (calls * (calls + 1) / 2);
+  std::printf("%-15s %12.0f calls/sec %s\n", name, callers * calls / seconds,
+              service.sum() == expected ? "" : "(lost calls!)");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int callers = argc > 1 ? std::atoi(argv[1]) : 4;
+  long long calls = argc > 2 ? std::atoll(argv[2]) : 1000000;
+
+  std::printf("callers=%d calls_per_caller=%lld\n", callers, calls);
+  run<MutexService>("mutex+condvar", callers, calls);
+  run<MailboxService>("Mailbox", callers, calls);
+  return EXIT_SUCCESS;
+}
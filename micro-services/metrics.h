@@ -0,0 +1,468 @@
+//   1). Low overhead metrics for services: counters, gauges and HDR-style
+//   latency histograms kept per service and per call type in a
+//   MetricsRegistry that is shared through the Parts (see services.h).
+//
+//   2) Counters and histograms are sharded per thread: every thread updates
+//   its own cache line(s) with a plain load + store (no lock prefix, no
+//   sharing), and the shards are summed when the metrics are read. A counter
+//   add() or histogram record() is a few ns (see metrics_bench.cpp), so they
+//   can stay enabled in production. Shards are allocated on the first update
+//   of a thread, the slots of exited threads are reused. Threads beyond
+//   max_metric_threads share one overflow shard updated with atomic adds.
+//
+//   3) Gauges (e.g. queue depth) are a single relaxed atomic, set or moved by
+//   any thread.
+//
+//   4) Histograms use log-linear buckets (8 sub-buckets per power of two, so
+//   values are kept with ~12% precision) over the full uint64_t range, plus
+//   the exact count, sum and max. Values are usually nanoseconds.
+//
+//   5) The registry can be dumped as text or in the Prometheus text exposition
+//   format (histograms as summaries with quantiles), written to a file or
+//   served on a Unix socket by the MetricsExporter (see metrics_exporter.h).
+//
+//   6) With parts.metrics set, the ServiceManager records the start/stop time
+//   of every service (start_ns / stop_ns gauges labelled with the service
+//   name) and the Executor its queue depth, queue wait and task run time
+//   (service "executor": queue_depth, queue_ns, task_ns).
+//
+// ** Example:
+//    a) ServiceOne(const Parts* parts)
+//       : m_calls(parts->metrics->counter("service_one", "calls_total",
+//                                         "function_one")),
+//         m_queue_depth(parts->metrics->gauge("service_one", "queue_depth")),
+//         m_latency(parts->metrics->histogram("service_one", "task_ns"))
+//       {}
+//    b) ServiceOne::function_one()
+//       { m_calls.add(); m_queue_depth.add(1); ... }
+//    c) processor()
+//       { ... m_queue_depth.add(-1);
+//             ScopedLatency timer(m_latency); // code for processing the task
+//       }
+//    d) std::string text = parts.metrics->dump(MetricsFormat::PROMETHEUS);
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Threads with an exclusive shard, the others share the overflow shard
+constexpr size_t max_metric_threads = 256;
+
+namespace detail {
+
+// Free shard slots, taken by a thread on its first metric update and given
+// back when it exits
+class MetricThreadSlots {
+ public:
+  static size_t index() {
+    static thread_local Slot slot;
+    return slot.index;
+  }
+
+ private:
+  struct Slot {
+    Slot() : index(acquire()) {}
+    ~Slot() { release(index); }
+    size_t index;
+  };
+
+  static MetricThreadSlots& instance() {
+    static MetricThreadSlots slots;
+    return slots;
+  }
+
+  static size_t acquire() {
+    MetricThreadSlots& slots = instance();
+    std::lock_guard<std::mutex> lock(slots.m_mutex);
+    if (!slots.m_free.empty()) {
+      size_t index = slots.m_free.back();
+      slots.m_free.pop_back();
+      return index;
+    }
+    return slots.m_next < max_metric_threads ? slots.m_next++
+                                             : max_metric_threads;
+  }
+
+  static void release(size_t index) {
+    if (index == max_metric_threads) return;
+    MetricThreadSlots& slots = instance();
+    std::lock_guard<std::mutex> lock(slots.m_mutex);
+    slots.m_free.push_back(index);
+  }
+
+  std::mutex m_mutex;
+  std::vector<size_t> m_free;
+  size_t m_next = 0;
+};
+
+// Add to a shard value. Only the owner thread writes an exclusive shard, so
+// a plain load + store is enough and readers never see a torn value.
+inline void shard_add(std::atomic<uint64_t>& value, uint64_t n,
+                      bool exclusive) {
+  if (exclusive)
+    value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  else
+    value.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void shard_max(std::atomic<uint64_t>& value, uint64_t n,
+                      bool exclusive) {
+  uint64_t current = value.load(std::memory_order_relaxed);
+  if (exclusive) {
+    if (n > current) value.store(n, std::memory_order_relaxed);
+  } else {
+    while (n > current &&
+           !value.compare_exchange_weak(current, n, std::memory_order_relaxed))
+      ;
+  }
+}
+
+// Per thread shards of a metric, allocated on the first use of a thread
+template <typename Shard>
+class Sharded {
+ public:
+  Sharded() { m_shards[max_metric_threads].store(new Shard()); }
+  Sharded(const Sharded&) = delete;
+  Sharded& operator=(const Sharded&) = delete;
+  ~Sharded() {
+    for (auto& shard : m_shards) delete shard.load(std::memory_order_relaxed);
+  }
+
+  // Shard of the calling thread, exclusive is false for the overflow shard
+  Shard& local(bool& exclusive) {
+    size_t index = MetricThreadSlots::index();
+    exclusive = index != max_metric_threads;
+    Shard* shard = m_shards[index].load(std::memory_order_acquire);
+    if (!shard) {
+      // Only the owner of the slot gets here
+      shard = new Shard();
+      m_shards[index].store(shard, std::memory_order_release);
+    }
+    return *shard;
+  }
+
+  template <typename Fn>
+  void for_each(Fn&& fn) const {
+    for (auto& shard : m_shards)
+      if (const Shard* s = shard.load(std::memory_order_acquire)) fn(*s);
+  }
+
+ private:
+  std::array<std::atomic<Shard*>, max_metric_threads + 1> m_shards{};
+};
+
+}  // namespace detail
+
+// Monotonic count of events
+class Counter {
+ public:
+  void add(uint64_t n = 1) {
+    bool exclusive = false;
+    detail::shard_add(m_shards.local(exclusive).value, n, exclusive);
+  }
+
+  uint64_t value() const {
+    uint64_t sum = 0;
+    m_shards.for_each([&sum](const Shard& shard) {
+      sum += shard.value.load(std::memory_order_relaxed);
+    });
+    return sum;
+  }
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value{0};
+  };
+
+  mutable detail::Sharded<Shard> m_shards;
+};
+
+// Value that goes up and down, like a queue depth
+class Gauge {
+ public:
+  void set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+  void add(int64_t delta) {
+    m_value.fetch_add(delta, std::memory_order_relaxed);
+  }
+  int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+ private:
+  alignas(64) std::atomic<int64_t> m_value{0};
+};
+
+// Merged view of a Histogram
+struct HistogramSnapshot {
+  static constexpr unsigned int sub_bits = 3;
+  static constexpr size_t sub_buckets = size_t{1} << sub_bits;
+  static constexpr size_t bucket_count = (64 - sub_bits + 1) * sub_buckets;
+
+  static size_t bucket(uint64_t value) {
+    if (value < sub_buckets) return static_cast<size_t>(value);
+    unsigned int shift = 63 - __builtin_clzll(value) - sub_bits;
+    return (shift + 1) * sub_buckets + ((value >> shift) & (sub_buckets - 1));
+  }
+
+  // Largest value that falls into the bucket
+  static uint64_t bucket_upper(size_t index) {
+    if (index < sub_buckets) return index;
+    unsigned int shift = static_cast<unsigned int>(index / sub_buckets - 1);
+    uint64_t sub = sub_buckets + index % sub_buckets;
+    return ((sub + 1) << shift) - 1;
+  }
+
+  // Upper bound of the bucket holding the q-th quantile (0 <= q <= 1),
+  // capped by the exact max
+  uint64_t quantile(double q) const {
+    if (count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count - 1));
+    uint64_t seen = 0;
+    for (size_t index = 0; index < bucket_count; index++) {
+      seen += buckets[index];
+      if (seen > rank) return std::min(bucket_upper(index), max);
+    }
+    return max;
+  }
+
+  double mean() const {
+    return count ? static_cast<double>(sum) / static_cast<double>(count) : 0;
+  }
+
+  std::array<uint64_t, bucket_count> buckets{};
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+};
+
+// Distribution of values, usually latencies in ns
+class Histogram {
+ public:
+  void record(uint64_t value) {
+    bool exclusive = false;
+    Shard& shard = m_shards.local(exclusive);
+    detail::shard_add(shard.buckets[HistogramSnapshot::bucket(value)], 1,
+                      exclusive);
+    detail::shard_add(shard.sum, value, exclusive);
+    detail::shard_max(shard.max, value, exclusive);
+  }
+
+  HistogramSnapshot snapshot() const {
+    HistogramSnapshot snapshot;
+    m_shards.for_each([&snapshot](const Shard& shard) {
+      for (size_t index = 0; index < HistogramSnapshot::bucket_count;
+           index++) {
+        uint64_t count = shard.buckets[index].load(std::memory_order_relaxed);
+        snapshot.buckets[index] += count;
+        snapshot.count += count;
+      }
+      snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+      snapshot.max =
+          std::max(snapshot.max, shard.max.load(std::memory_order_relaxed));
+    });
+    return snapshot;
+  }
+
+ private:
+  struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, HistogramSnapshot::bucket_count>
+        buckets{};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+  };
+
+  mutable detail::Sharded<Shard> m_shards;
+};
+
+// Records the lifetime of the scope in ns into a Histogram
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(Histogram& histogram)
+      : m_histogram(histogram), m_begin(std::chrono::steady_clock::now()) {}
+  ~ScopedLatency() {
+    m_histogram.record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_begin)
+            .count()));
+  }
+
+ private:
+  Histogram& m_histogram;
+  std::chrono::steady_clock::time_point m_begin;
+};
+
+// CPU time of the calling thread in ns, e.g. to account the CPU time of a
+// processor() loop iteration to a Counter. This is a syscall, unlike the
+// steady_clock of ScopedLatency.
+inline uint64_t thread_cpu_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL +
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+enum class MetricsFormat {
+  TEXT,
+  PROMETHEUS,
+};
+
+class MetricsRegistry {
+ public:
+  // The metric of the service, created on first use. The reference stays
+  // valid for the lifetime of the registry, look it up once and keep it for
+  // the hot path. call distinguishes call types of one service metric.
+  Counter& counter(const std::string& service, const std::string& name,
+                   const std::string& call = std::string()) {
+    return get(m_counters, service, name, call);
+  }
+  Gauge& gauge(const std::string& service, const std::string& name,
+               const std::string& call = std::string()) {
+    return get(m_gauges, service, name, call);
+  }
+  Histogram& histogram(const std::string& service, const std::string& name,
+                       const std::string& call = std::string()) {
+    return get(m_histograms, service, name, call);
+  }
+
+  std::string dump(MetricsFormat format) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string out;
+    bool prometheus = format == MetricsFormat::PROMETHEUS;
+
+    dump_metrics(out, m_counters, prometheus ? "counter" : nullptr,
+                 [](std::string& line, const std::string& labels,
+                    const std::string& name, const Counter& counter) {
+                   append(line, "%s%s %" PRIu64 "\n", name.c_str(),
+                          labels.c_str(), counter.value());
+                 });
+    dump_metrics(out, m_gauges, prometheus ? "gauge" : nullptr,
+                 [](std::string& line, const std::string& labels,
+                    const std::string& name, const Gauge& gauge) {
+                   append(line, "%s%s %" PRId64 "\n", name.c_str(),
+                          labels.c_str(), gauge.value());
+                 });
+    dump_metrics(
+        out, m_histograms, prometheus ? "summary" : nullptr,
+        [prometheus](std::string& line, const std::string& labels,
+                     const std::string& name, const Histogram& histogram) {
+          HistogramSnapshot snapshot = histogram.snapshot();
+          if (!prometheus) {
+            append(line,
+                   "%s%s count=%" PRIu64 " mean=%.1f p50=%" PRIu64
+                   " p90=%" PRIu64 " p99=%" PRIu64 " p99.9=%" PRIu64
+                   " max=%" PRIu64 "\n",
+                   name.c_str(), labels.c_str(), snapshot.count,
+                   snapshot.mean(), snapshot.quantile(0.5),
+                   snapshot.quantile(0.9), snapshot.quantile(0.99),
+                   snapshot.quantile(0.999), snapshot.max);
+            return;
+          }
+          // labels is {...}, the quantile goes inside the braces
+          std::string open = labels.substr(0, labels.size() - 1);
+          for (double q : {0.5, 0.9, 0.99, 0.999, 1.0})
+            append(line, "%s%s,quantile=\"%g\"} %" PRIu64 "\n", name.c_str(),
+                   open.c_str(), q, snapshot.quantile(q));
+          append(line, "%s_sum%s %" PRIu64 "\n", name.c_str(), labels.c_str(),
+                 snapshot.sum);
+          append(line, "%s_count%s %" PRIu64 "\n", name.c_str(),
+                 labels.c_str(), snapshot.count);
+        });
+    return out;
+  }
+
+  // Write the dump to path through a temporary file and rename(), so readers
+  // never see a partial file. Returns 0 or -errno.
+  int write_file(const std::string& path, MetricsFormat format) const {
+    std::string text = dump(format);
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0) return -errno;
+    size_t written = 0;
+    while (written < text.size()) {
+      ssize_t n = ::write(fd, text.data() + written, text.size() - written);
+      if (n < 0) {
+        int err = errno;
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        return -err;
+      }
+      written += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    if (::rename(tmp.c_str(), path.c_str()) != 0) return -errno;
+    return 0;
+  }
+
+ private:
+  // (name, service, call), sorted by name so a Prometheus TYPE line is
+  // written once per metric name
+  using Key = std::tuple<std::string, std::string, std::string>;
+  template <typename Metric>
+  using Map = std::map<Key, std::unique_ptr<Metric>>;
+
+  template <typename Metric>
+  Metric& get(Map<Metric>& map, const std::string& service,
+              const std::string& name, const std::string& call) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& metric = map[Key(name, service, call)];
+    if (!metric) metric = std::make_unique<Metric>();
+    return *metric;
+  }
+
+  template <typename... Args>
+  static void append(std::string& out, const char* format, Args... args) {
+    char buf[512];
+    int len = std::snprintf(buf, sizeof(buf), format, args...);
+    if (len > 0)
+      out.append(buf, std::min(static_cast<size_t>(len), sizeof(buf) - 1));
+  }
+
+  // Prometheus (type set): name{service="...",call="..."},
+  // text: service.name[call]
+  template <typename Metric, typename Fn>
+  static void dump_metrics(std::string& out, const Map<Metric>& map,
+                           const char* type, Fn&& fn) {
+    const std::string* last_name = nullptr;
+    for (const auto& entry : map) {
+      const std::string& name = std::get<0>(entry.first);
+      const std::string& service = std::get<1>(entry.first);
+      const std::string& call = std::get<2>(entry.first);
+      std::string labels;
+      if (type) {
+        if (!last_name || *last_name != name)
+          append(out, "# TYPE %s %s\n", name.c_str(), type);
+        labels = "{service=\"" + service + "\"";
+        if (!call.empty()) labels += ",call=\"" + call + "\"";
+        labels += "}";
+        fn(out, labels, name, *entry.second);
+      } else {
+        std::string full = service + "." + name;
+        if (!call.empty()) labels = "[" + call + "]";
+        fn(out, labels, full, *entry.second);
+      }
+      last_name = &name;
+    }
+  }
+
+  mutable std::mutex m_mutex;
+  Map<Counter> m_counters;
+  Map<Gauge> m_gauges;
+  Map<Histogram> m_histograms;
+};
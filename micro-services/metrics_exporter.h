@@ -0,0 +1,228 @@
+//   1). MetricsExporter is a service that publishes the MetricsRegistry of the
+//   Parts (see metrics.h) outside of the process:
+//      a) socket_path - every client connecting to this Unix stream socket
+//                       gets a dump of the metrics, then the connection is
+//                       closed, e.g. `socat - UNIX-CONNECT:/run/app.metrics`
+//      b) file_path   - the dump is written to this file every period, e.g.
+//                       for the node exporter textfile collector
+//   Either of them can be empty. Its thread only wakes up for a client or the
+//   period, the services recording metrics are never involved. The dump is
+//   sent without blocking: clients whose socket buffer is full stay in the
+//   poll set until they took all of it, a client that did not take it within
+//   client_timeout is dropped, and cancel() drops the clients still pending.
+//   At most max_clients are served at once, the others wait in the backlog.
+//
+// ** Example:
+//    MetricsExporter::Options options;
+//    options.socket_path = "/run/app.metrics";
+//    options.format = MetricsFormat::PROMETHEUS;
+//    IService* exporter = new MetricsExporter(&parts, options);
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "services.h"
+
+struct MetricsExporterOptions {
+  std::string socket_path;
+  std::string file_path;
+  std::chrono::milliseconds period{10000};
+  std::chrono::milliseconds client_timeout{5000};
+  size_t max_clients = 16;
+  MetricsFormat format = MetricsFormat::PROMETHEUS;
+};
+
+class MetricsExporter : public IService {
+ public:
+  using Options = MetricsExporterOptions;
+
+  MetricsExporter(const Parts* parts, Options options)
+      : m_parts(parts), m_options(std::move(options)) {}
+  ~MetricsExporter() { close_fds(); }
+
+  DECLARE_SERVICE(MetricsExporter)
+
+ private:
+  // Returns 0 or -errno
+  int listen_socket() {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (m_options.socket_path.size() >= sizeof(addr.sun_path))
+      return -ENAMETOOLONG;
+    std::memcpy(addr.sun_path, m_options.socket_path.c_str(),
+                m_options.socket_path.size() + 1);
+
+    m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_listen_fd < 0) return -errno;
+    // A stale socket of a previous run
+    ::unlink(m_options.socket_path.c_str());
+    if (::bind(m_listen_fd, reinterpret_cast<sockaddr*>(&addr),
+               sizeof(addr)) != 0 ||
+        ::listen(m_listen_fd, 16) != 0) {
+      int err = errno;
+      ::close(m_listen_fd);
+      m_listen_fd = -1;
+      return -err;
+    }
+    return 0;
+  }
+
+  using Clock = std::chrono::steady_clock;
+
+  // Client still taking its dump
+  struct Client {
+    int fd;
+    std::string text;
+    size_t written;
+    Clock::time_point deadline;
+  };
+
+  // Sends what the socket buffer takes. Returns true if the client is done,
+  // with the whole dump sent or an error.
+  static bool send_some(Client& client) {
+    while (client.written < client.text.size()) {
+      ssize_t n = ::send(client.fd, client.text.data() + client.written,
+                         client.text.size() - client.written, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+      if (n <= 0) return true;
+      client.written += static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  // The client socket is non-blocking, the rest of the dump is sent by
+  // processor() when the client can take it
+  void accept_client() {
+    int fd = ::accept4(m_listen_fd, nullptr, nullptr,
+                       SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) return;
+    Client client{fd, m_registry->dump(m_options.format), 0,
+                  Clock::now() + m_options.client_timeout};
+    if (send_some(client))
+      ::close(fd);
+    else
+      m_clients.push_back(std::move(client));
+  }
+
+  void processor() {
+    auto next_write = Clock::now();
+    std::vector<pollfd> fds;
+    while (true) {
+      auto now = Clock::now();
+      auto wake_up = Clock::time_point::max();
+      if (!m_options.file_path.empty()) {
+        if (now >= next_write) {
+          m_registry->write_file(m_options.file_path, m_options.format);
+          next_write = now + m_options.period;
+        }
+        wake_up = next_write;
+      }
+      // Too slow clients are dropped
+      for (size_t n = 0; n < m_clients.size();) {
+        if (now >= m_clients[n].deadline) {
+          drop_client(n);
+          continue;
+        }
+        wake_up = std::min(wake_up, m_clients[n].deadline);
+        n++;
+      }
+      int timeout = -1;
+      if (wake_up != Clock::time_point::max())
+        // Rounded up, so the loop does not spin before the deadline
+        timeout = static_cast<int>(
+            std::chrono::ceil<std::chrono::milliseconds>(wake_up - now)
+                .count());
+
+      fds.clear();
+      fds.push_back({m_cancel_fd, POLLIN, 0});
+      bool accepting =
+          m_listen_fd >= 0 && m_clients.size() < m_options.max_clients;
+      if (accepting) fds.push_back({m_listen_fd, POLLIN, 0});
+      size_t first_client = fds.size();
+      for (const Client& client : m_clients)
+        fds.push_back({client.fd, POLLOUT, 0});
+
+      int ready = ::poll(fds.data(), fds.size(), timeout);
+      if (ready < 0 && errno != EINTR) return;
+      if (ready <= 0) continue;
+      if (fds[0].revents) return;
+      // Backwards, dropping a client moves the last one into its place
+      for (size_t n = m_clients.size(); n-- > 0;)
+        if (fds[first_client + n].revents && send_some(m_clients[n]))
+          drop_client(n);
+      if (accepting && (fds[1].revents & POLLIN)) accept_client();
+    }
+  }
+
+  void drop_client(size_t index) {
+    ::close(m_clients[index].fd);
+    if (index + 1 != m_clients.size())
+      m_clients[index] = std::move(m_clients.back());
+    m_clients.pop_back();
+  }
+
+  void close_fds() {
+    while (!m_clients.empty()) drop_client(m_clients.size() - 1);
+    if (m_listen_fd >= 0) {
+      ::close(m_listen_fd);
+      ::unlink(m_options.socket_path.c_str());
+      m_listen_fd = -1;
+    }
+    if (m_cancel_fd >= 0) {
+      ::close(m_cancel_fd);
+      m_cancel_fd = -1;
+    }
+  }
+
+  const Parts* m_parts;
+  Options m_options;
+  MetricsRegistry* m_registry = nullptr;
+  int m_listen_fd = -1;
+  // Only used by processor()
+  std::vector<Client> m_clients;
+  // Written by cancel() to wake up processor()
+  int m_cancel_fd = -1;
+  // Thread running processor() loop
+  std::thread m_loop_thread;
+};
+
+inline void MetricsExporter::start(const Parts* parts) {
+  m_parts = parts;
+  m_registry = parts->metrics;
+  if (!m_registry) return;
+  m_cancel_fd = ::eventfd(0, EFD_CLOEXEC);
+  if (m_cancel_fd < 0) return;
+  if (!m_options.socket_path.empty() && listen_socket() != 0)
+    std::fprintf(stderr, "MetricsExporter: cannot listen on %s\n",
+                 m_options.socket_path.c_str());
+  m_loop_thread = std::thread(&MetricsExporter::processor, this);
+}
+
+inline void MetricsExporter::cancel() {
+  if (m_cancel_fd < 0) return;
+  uint64_t one = 1;
+  ssize_t n = ::write(m_cancel_fd, &one, sizeof(one));
+  (void)n;
+}
+
+inline void MetricsExporter::join() {
+  if (m_loop_thread.joinable()) m_loop_thread.join();
+  close_fds();
+}
+
+inline void MetricsExporter::destroy() { delete this; }
@@ -0,0 +1,244 @@
+// Test of metrics.h and of the metrics recorded by the service framework
+//
+// Threads update shared counters and histograms, the merged values must be
+// exact (counts, sums, max) and the quantiles within the bucket precision.
+// Threads that exit hand their shard to new threads without losing counts.
+// A ServiceManager and an Executor started with parts.metrics set must
+// record the start/stop times of the services and the queue depth, queue
+// wait and run time of the tasks on their own, and the dumps must list them.
+// The MetricsExporter must send a dump larger than the socket buffer whole to
+// a client reading it slowly, drop a client that does not read within the
+// client timeout, and stop at cancel() with a client still pending.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o metrics_test metrics_test.cpp
+//   ./metrics_test
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "executor.h"
+#include "metrics.h"
+#include "metrics_exporter.h"
+#include "service_manager.h"
+#include "test_util.h"
+
+namespace {
+
+constexpr int threads = 8;
+constexpr uint64_t events = 100000;
+
+void test_sharded_sums() {
+  MetricsRegistry registry;
+  Counter& counter = registry.counter("test", "events_total");
+  Histogram& histogram = registry.histogram("test", "value_ns");
+  Gauge& gauge = registry.gauge("test", "depth");
+  std::vector<std::thread> workers;
+  for (int n = 0; n < threads; n++)
+    workers.emplace_back([&] {
+      for (uint64_t i = 1; i <= events; i++) {
+        counter.add();
+        histogram.record(i);
+        gauge.add(1);
+        gauge.add(-1);
+      }
+    });
+  for (std::thread& worker : workers) worker.join();
+  // New threads take over the shards of the exited ones
+  workers.clear();
+  for (int n = 0; n < threads; n++)
+    workers.emplace_back([&] { counter.add(2); });
+  for (std::thread& worker : workers) worker.join();
+
+  CHECK(counter.value() == threads * events + 2 * threads);
+  CHECK(gauge.value() == 0);
+  HistogramSnapshot snapshot = histogram.snapshot();
+  CHECK(snapshot.count == threads * events);
+  CHECK(snapshot.sum == threads * events * (events + 1) / 2);
+  CHECK(snapshot.max == events);
+  // Buckets hold values within 1/8 of their upper bound
+  for (double q : {0.5, 0.9, 0.99}) {
+    double exact = q * events;
+    double value = static_cast<double>(snapshot.quantile(q));
+    CHECK(value >= exact * 0.99 && value <= exact * 1.13);
+  }
+  CHECK(snapshot.quantile(1.0) == events);
+}
+
+void test_buckets() {
+  // Every value falls into the bucket whose range holds it
+  for (uint64_t value : {0ull, 1ull, 7ull, 8ull, 9ull, 15ull, 16ull, 1000ull,
+                         123456789ull, ~0ull >> 1, ~0ull}) {
+    size_t bucket = HistogramSnapshot::bucket(value);
+    CHECK(bucket < HistogramSnapshot::bucket_count);
+    CHECK(value <= HistogramSnapshot::bucket_upper(bucket));
+    CHECK(bucket == 0 ||
+          value > HistogramSnapshot::bucket_upper(bucket - 1));
+  }
+}
+
+class SleepyService : public IService {
+ public:
+  SleepyService(const char* name, std::vector<const IService*> dependencies)
+      : m_name(name), m_dependencies(std::move(dependencies)) {}
+
+  void start(const Parts*) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  void cancel() override {}
+  void join() override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  void destroy() override {}
+  std::string name() override { return m_name; }
+  std::vector<const IService*> dependencies(const Parts*) const override {
+    return m_dependencies;
+  }
+
+ private:
+  std::string m_name;
+  std::vector<const IService*> m_dependencies;
+};
+
+void test_framework_metrics() {
+  MetricsRegistry registry;
+  Parts parts;
+  parts.metrics = &registry;
+  // Owned by the ServiceManager, destroy() deletes it
+  auto* executor = new Executor(&parts, 4);
+  parts.executor = executor;
+  SleepyService user("user", {executor});
+
+  ServiceManager manager(2);
+  manager.add(executor);
+  manager.add(&user);
+  CHECK(manager.start(&parts));
+
+  constexpr long tasks = 10000;
+  std::atomic<long> ran = {0};
+  {
+    TaskSource serial(executor);
+    for (long n = 0; n < tasks; n++) {
+      executor->post([&] { ran++; });
+      serial.post([&] { ran++; });
+    }
+    serial.join();
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (ran < 2 * tasks && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  CHECK(ran == 2 * tasks);
+  // The task that ran last may still be recording
+  while (registry.gauge("executor", "queue_depth").value() != 0 &&
+         std::chrono::steady_clock::now() < deadline)
+    std::this_thread::yield();
+  CHECK(registry.gauge("executor", "queue_depth").value() == 0);
+  HistogramSnapshot queued = registry.histogram("executor", "queue_ns")
+                                 .snapshot();
+  HistogramSnapshot run = registry.histogram("executor", "task_ns").snapshot();
+  // Serial tasks run in batches of at least one
+  CHECK(queued.count >= tasks + 1 && queued.count <= 2 * tasks);
+  CHECK(run.count == queued.count);
+
+  int64_t start_ns = registry.gauge("user", "start_ns").value();
+  CHECK(start_ns >= 2000000);
+  CHECK(registry.gauge("Executor", "start_ns").value() > 0);
+
+  std::string text = registry.dump(MetricsFormat::TEXT);
+  std::string prometheus = registry.dump(MetricsFormat::PROMETHEUS);
+  for (const char* name : {"queue_depth", "queue_ns", "task_ns", "start_ns"}) {
+    CHECK(text.find(name) != std::string::npos);
+    CHECK(prometheus.find(std::string("# TYPE ") + name) != std::string::npos);
+  }
+  CHECK(prometheus.find("start_ns{service=\"user\"}") != std::string::npos);
+
+  manager.stop();
+  CHECK(registry.gauge("user", "stop_ns").value() >= 1000000);
+  CHECK(registry.gauge("Executor", "stop_ns").value() > 0);
+}
+
+// Connected client socket, -1 on error
+int connect_to(const std::string& path) {
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Bytes read until the exporter closed the connection, pausing after every
+// read of at most chunk bytes
+size_t read_all(int fd, size_t chunk, std::chrono::microseconds pause) {
+  std::vector<char> buf(chunk);
+  size_t total = 0;
+  while (true) {
+    ssize_t n = ::read(fd, buf.data(), buf.size());
+    if (n <= 0) return total;
+    total += static_cast<size_t>(n);
+    std::this_thread::sleep_for(pause);
+  }
+}
+
+void test_exporter() {
+  MetricsRegistry registry;
+  // A dump of more than 600 kB, far more than a socket buffer
+  for (int n = 0; n < 2000; n++)
+    registry.histogram("service_" + std::to_string(n), "task_ns").record(n);
+  size_t dump_size = registry.dump(MetricsFormat::PROMETHEUS).size();
+  Parts parts;
+  parts.metrics = &registry;
+  MetricsExporter::Options options;
+  options.socket_path = "/tmp/metrics_test_" + std::to_string(getpid());
+  options.client_timeout = std::chrono::milliseconds(1000);
+  MetricsExporter exporter(&parts, options);
+  exporter.start(&parts);
+
+  // Starts reading once the socket buffer is full, then slowly
+  int slow = connect_to(options.socket_path);
+  CHECK(slow >= 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  CHECK(read_all(slow, 64 * 1024, std::chrono::microseconds(200)) ==
+        dump_size);
+  ::close(slow);
+
+  // Never reads before the timeout, the exporter drops it
+  int stuck = connect_to(options.socket_path);
+  CHECK(stuck >= 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  CHECK(read_all(stuck, 64 * 1024, std::chrono::microseconds(0)) < dump_size);
+  ::close(stuck);
+
+  // cancel() does not wait for the pending client
+  int pending = connect_to(options.socket_path);
+  CHECK(pending >= 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  auto start = std::chrono::steady_clock::now();
+  exporter.cancel();
+  exporter.join();
+  CHECK(std::chrono::steady_clock::now() - start <
+        std::chrono::milliseconds(500));
+  ::close(pending);
+}
+
+}  // namespace
+
+int main() {
+  test_sharded_sums();
+  test_buckets();
+  test_framework_metrics();
+  test_exporter();
+  return test_result();
+}
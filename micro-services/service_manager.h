@@ -0,0 +1,298 @@
+//   1). ServiceManager starts and stops the services of services.h in
+//   dependency order instead of the service_table order, running the services
+//   that do not depend on each other in parallel.
+//
+//   2) Dependencies are declared by each service with dependencies(), as the
+//   Parts slots it calls into. The manager builds the DAG once all services
+//   are created (so all Parts slots are filled) and then:
+//      a) start()  - calls start() of a service on a worker thread as soon as
+//                    all of its dependencies are started. The worker threads
+//                    are kept until stop() has run the services down.
+//      b) stop()   - calls cancel() and join() of a service as soon as all the
+//                    services depending on it are joined, so a service never
+//                    outlives the services it talks to, then destroy() of all
+//                    of them in reverse topological order
+//
+//   3) The duration of start(), cancel() + join() and destroy() of every
+//   service is recorded and available with timings() once stop() returned,
+//   until a service is added again. With parts->metrics set (see metrics.h)
+//   the start() and cancel() + join() durations are also set as the start_ns
+//   and stop_ns gauges of the service, so they are exported while it runs.
+//
+//   4) A dependency cycle is detected before anything is started, start()
+//   then returns false.
+//
+// ** Example:
+// static NewService service_table[] = { new_service_one, new_service_two, 0 };
+// Parts parts;
+// ServiceManager manager;
+//
+// manager.create(service_table, &parts);
+// if (!manager.start(&parts)) { // dependency cycle }
+// while (<execution_condition> + /*signal_handler*/) { // your code }
+// manager.stop();
+//
+// for (const auto& timing : manager.timings())
+//   printf("%s start %lld us\n", timing.name.c_str(),
+//          (long long)timing.start.count() / 1000);
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.h"
+#include "services.h"
+
+namespace detail {
+
+// Calls fn(node) for all nodes of a DAG on a pool of threads, each node only
+// after fn() returned for all its predecessors. The calling thread takes
+// part, the other workers are started by the first run() and kept for the
+// following ones until the DagRunner is destroyed.
+class DagRunner {
+ public:
+  explicit DagRunner(unsigned int threads)
+      : m_threads(std::max(1u, threads)) {}
+  DagRunner(const DagRunner&) = delete;
+  DagRunner& operator=(const DagRunner&) = delete;
+  ~DagRunner() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_exit = true;
+    }
+    m_cv.notify_all();
+    for (auto& thread : m_workers) thread.join();
+  }
+
+  // next[node] lists the nodes that follow node, pending[node] is the number
+  // of its predecessors
+  void run(const std::vector<std::vector<size_t>>& next,
+           std::vector<size_t> pending, std::function<void(size_t)> fn) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_next = &next;
+    m_pending = std::move(pending);
+    m_fn = std::move(fn);
+    m_done = 0;
+    m_count = next.size();
+    m_ready.clear();
+    for (size_t node = 0; node < m_count; node++)
+      if (m_pending[node] == 0) m_ready.push_back(node);
+
+    size_t threads = std::min<size_t>(m_threads, m_count);
+    while (m_workers.size() + 1 < threads)
+      m_workers.emplace_back(&DagRunner::worker_loop, this);
+    m_cv.notify_all();
+
+    work(lock);
+    // The workers must be out of fn() and done with the run state
+    m_cv.wait(lock, [this]() { return m_busy == 0; });
+    m_fn = nullptr;
+    m_next = nullptr;
+  }
+
+ private:
+  // Run ready nodes until all nodes of the current run are done
+  void work(std::unique_lock<std::mutex>& lock) {
+    while (true) {
+      m_cv.wait(lock,
+                [this]() { return !m_ready.empty() || m_done == m_count; });
+      if (m_done == m_count) return;
+      size_t node = m_ready.front();
+      m_ready.pop_front();
+
+      lock.unlock();
+      m_fn(node);
+      lock.lock();
+
+      m_done++;
+      for (size_t follower : (*m_next)[node])
+        if (--m_pending[follower] == 0) m_ready.push_back(follower);
+      m_cv.notify_all();
+    }
+  }
+
+  void worker_loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_cv.wait(lock, [this]() { return m_exit || !m_ready.empty(); });
+      if (m_exit) return;
+      m_busy++;
+      work(lock);
+      m_busy--;
+      m_cv.notify_all();
+    }
+  }
+
+  const unsigned int m_threads;
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  // -- Locked by m_mutex --
+  bool m_exit = false;
+  // Workers inside work()
+  size_t m_busy = 0;
+  // State of the current run()
+  const std::vector<std::vector<size_t>>* m_next = nullptr;
+  std::vector<size_t> m_pending;
+  std::function<void(size_t)> m_fn;
+  std::deque<size_t> m_ready;
+  size_t m_done = 0;
+  size_t m_count = 0;
+};
+
+}  // namespace detail
+
+class ServiceManager {
+ public:
+  struct Timing {
+    std::string name;
+    std::chrono::nanoseconds start{0};
+    std::chrono::nanoseconds stop{0};
+    std::chrono::nanoseconds destroy{0};
+  };
+
+  explicit ServiceManager(
+      unsigned int threads = std::thread::hardware_concurrency())
+      : m_threads(threads ? threads : 1) {}
+
+  // Create the services of the NULL terminated table, a service can be NULL
+  // if not applicable to the hardware
+  void create(const NewService* service_table, Parts* parts) {
+    for (size_t n = 0; service_table[n]; n++) add(service_table[n](parts));
+  }
+
+  void add(IService* service) {
+    if (!service) return;
+    // Timings left by the previous stop()
+    if (m_services.empty()) m_timings.clear();
+    m_services.push_back(service);
+    m_timings.push_back({service->name()});
+  }
+
+  // Start all services, independent ones in parallel. Returns false without
+  // starting any service if the dependencies have a cycle.
+  bool start(const Parts* parts) {
+    if (!build_graph(parts)) return false;
+
+    m_metrics = parts ? parts->metrics : nullptr;
+    m_runner = std::make_unique<detail::DagRunner>(m_threads);
+    m_runner->run(m_dependents, m_dependency_count, [this, parts](size_t node) {
+      auto begin = Clock::now();
+      m_services[node]->start(parts);
+      m_timings[node].start = Clock::now() - begin;
+      record(node, "start_ns", m_timings[node].start);
+    });
+    m_started = true;
+    return true;
+  }
+
+  // Cancel and join every service once its dependents are joined, then
+  // destroy the services in reverse topological order. Services that were
+  // never started are only destroyed, in reverse creation order.
+  void stop() {
+    if (!m_started) {
+      m_order.clear();
+      for (size_t node = 0; node < m_services.size(); node++)
+        m_order.push_back(node);
+      destroy();
+      return;
+    }
+
+    std::vector<size_t> dependent_count(m_services.size());
+    for (size_t node = 0; node < m_services.size(); node++)
+      dependent_count[node] = m_dependents[node].size();
+
+    m_runner->run(m_dependencies, dependent_count, [this](size_t node) {
+      auto begin = Clock::now();
+      m_services[node]->cancel();
+      m_services[node]->join();
+      m_timings[node].stop = Clock::now() - begin;
+      record(node, "stop_ns", m_timings[node].stop);
+    });
+    m_runner.reset();
+    destroy();
+    m_started = false;
+  }
+
+  // Per service timings in creation order, see 3). at the top
+  const std::vector<Timing>& timings() const { return m_timings; }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  void record(size_t node, const char* name, std::chrono::nanoseconds time) {
+    if (m_metrics)
+      m_metrics->gauge(m_timings[node].name, name).set(time.count());
+  }
+
+  void destroy() {
+    for (auto it = m_order.rbegin(); it != m_order.rend(); ++it) {
+      auto begin = Clock::now();
+      m_services[*it]->destroy();
+      m_timings[*it].destroy = Clock::now() - begin;
+    }
+    m_services.clear();
+  }
+
+  // Resolve the dependencies to service indices and compute a topological
+  // order (Kahn), false on a cycle
+  bool build_graph(const Parts* parts) {
+    size_t count = m_services.size();
+    std::unordered_map<const IService*, size_t> index;
+    for (size_t node = 0; node < count; node++) index[m_services[node]] = node;
+
+    m_dependencies.assign(count, {});
+    m_dependents.assign(count, {});
+    m_dependency_count.assign(count, 0);
+    for (size_t node = 0; node < count; node++) {
+      for (const IService* dependency : m_services[node]->dependencies(parts)) {
+        auto it = index.find(dependency);
+        // Not created or not managed here, nothing to wait for
+        if (it == index.end() || it->second == node) continue;
+        auto& dependencies = m_dependencies[node];
+        if (std::find(dependencies.begin(), dependencies.end(), it->second) !=
+            dependencies.end())
+          continue;
+        dependencies.push_back(it->second);
+        m_dependents[it->second].push_back(node);
+        m_dependency_count[node]++;
+      }
+    }
+
+    m_order.clear();
+    std::vector<size_t> pending = m_dependency_count;
+    for (size_t node = 0; node < count; node++)
+      if (pending[node] == 0) m_order.push_back(node);
+    for (size_t n = 0; n < m_order.size(); n++)
+      for (size_t dependent : m_dependents[m_order[n]])
+        if (--pending[dependent] == 0) m_order.push_back(dependent);
+    return m_order.size() == count;
+  }
+
+  unsigned int m_threads;
+  bool m_started = false;
+  // Workers of start() and stop(), see 2). at the top
+  std::unique_ptr<detail::DagRunner> m_runner;
+  // parts->metrics of start(), may be nullptr
+  MetricsRegistry* m_metrics = nullptr;
+  std::vector<IService*> m_services;
+  std::vector<Timing> m_timings;
+
+  // Indices into m_services
+  std::vector<std::vector<size_t>> m_dependencies;
+  std::vector<std::vector<size_t>> m_dependents;
+  std::vector<size_t> m_dependency_count;
+  std::vector<size_t> m_order;
+};
@@ -0,0 +1,235 @@
+// Test of ServiceManager ordering
+//
+// A diamond of services (top depends on left and right, both depend on base)
+// plus an independent one is started and stopped. Every service must start
+// after its dependencies started and be joined after the services depending
+// on it were joined, destroy() must run in reverse dependency order, and left
+// and right must start in parallel. stop() must run on the worker threads of
+// start() instead of new ones. A dependency cycle must be rejected before any
+// service starts. Services added after stop() must get timings of their own.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -pthread -o service_manager_test
+//       service_manager_test.cpp
+//   ./service_manager_test
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "service_manager.h"
+#include "test_util.h"
+
+namespace {
+
+// Serial number of the calling thread, unlike std::thread::id never reused
+// by a later thread
+int thread_serial() {
+  static std::atomic_int next = {0};
+  thread_local int serial = ++next;
+  return serial;
+}
+
+// Order in which the steps of all services happened
+struct Log {
+  std::atomic_int clock = {0};
+  std::mutex mutex;
+  // Locked by mutex
+  std::set<int> start_threads;
+  std::set<int> stop_threads;
+};
+
+class TestService : public IService {
+ public:
+  TestService(const char* name, Log& log,
+              std::vector<const IService*> dependencies = {})
+      : m_name(name), m_log(log), m_dependencies(std::move(dependencies)) {}
+
+  void start(const Parts*) override {
+    {
+      std::lock_guard<std::mutex> lock(m_log.mutex);
+      m_log.start_threads.insert(thread_serial());
+    }
+    if (m_start_rendezvous) m_parallel = wait_for_others(*m_start_rendezvous);
+    started = ++m_log.clock;
+  }
+  void cancel() override { cancelled = ++m_log.clock; }
+  void join() override {
+    {
+      std::lock_guard<std::mutex> lock(m_log.mutex);
+      m_log.stop_threads.insert(thread_serial());
+    }
+    if (m_join_rendezvous) wait_for_others(*m_join_rendezvous);
+    joined = ++m_log.clock;
+  }
+  // Owned by the test, the steps are checked after stop()
+  void destroy() override { destroyed = ++m_log.clock; }
+  std::string name() override { return m_name; }
+  std::vector<const IService*> dependencies(const Parts*) const override {
+    return m_dependencies;
+  }
+
+  void set_dependencies(std::vector<const IService*> dependencies) {
+    m_dependencies = std::move(dependencies);
+  }
+  // start() and join() wait for meet_count services meeting at the
+  // rendezvous, join_rendezvous may be nullptr
+  void meet(std::atomic_int* start_rendezvous, std::atomic_int* join_rendezvous,
+            int meet_count) {
+    m_start_rendezvous = start_rendezvous;
+    m_join_rendezvous = join_rendezvous;
+    m_meet_count = meet_count;
+  }
+  bool parallel() const { return m_parallel; }
+
+  int started = 0;
+  int cancelled = 0;
+  int joined = 0;
+  int destroyed = 0;
+
+ private:
+  std::string m_name;
+  Log& m_log;
+  std::vector<const IService*> m_dependencies;
+  // Waits for the others to reach the rendezvous as well, at most a second.
+  // Returns true if they did.
+  bool wait_for_others(std::atomic_int& rendezvous) {
+    rendezvous.fetch_add(1);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (rendezvous.load() < m_meet_count &&
+           std::chrono::steady_clock::now() < deadline)
+      std::this_thread::yield();
+    return rendezvous.load() >= m_meet_count;
+  }
+
+  std::atomic_int* m_start_rendezvous = nullptr;
+  std::atomic_int* m_join_rendezvous = nullptr;
+  int m_meet_count = 0;
+  bool m_parallel = false;
+};
+
+// a depends on b: b starts first, a is joined and destroyed first
+void check_before(const TestService& a, const TestService& b) {
+  CHECK(b.started < a.started);
+  CHECK(a.joined < b.cancelled);
+  CHECK(a.destroyed < b.destroyed);
+}
+
+void test_dag_order() {
+  Log log;
+  TestService base("base", log);
+  TestService left("left", log, {&base});
+  TestService right("right", log, {&base});
+  TestService top("top", log, {&left, &right, &base});
+  TestService alone("alone", log, {nullptr});
+  std::atomic_int rendezvous = {0};
+  left.meet(&rendezvous, nullptr, 2);
+  right.meet(&rendezvous, nullptr, 2);
+
+  ServiceManager manager(4);
+  // Created in an order that is not a valid start order
+  for (TestService* service : {&top, &left, &alone, &right, &base})
+    manager.add(service);
+  Parts parts;
+  CHECK(manager.start(&parts));
+  manager.stop();
+
+  check_before(left, base);
+  check_before(right, base);
+  check_before(top, left);
+  check_before(top, right);
+  for (TestService* service : {&top, &left, &alone, &right, &base}) {
+    CHECK(service->started != 0);
+    CHECK(service->cancelled < service->joined);
+    CHECK(service->joined < service->destroyed);
+  }
+  CHECK(left.parallel() && right.parallel());
+
+  const auto& timings = manager.timings();
+  CHECK(timings.size() == 5 && timings[0].name == "top" &&
+        timings[4].name == "base");
+}
+
+// Four independent services meet in start() and in join(), so all four
+// threads of the manager run one of each
+void test_thread_reuse() {
+  Log log;
+  std::atomic_int start_rendezvous = {0};
+  std::atomic_int join_rendezvous = {0};
+  std::vector<std::unique_ptr<TestService>> services;
+  ServiceManager manager(4);
+  for (const char* name : {"a", "b", "c", "d"}) {
+    services.push_back(std::make_unique<TestService>(name, log));
+    services.back()->meet(&start_rendezvous, &join_rendezvous, 4);
+    manager.add(services.back().get());
+  }
+  Parts parts;
+  CHECK(manager.start(&parts));
+  manager.stop();
+  for (const auto& service : services) CHECK(service->parallel());
+  CHECK(log.start_threads.size() == 4);
+  CHECK(log.stop_threads.size() == 4);
+  for (int serial : log.stop_threads) CHECK(log.start_threads.count(serial));
+}
+
+void test_cycle() {
+  Log log;
+  TestService first("first", log);
+  TestService second("second", log, {&first});
+  TestService third("third", log, {&second});
+  first.set_dependencies({&third});
+  TestService outside("outside", log);
+
+  ServiceManager manager(2);
+  for (TestService* service : {&first, &second, &third, &outside})
+    manager.add(service);
+  Parts parts;
+  CHECK(!manager.start(&parts));
+  for (TestService* service : {&first, &second, &third, &outside})
+    CHECK(service->started == 0);
+  // Never started, only destroyed, in reverse creation order
+  manager.stop();
+  CHECK(outside.destroyed < third.destroyed);
+  CHECK(third.destroyed < second.destroyed);
+  CHECK(second.destroyed < first.destroyed);
+  CHECK(first.cancelled == 0 && first.joined == 0);
+}
+
+void test_add_after_stop() {
+  Log log;
+  TestService one("one", log);
+  TestService two("two", log, {&one});
+  ServiceManager manager(2);
+  manager.add(&one);
+  manager.add(&two);
+  Parts parts;
+  CHECK(manager.start(&parts));
+  manager.stop();
+  CHECK(manager.timings().size() == 2);
+
+  TestService three("three", log);
+  TestService four("four", log, {&three});
+  manager.add(&three);
+  manager.add(&four);
+  CHECK(manager.timings().size() == 2);
+  CHECK(manager.start(&parts));
+  manager.stop();
+  const auto& timings = manager.timings();
+  CHECK(timings.size() == 2 && timings[0].name == "three" &&
+        timings[1].name == "four");
+  check_before(four, three);
+}
+
+}  // namespace
+
+int main() {
+  test_dag_order();
+  test_thread_reuse();
+  test_cycle();
+  test_add_after_stop();
+  return test_result();
+}
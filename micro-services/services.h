@@ -17,6 +17,10 @@
 //   ** It is done in such way so no service can be started and then try to
 //      talk to another service that may not exist yet.
 //
+//   5) Instead of the table order, services can declare the Parts slots they
+//   use with dependencies() and be started and stopped by the ServiceManager
+//   (see service_manager.h), which runs independent services in parallel.
+//
 // ** Example: (services will be started in the order of declaration)
 // static NewService service_table[] = { new_service_one, new_service_two, 0 };
 // std::vector<IService*> services;
@@ -46,6 +50,9 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
 // Struct that holds pointers to all created services. When threaded class is
 // declared as service with the DECLARE_SERVICE macro it will be provided
 // pointer to the Parts through start() function signature so it can be stored
@@ -66,6 +73,9 @@
 //
 //    virtual bool function_one() override;
 //    virtual bool function_two() const override;
+//    // Optional, ServiceOne calls into service_two
+//    virtual std::vector<const IService*> dependencies(
+//        const Parts*) const override;
 //
 // private:
 //    const Parts* m_parts;
@@ -107,6 +117,8 @@
 //         m_cv_task.notify_one();
 //       }
 //    h) ServiceOne::function_two() { // Similar logic to fc1 }
+//       ServiceOne::dependencies(const Parts* parts) const
+//       { return {parts->service_two}; }
 //    i) processor()
 //       {
 //         std::unique_lock<std::mutex> lock(m_mutex);
@@ -121,6 +133,8 @@
 //    j) CREATE_SERVICE_PART(service_one_name, ServiceOne, service_one)
 
 struct Parts;
+class Executor;
+class MetricsRegistry;
 
 class IService {
  public:
@@ -134,6 +148,12 @@ class IService {
   // and the destroy() function a no-op.
   virtual void destroy() = 0;
   virtual std::string name() = 0;
+  // Services from the Parts slots this service calls into. They are started
+  // before and stopped after this service by the ServiceManager (see
+  // service_manager.h). Slots that are NULL are ignored.
+  virtual std::vector<const IService*> dependencies(const Parts*) const {
+    return {};
+  }
 };
 
 #define DECLARE_SERVICE(service_name)               \
@@ -176,9 +196,15 @@ class IServiceTwo : public IService {
 struct Parts {
   IServiceOne* service_one;
   IServiceTwo* service_two;
+  // Shared thread pool (see executor.h), optional
+  Executor* executor;
+  // Counters and histograms of all services (see metrics.h), optional
+  MetricsRegistry* metrics;
 
   Parts() {
     service_one = nullptr;
     service_two = nullptr;
+    executor = nullptr;
+    metrics = nullptr;
   }
 };
@@ -1,10 +1,55 @@
+// Prints the type of a file, or with bulk options the types of many files
+//
+// Usage:
+//   check-file <path>
+//   check-file [--walk] [--stat] [--json] [--count] [--threads N] <path|->...
+//
+//   --walk       descend into directories, symlinks are not followed
+//   --stat       statx() every entry for its size, otherwise the type comes from getdents64()
+//   --json       one JSON object per line instead of "<type> <size> <path>"
+//   --count      only the number of files of every type
+//   --threads N  number of worker threads, default is the number of cores
+//   -            read the paths from stdin, one per line
+//   --watch SOCKET  keep serving the status of the paths, see below
+//
+// Directories are read with getdents64() into a buffer per worker and the workers take directories
+// from a shared stack of at most 4096 jobs, depth first. The subdirectories found while that stack
+// is full are read right away by the worker that found them, so memory is bounded by the depth of
+// the tree times a batch of paths and a buffer, however wide the tree is. The output of every
+// worker is buffered and written in whole lines. The counts by fs::file_type are printed at the
+// end, to stderr unless --count is given.
+//
+// Watch mode keeps the type, size and mtime of the paths, the entries of the directories among them
+// (of the whole trees with --walk) and updates this cache from inotify events, a queue overflow
+// rescans everything. Clients connect to the Unix socket and send paths, one per line, every path
+// gets a line "<type> <size> <mtime> <path>" (or a JSON object) back from the cache. Paths outside
+// of the watched set are answered with a statx().
+//   check-file --watch /run/check-file.sock --walk /var/spool/app
+//   echo /var/spool/app/ready | socat - UNIX-CONNECT:/run/check-file.sock
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <unordered_map>
+#include <unordered_set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
 #include <sys/stat.h>
 
@@ -52,23 +97,908 @@ void check_status(const fs::path& p, fs::file_status s)
     std::cout << '\n';
 }
 
-int main(int argc, char** argv)
+// ---- Bulk mode -----
+
+struct Options
+{
+    bool walk = false;
+    bool stat = false;
+    bool json = false;
+    bool count = false;
+    std::string watch_socket;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+// fs::file_type values used as indexes of the counts
+static const fs::file_type file_types[] = {
+    fs::file_type::not_found, fs::file_type::regular,   fs::file_type::directory,
+    fs::file_type::symlink,   fs::file_type::block,     fs::file_type::character,
+    fs::file_type::fifo,      fs::file_type::socket,    fs::file_type::unknown,
+};
+static const size_t file_types_count = sizeof(file_types) / sizeof(file_types[0]);
+
+static size_t type_index(fs::file_type type)
+{
+    return std::find(file_types, file_types + file_types_count, type) - file_types;
+}
+
+static const char* type_name(fs::file_type type)
+{
+    switch (type)
+    {
+    case fs::file_type::not_found:
+        return "not_found";
+    case fs::file_type::regular:
+        return "regular";
+    case fs::file_type::directory:
+        return "directory";
+    case fs::file_type::symlink:
+        return "symlink";
+    case fs::file_type::block:
+        return "block";
+    case fs::file_type::character:
+        return "character";
+    case fs::file_type::fifo:
+        return "fifo";
+    case fs::file_type::socket:
+        return "socket";
+    default:
+        return "unknown";
+    }
+}
+
+static fs::file_type from_dirent(unsigned char type)
+{
+    switch (type)
+    {
+    case DT_REG:
+        return fs::file_type::regular;
+    case DT_DIR:
+        return fs::file_type::directory;
+    case DT_LNK:
+        return fs::file_type::symlink;
+    case DT_BLK:
+        return fs::file_type::block;
+    case DT_CHR:
+        return fs::file_type::character;
+    case DT_FIFO:
+        return fs::file_type::fifo;
+    case DT_SOCK:
+        return fs::file_type::socket;
+    default:
+        return fs::file_type::none;
+    }
+}
+
+static fs::file_type from_mode(mode_t mode)
+{
+    switch (mode & S_IFMT)
+    {
+    case S_IFREG:
+        return fs::file_type::regular;
+    case S_IFDIR:
+        return fs::file_type::directory;
+    case S_IFLNK:
+        return fs::file_type::symlink;
+    case S_IFBLK:
+        return fs::file_type::block;
+    case S_IFCHR:
+        return fs::file_type::character;
+    case S_IFIFO:
+        return fs::file_type::fifo;
+    case S_IFSOCK:
+        return fs::file_type::socket;
+    default:
+        return fs::file_type::unknown;
+    }
+}
+
+// Type and size of the name relative to the directory, the size is -1 if not known. The mtime in
+// nanoseconds is only read if asked for.
+static fs::file_type stat_entry(int dir_fd, const char* name, int flags, long long& size,
+                                long long* mtime = nullptr)
+{
+    struct statx st;
+    unsigned mask = STATX_TYPE | STATX_SIZE | (mtime ? STATX_MTIME : 0);
+    if (::statx(dir_fd, name, flags | AT_NO_AUTOMOUNT, mask, &st) != 0)
+    {
+        size = -1;
+        if (mtime)
+            *mtime = -1;
+        return errno == ENOENT || errno == ENOTDIR ? fs::file_type::not_found
+                                                   : fs::file_type::unknown;
+    }
+    size = (st.stx_mask & STATX_SIZE) ? static_cast<long long>(st.stx_size) : -1;
+    if (mtime)
+        *mtime = (st.stx_mask & STATX_MTIME)
+                     ? st.stx_mtime.tv_sec * 1000000000LL + st.stx_mtime.tv_nsec
+                     : -1;
+    return from_mode(st.stx_mode);
+}
+
+// Quoted JSON string, control characters escaped
+static void append_json_string(std::string& out, const std::string& text)
+{
+    out += '"';
+    for (unsigned char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += static_cast<char>(c);
+        }
+        else if (c < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else
+            out += static_cast<char>(c);
+    }
+    out += '"';
+}
+
+// Linux dirent64, getdents64() has no glibc wrapper before 2.30
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+class Scanner
+{
+  public:
+    explicit Scanner(const Options& options) : m_options(options)
+    {
+    }
+
+    // Type of a path given by the user, symlinks followed like fs::status()
+    void add_path(const std::string& path)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // Keep the input from running ahead of the workers
+        m_cv_space.wait(lock, [this] { return m_jobs.size() < max_queued; });
+        m_jobs.push_back({path, false});
+        m_pending++;
+        lock.unlock();
+        m_cv_jobs.notify_one();
+    }
+
+    // Start the workers, add_path() may be called meanwhile
+    void start()
+    {
+        for (unsigned n = 0; n < m_options.threads; n++)
+            m_workers.emplace_back(&Scanner::worker, this);
+    }
+
+    // Wait until all paths and directories are done
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_input_done = true;
+        }
+        m_cv_jobs.notify_all();
+        for (auto& worker : m_workers)
+            worker.join();
+    }
+
+    void print_counts(std::FILE* out) const
+    {
+        unsigned long long total = 0;
+        for (size_t n = 0; n < file_types_count; n++)
+        {
+            if (!m_counts[n])
+                continue;
+            total += m_counts[n];
+            if (m_options.json)
+                std::fprintf(out, "{\"type\":\"%s\",\"count\":%llu}\n", type_name(file_types[n]),
+                             m_counts[n].load());
+            else
+                std::fprintf(out, "%-10s %llu\n", type_name(file_types[n]), m_counts[n].load());
+        }
+        if (m_options.json)
+            std::fprintf(out, "{\"type\":\"total\",\"count\":%llu}\n", total);
+        else
+            std::fprintf(out, "%-10s %llu\n", "total", total);
+    }
+
+  private:
+    static const size_t max_queued = 4096;
+    // Subdirectories kept by a worker per directory level before handing them off
+    static const size_t found_batch = 64;
+    static const size_t output_buffer = 64 * 1024;
+    static const size_t dirents_buffer = 64 * 1024;
+
+    struct Job
+    {
+        std::string path;
+        bool directory; // read the entries, otherwise stat the path
+    };
+
+    // Per worker output and counts
+    struct Context
+    {
+        std::string output;
+        unsigned long long counts[file_types_count] = {};
+        // getdents64() buffer per level of directories read inline, see hand_off()
+        std::vector<std::unique_ptr<char[]>> dirents;
+    };
+
+    const Options& m_options;
+    std::mutex m_mutex;
+    std::condition_variable m_cv_jobs;
+    std::condition_variable m_cv_space;
+    // Stack, the last directory found is read first, at most max_queued jobs
+    std::vector<Job> m_jobs;
+    // Jobs queued or running, directories may still add jobs
+    size_t m_pending = 0;
+    bool m_input_done = false;
+    std::vector<std::thread> m_workers;
+    std::mutex m_output_mutex;
+    std::atomic<unsigned long long> m_counts[file_types_count] = {};
+
+    void worker()
+    {
+        Context context;
+        context.output.reserve(output_buffer + PATH_MAX + 64);
+        while (1)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv_jobs.wait(lock, [this] {
+                    return !m_jobs.empty() || (m_input_done && m_pending == 0);
+                });
+                if (m_jobs.empty())
+                    break;
+                job = std::move(m_jobs.back());
+                m_jobs.pop_back();
+            }
+            m_cv_space.notify_one();
+
+            if (job.directory)
+                read_directory(job.path, context, 0);
+            else
+                check_path(job.path, context);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            bool done = --m_pending == 0 && m_input_done;
+            lock.unlock();
+            if (done)
+                m_cv_jobs.notify_all();
+        }
+        flush(context);
+        for (size_t n = 0; n < file_types_count; n++)
+            m_counts[n] += context.counts[n];
+    }
+
+    void check_path(const std::string& path, Context& context)
+    {
+        long long size;
+        fs::file_type type = stat_entry(AT_FDCWD, path.c_str(), 0, size);
+        emit(path, type, size, context);
+        if (type == fs::file_type::directory && m_options.walk)
+        {
+            std::vector<Job> found{{path, true}};
+            hand_off(found, context, 0);
+        }
+    }
+
+    // Moves the directories found onto the shared stack as far as it has room, the worker reads
+    // the others itself one level deeper. Clears found.
+    void hand_off(std::vector<Job>& found, Context& context, size_t depth)
+    {
+        size_t queued = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t room = max_queued - std::min(max_queued, m_jobs.size());
+            queued = std::min(room, found.size());
+            for (size_t n = 0; n < queued; n++)
+                m_jobs.push_back(std::move(found[n]));
+            m_pending += queued;
+        }
+        if (queued > 1)
+            m_cv_jobs.notify_all();
+        else if (queued)
+            m_cv_jobs.notify_one();
+        for (size_t n = queued; n < found.size(); n++)
+            read_directory(found[n].path, context, depth + 1);
+        found.clear();
+    }
+
+    void read_directory(const std::string& path, Context& context, size_t depth)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            std::fprintf(stderr, "check-file: cannot open %s: %s\n", path.c_str(),
+                         std::strerror(errno));
+            return;
+        }
+        if (context.dirents.size() <= depth)
+            context.dirents.emplace_back(new char[dirents_buffer]);
+        char* dirents = context.dirents[depth].get();
+        std::string child = path;
+        if (child.back() != '/')
+            child += '/';
+        size_t base = child.size();
+        std::vector<Job> found;
+
+        while (1)
+        {
+            long length = ::syscall(SYS_getdents64, fd, dirents, dirents_buffer);
+            if (length <= 0)
+            {
+                if (length < 0)
+                    std::fprintf(stderr, "check-file: cannot read %s: %s\n", path.c_str(),
+                                 std::strerror(errno));
+                break;
+            }
+            for (long offset = 0; offset < length;)
+            {
+                auto* entry = reinterpret_cast<linux_dirent64*>(dirents + offset);
+                offset += entry->d_reclen;
+                const char* name = entry->d_name;
+                if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+                    continue;
+
+                long long size = -1;
+                fs::file_type type = from_dirent(entry->d_type);
+                // Some filesystems leave the type to stat
+                if (type == fs::file_type::none || m_options.stat)
+                    type = stat_entry(fd, name, AT_SYMLINK_NOFOLLOW, size);
+
+                child.resize(base);
+                child += name;
+                emit(child, type, size, context);
+                if (type == fs::file_type::directory && m_options.walk)
+                {
+                    found.push_back({child, true});
+                    if (found.size() >= found_batch)
+                        hand_off(found, context, depth);
+                }
+            }
+        }
+        ::close(fd);
+        hand_off(found, context, depth);
+    }
+
+    void emit(const std::string& path, fs::file_type type, long long size, Context& context)
+    {
+        context.counts[type_index(type)]++;
+        if (m_options.count)
+            return;
+
+        std::string& out = context.output;
+        if (m_options.json)
+        {
+            out += "{\"path\":";
+            append_json_string(out, path);
+            out += ",\"type\":\"";
+            out += type_name(type);
+            out += '"';
+            if (size >= 0)
+            {
+                out += ",\"size\":";
+                out += std::to_string(size);
+            }
+            out += "}\n";
+        }
+        else
+        {
+            out += type_name(type);
+            out += ' ';
+            out += size >= 0 ? std::to_string(size) : "-";
+            out += ' ';
+            out += path;
+            out += '\n';
+        }
+        if (out.size() >= output_buffer)
+            flush(context);
+    }
+
+    void flush(Context& context)
+    {
+        if (context.output.empty())
+            return;
+        std::lock_guard<std::mutex> lock(m_output_mutex);
+        const char* data = context.output.data();
+        size_t left = context.output.size();
+        while (left)
+        {
+            ssize_t written = ::write(STDOUT_FILENO, data, left);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                break;
+            data += written;
+            left -= written;
+        }
+        context.output.clear();
+    }
+};
+
+// ---- Watch mode -----
+
+static volatile std::sig_atomic_t watch_stop = 0;
+
+static void watch_signal(int)
+{
+    watch_stop = 1;
+}
+
+class Watcher
+{
+  public:
+    explicit Watcher(const Options& options) : m_options(options)
+    {
+    }
+
+    ~Watcher()
+    {
+        for (auto& client : m_clients)
+            ::close(client.fd);
+        if (m_listen_fd >= 0)
+        {
+            ::close(m_listen_fd);
+            ::unlink(m_options.watch_socket.c_str());
+        }
+        if (m_inotify_fd >= 0)
+            ::close(m_inotify_fd);
+    }
+
+    int run(const std::vector<std::string>& paths)
+    {
+        m_inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_inotify_fd < 0 || !listen_socket())
+        {
+            std::fprintf(stderr, "check-file: cannot watch on %s: %s\n",
+                         m_options.watch_socket.c_str(), std::strerror(errno));
+            return -1;
+        }
+        for (const auto& path : paths)
+            if (path != "-")
+            {
+                m_explicit.insert(normalize(path));
+                m_explicit_parents.insert(parent_of(normalize(path)));
+            }
+        rescan();
+
+        struct sigaction action = {};
+        action.sa_handler = watch_signal;
+        ::sigaction(SIGINT, &action, nullptr);
+        ::sigaction(SIGTERM, &action, nullptr);
+
+        std::vector<pollfd> fds;
+        while (!watch_stop)
+        {
+            fds.assign({{m_inotify_fd, POLLIN, 0}, {m_listen_fd, POLLIN, 0}});
+            for (const auto& client : m_clients)
+                fds.push_back({client.fd, POLLIN, 0});
+            if (::poll(fds.data(), fds.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            if (fds[0].revents)
+                read_events();
+            if (fds[1].revents)
+                accept_client();
+            // Backwards, serve_client() may remove the client
+            for (size_t n = fds.size(); n-- > 2;)
+                if (fds[n].revents)
+                    serve_client(n - 2);
+        }
+        return EXIT_SUCCESS;
+    }
+
+  private:
+    static const size_t max_client_input = 64 * 1024;
+    static const uint32_t dir_events = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                       IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF |
+                                       IN_MOVE_SELF | IN_EXCL_UNLINK | IN_ONLYDIR;
+
+    struct Status
+    {
+        fs::file_type type;
+        long long size;
+        long long mtime; // nanoseconds
+    };
+
+    struct Client
+    {
+        int fd;
+        std::string input;
+    };
+
+    const Options& m_options;
+    int m_inotify_fd = -1;
+    int m_listen_fd = -1;
+    std::vector<Client> m_clients;
+
+    std::unordered_map<std::string, Status> m_cache;
+    // Paths in m_cache by parent directory, so dropping a directory only visits its own entries
+    std::unordered_map<std::string, std::unordered_set<std::string>> m_children;
+    // Paths given on the command line, cached even if they do not exist
+    std::unordered_set<std::string> m_explicit;
+    // Their parents stay watched to see them appear and disappear
+    std::unordered_set<std::string> m_explicit_parents;
+    // Directories with all their entries in the cache
+    std::unordered_set<std::string> m_full_dirs;
+    std::unordered_map<int, std::string> m_watches;
+    std::unordered_map<std::string, int> m_watch_of;
+
+    static std::string normalize(const std::string& path)
+    {
+        std::string normal = fs::path(path).lexically_normal().string();
+        while (normal.size() > 1 && normal.back() == '/')
+            normal.pop_back();
+        return normal;
+    }
+
+    static std::string parent_of(const std::string& path)
+    {
+        std::string parent = fs::path(path).parent_path().string();
+        return parent.empty() ? "." : parent;
+    }
+
+    static std::string join(const std::string& dir, const char* name)
+    {
+        return dir == "/" ? dir + name : dir + "/" + name;
+    }
+
+    bool listen_socket()
+    {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (m_options.watch_socket.size() >= sizeof(addr.sun_path))
+        {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        std::memcpy(addr.sun_path, m_options.watch_socket.c_str(), m_options.watch_socket.size());
+        m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (m_listen_fd < 0)
+            return false;
+        // A stale socket of a previous run
+        ::unlink(m_options.watch_socket.c_str());
+        return ::bind(m_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+               ::listen(m_listen_fd, 64) == 0;
+    }
+
+    void add_watch(const std::string& dir)
+    {
+        if (m_watch_of.count(dir))
+            return;
+        int wd = ::inotify_add_watch(m_inotify_fd, dir.c_str(), dir_events);
+        if (wd < 0)
+        {
+            std::fprintf(stderr, "check-file: cannot watch %s: %s\n", dir.c_str(),
+                         std::strerror(errno));
+            return;
+        }
+        // A hard link or a moved directory may come back with the watch of another path
+        auto old = m_watches.find(wd);
+        if (old != m_watches.end())
+            m_watch_of.erase(old->second);
+        m_watches[wd] = dir;
+        m_watch_of[dir] = wd;
+    }
+
+    void remove_watch(const std::string& dir)
+    {
+        auto found = m_watch_of.find(dir);
+        if (found == m_watch_of.end())
+            return;
+        ::inotify_rm_watch(m_inotify_fd, found->second);
+        m_watches.erase(found->second);
+        m_watch_of.erase(found);
+    }
+
+    // Build the cache from scratch, also after an overflow of the event queue
+    void rescan()
+    {
+        for (auto& watch : m_watches)
+            ::inotify_rm_watch(m_inotify_fd, watch.first);
+        m_watches.clear();
+        m_watch_of.clear();
+        m_cache.clear();
+        m_children.clear();
+        m_full_dirs.clear();
+        for (const auto& path : m_explicit)
+        {
+            // Watching the parent shows the path appear and disappear
+            add_watch(parent_of(path));
+            refresh(path);
+        }
+    }
+
+    // Watch the directory before reading it, so no entry created meanwhile is missed
+    void scan_directory(const std::string& dir)
+    {
+        if (m_full_dirs.count(dir))
+            return;
+        add_watch(dir);
+        m_full_dirs.insert(dir);
+        DIR* stream = ::opendir(dir.c_str());
+        if (!stream)
+            return;
+        while (dirent* entry = ::readdir(stream))
+        {
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+                continue;
+            refresh(join(dir, name));
+        }
+        ::closedir(stream);
+    }
+
+    void cache_put(const std::string& path, const Status& status)
+    {
+        if (m_cache.insert_or_assign(path, status).second)
+            m_children[parent_of(path)].insert(path);
+    }
+
+    void cache_erase(const std::string& path)
+    {
+        if (!m_cache.erase(path))
+            return;
+        auto siblings = m_children.find(parent_of(path));
+        if (siblings == m_children.end())
+            return;
+        siblings->second.erase(path);
+        if (siblings->second.empty())
+            m_children.erase(siblings);
+    }
+
+    // Forget the entries of a directory that is gone or is not a directory any more, the cost is
+    // the number of entries dropped and not the size of the cache
+    void drop_directory(const std::string& dir)
+    {
+        if (!m_full_dirs.erase(dir))
+            return;
+        if (!m_explicit_parents.count(dir))
+            remove_watch(dir);
+
+        auto children = m_children.find(dir);
+        if (children == m_children.end())
+            return;
+        std::unordered_set<std::string> entries = std::move(children->second);
+        m_children.erase(children);
+        std::vector<std::string> nested;
+        for (const auto& path : entries)
+        {
+            // Command line paths stay cached with their own entries
+            if (m_explicit.count(path))
+            {
+                m_children[dir].insert(path);
+                continue;
+            }
+            auto entry = m_cache.find(path);
+            if (entry->second.type == fs::file_type::directory)
+                nested.push_back(path);
+            m_cache.erase(entry);
+        }
+        for (const auto& path : nested)
+            drop_directory(path);
+    }
+
+    // Stat the path again and update the cache
+    void refresh(const std::string& path)
+    {
+        bool is_explicit = m_explicit.count(path) > 0;
+        Status status;
+        // Command line paths follow symlinks like fs::status(), entries do not
+        status.type = stat_entry(AT_FDCWD, path.c_str(), is_explicit ? 0 : AT_SYMLINK_NOFOLLOW,
+                                 status.size, &status.mtime);
+
+        if (status.type == fs::file_type::not_found && !is_explicit)
+            cache_erase(path);
+        else
+            cache_put(path, status);
+
+        bool in_full_dir = m_full_dirs.count(parent_of(path)) > 0;
+        bool watched = is_explicit || (m_options.walk && in_full_dir);
+        if (status.type == fs::file_type::directory && watched)
+            scan_directory(path);
+        else if (status.type != fs::file_type::directory)
+            drop_directory(path);
+    }
+
+    void read_events()
+    {
+        alignas(inotify_event) char buffer[64 * 1024];
+        while (1)
+        {
+            ssize_t length = ::read(m_inotify_fd, buffer, sizeof(buffer));
+            if (length <= 0)
+                return;
+            for (ssize_t offset = 0; offset < length;)
+            {
+                auto* event = reinterpret_cast<inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    rescan();
+                    continue;
+                }
+                auto watch = m_watches.find(event->wd);
+                if (watch == m_watches.end())
+                    continue;
+                std::string dir = watch->second;
+                if (event->mask & IN_IGNORED)
+                {
+                    m_watches.erase(watch);
+                    m_watch_of.erase(dir);
+                    continue;
+                }
+                if (event->len)
+                {
+                    std::string path = join(dir, event->name);
+                    if (m_full_dirs.count(dir) || m_explicit.count(path))
+                        refresh(path);
+                }
+                else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+                    refresh(dir);
+            }
+        }
+    }
+
+    void accept_client()
+    {
+        while (1)
+        {
+            int fd = ::accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd < 0)
+                return;
+            m_clients.push_back({fd, {}});
+        }
+    }
+
+    void serve_client(size_t index)
+    {
+        Client& client = m_clients[index];
+        char buffer[4096];
+        ssize_t length = ::recv(client.fd, buffer, sizeof(buffer), 0);
+        if (length < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        bool keep = length > 0;
+        if (keep)
+            client.input.append(buffer, length);
+
+        std::string reply;
+        size_t start = 0;
+        size_t end;
+        while ((end = client.input.find('\n', start)) != std::string::npos)
+        {
+            if (end > start)
+                answer(client.input.substr(start, end - start), reply);
+            start = end + 1;
+        }
+        client.input.erase(0, start);
+
+        if (!reply.empty() &&
+            ::send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT) !=
+                static_cast<ssize_t>(reply.size()))
+            keep = false;
+        // A client that does not read its replies or never ends a line is dropped
+        if (!keep || client.input.size() > max_client_input)
+        {
+            ::close(client.fd);
+            m_clients.erase(m_clients.begin() + index);
+        }
+    }
+
+    void answer(const std::string& query, std::string& reply)
+    {
+        std::string path = normalize(query);
+        Status status;
+        auto cached = m_cache.find(path);
+        if (cached != m_cache.end())
+            status = cached->second;
+        else if (m_full_dirs.count(parent_of(path)))
+            status = {fs::file_type::not_found, -1, -1};
+        else
+            status.type = stat_entry(AT_FDCWD, path.c_str(), 0, status.size, &status.mtime);
+
+        char line[128];
+        if (m_options.json)
+        {
+            std::snprintf(line, sizeof(line), "{\"type\":\"%s\",\"size\":%lld,\"mtime\":%lld,",
+                          type_name(status.type), status.size, status.mtime);
+            reply += line;
+            reply += "\"path\":";
+            append_json_string(reply, path);
+            reply += "}\n";
+        }
+        else
+        {
+            std::snprintf(line, sizeof(line), "%s %lld %lld ", type_name(status.type), status.size,
+                          status.mtime);
+            reply += line;
+            reply += path;
+            reply += '\n';
+        }
+    }
+};
+
+static int bulk_main(int argc, char** argv)
 {
-    std::string file_name;
-    if (argc > 1 && argc < 3)
-        file_name = argv[1];
-    else if (argc < 2)
+    Options options;
+    std::vector<std::string> paths;
+    for (int n = 1; n < argc; n++)
+    {
+        std::string arg = argv[n];
+        if (arg == "--walk")
+            options.walk = true;
+        else if (arg == "--stat")
+            options.stat = true;
+        else if (arg == "--json")
+            options.json = true;
+        else if (arg == "--count")
+            options.count = true;
+        else if (arg == "--threads" && n + 1 < argc)
+            options.threads = std::max(1, std::atoi(argv[++n]));
+        else if (arg == "--watch" && n + 1 < argc)
+            options.watch_socket = argv[++n];
+        else if (arg.size() > 1 && arg[0] == '-' && arg != "--")
+        {
+            std::cout << "Error. Unknown option " << arg << std::endl;
+            return -1;
+        }
+        else if (arg != "--")
+            paths.push_back(arg);
+    }
+    if (paths.empty())
     {
         std::cout << "Error. Too little arguments" << std::endl;
         return -1;
     }
 
-    if (argc > 3)
+    if (!options.watch_socket.empty())
     {
-        std::cout << "Error. Too many arguments" << std::endl;
+        Watcher watcher(options);
+        return watcher.run(paths);
+    }
+
+    Scanner scanner(options);
+    scanner.start();
+    for (const auto& path : paths)
+    {
+        if (path != "-")
+        {
+            scanner.add_path(path);
+            continue;
+        }
+        std::string line;
+        while (std::getline(std::cin, line))
+            if (!line.empty())
+                scanner.add_path(line);
+    }
+    scanner.finish();
+    scanner.print_counts(options.count ? stdout : stderr);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Error. Too little arguments" << std::endl;
         return -1;
     }
+    // Options or several paths use the bulk mode
+    if (argc > 2 || argv[1][0] == '-')
+        return bulk_main(argc, argv);
 
+    std::string file_name = argv[1];
     check_status(file_name, fs::status(file_name));
 
     return EXIT_SUCCESS;
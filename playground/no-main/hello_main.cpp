@@ -0,0 +1,21 @@
+// Regular main() counterpart of mini.cpp for the startup benchmark
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char** argv)
+{
+    std::printf("Hello World\n");
+    std::printf("argc %d\n", argc);
+    for (int n = 0; n < argc; n++)
+        std::printf("%s\n", argv[n]);
+    const char* home = std::getenv("HOME");
+    std::printf("HOME %s\n", home ? home : "(unset)");
+
+    long* squares = new long[1000];
+    long sum = 0;
+    for (long n = 0; n < 1000; n++)
+        sum += squares[n] = n * n;
+    std::printf("sum %ld\n", sum);
+    delete[] squares;
+    return EXIT_SUCCESS;
+}
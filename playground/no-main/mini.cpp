@@ -0,0 +1,29 @@
+// Example tool on the minimal runtime, prints the same as hello_main.cpp
+#include "mini_runtime.h"
+
+int mini_main(int argc, char** argv, char** envp)
+{
+    mini::print("Hello World\n");
+    mini::print("argc ");
+    mini::print(static_cast<long>(argc));
+    mini::print("\n");
+    for (int n = 0; n < argc; n++)
+    {
+        mini::print(argv[n]);
+        mini::print("\n");
+    }
+    const char* home = mini::getenv(envp, "HOME");
+    mini::print("HOME ");
+    mini::print(home ? home : "(unset)");
+    mini::print("\n");
+
+    // Arena backed allocation
+    long* squares = new long[1000];
+    long sum = 0;
+    for (long n = 0; n < 1000; n++)
+        sum += squares[n] = n * n;
+    mini::print("sum ");
+    mini::print(sum);
+    mini::print("\n");
+    return 0;
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+// Minimal runtime for short-lived tools built without the C runtime and libc
+//
+// The program is linked static with -nostdlib (see the Makefile), mini_start.cpp provides the
+// _start() entry that reads argc, argv and envp from the initial stack, runs the global
+// constructors and calls mini_main(). Nothing is dynamically linked or initialized besides that,
+// so the process is ready as soon as exec() maps it. The destructors of static objects (at most
+// 64, registered through __cxa_atexit()) run when mini_main() returns, not on mini::exit().
+//
+// The runtime offers:
+//   - raw system calls for write, exit and mmap (x86-64 and AArch64)
+//   - a bump arena allocator on top of mmap, operator new uses it and delete is a no-op
+//   - getenv() over envp and small print helpers
+//
+// Usage example:
+//
+// #include "mini_runtime.h"
+//
+// int mini_main(int argc, char** argv, char** envp)
+// {
+//     mini::print("Hello World\n");
+//     return 0;
+// }
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Entry point of the program, the return value is the exit status
+int mini_main(int argc, char** argv, char** envp);
+
+namespace mini
+{
+#if defined(__x86_64__)
+enum Syscall : long
+{
+    SYS_WRITE = 1,
+    SYS_MMAP = 9,
+    SYS_MUNMAP = 11,
+    SYS_EXIT_GROUP = 231,
+};
+
+inline long syscall6(long number, long a1, long a2 = 0, long a3 = 0, long a4 = 0, long a5 = 0,
+                     long a6 = 0)
+{
+    long result;
+    register long r10 asm("r10") = a4;
+    register long r8 asm("r8") = a5;
+    register long r9 asm("r9") = a6;
+    asm volatile("syscall"
+                 : "=a"(result)
+                 : "a"(number), "D"(a1), "S"(a2), "d"(a3), "r"(r10), "r"(r8), "r"(r9)
+                 : "rcx", "r11", "memory");
+    return result;
+}
+#elif defined(__aarch64__)
+enum Syscall : long
+{
+    SYS_WRITE = 64,
+    SYS_MUNMAP = 215,
+    SYS_MMAP = 222,
+    SYS_EXIT_GROUP = 94,
+};
+
+inline long syscall6(long number, long a1, long a2 = 0, long a3 = 0, long a4 = 0, long a5 = 0,
+                     long a6 = 0)
+{
+    register long x8 asm("x8") = number;
+    register long x0 asm("x0") = a1;
+    register long x1 asm("x1") = a2;
+    register long x2 asm("x2") = a3;
+    register long x3 asm("x3") = a4;
+    register long x4 asm("x4") = a5;
+    register long x5 asm("x5") = a6;
+    asm volatile("svc 0"
+                 : "+r"(x0)
+                 : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5)
+                 : "memory");
+    return x0;
+}
+#else
+#error "mini_runtime.h supports x86-64 and AArch64 only"
+#endif
+
+// Values of <sys/mman.h>, the same on both architectures
+static const long PROT_READ = 1;
+static const long PROT_WRITE = 2;
+static const long MAP_PRIVATE = 2;
+static const long MAP_ANONYMOUS = 0x20;
+
+// Returns the number of bytes written or -errno
+inline long write(int fd, const void* data, size_t size)
+{
+    return syscall6(SYS_WRITE, fd, reinterpret_cast<long>(data), static_cast<long>(size));
+}
+
+[[noreturn]] inline void exit(int status)
+{
+    while (1)
+        syscall6(SYS_EXIT_GROUP, status);
+}
+
+// Anonymous private mapping, nullptr on failure
+inline void* mmap(size_t size)
+{
+    long result = syscall6(SYS_MMAP, 0, static_cast<long>(size), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    // Errors are returned as -4095..-1
+    return static_cast<unsigned long>(result) > -4096UL ? nullptr : reinterpret_cast<void*>(result);
+}
+
+inline void munmap(void* address, size_t size)
+{
+    syscall6(SYS_MUNMAP, reinterpret_cast<long>(address), static_cast<long>(size));
+}
+
+inline size_t strlen(const char* text)
+{
+    size_t length = 0;
+    while (text[length])
+        length++;
+    return length;
+}
+
+// Value of the variable in envp, nullptr if not set
+inline const char* getenv(char** envp, const char* name)
+{
+    size_t length = strlen(name);
+    for (; *envp; envp++)
+    {
+        const char* entry = *envp;
+        size_t n = 0;
+        while (n < length && entry[n] == name[n])
+            n++;
+        if (n == length && entry[n] == '=')
+            return entry + n + 1;
+    }
+    return nullptr;
+}
+
+// Write the whole text, false on error
+inline bool print(const char* text, int fd = 1)
+{
+    size_t left = strlen(text);
+    while (left)
+    {
+        long written = write(fd, text, left);
+        // EINTR
+        if (written == -4)
+            continue;
+        if (written <= 0)
+            return false;
+        text += written;
+        left -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+inline bool print(long value, int fd = 1)
+{
+    char buffer[24];
+    char* end = buffer + sizeof(buffer) - 1;
+    *end = 0;
+    char* start = end;
+    unsigned long magnitude = value < 0 ? 0UL - static_cast<unsigned long>(value) : value;
+    do
+    {
+        *--start = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+        *--start = '-';
+    return print(start, fd);
+}
+
+// Bump allocator, memory is only given back by reset() or the end of the process
+class Arena
+{
+  public:
+    explicit Arena(size_t chunk_size = 64 * 1024) : m_chunk_size(chunk_size)
+    {
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena()
+    {
+        reset();
+    }
+
+    // nullptr if the memory is exhausted, align must be a power of two
+    void* alloc(size_t size, size_t align = alignof(max_align_t))
+    {
+        uintptr_t position = (m_position + align - 1) & ~(align - 1);
+        if (!m_chunk || position + size > m_end)
+        {
+            if (!grow(size + align))
+                return nullptr;
+            position = (m_position + align - 1) & ~(align - 1);
+        }
+        m_position = position + size;
+        return reinterpret_cast<void*>(position);
+    }
+
+    // Unmap all chunks
+    void reset()
+    {
+        while (m_chunk)
+        {
+            Chunk* previous = m_chunk->previous;
+            munmap(m_chunk, m_chunk->size);
+            m_chunk = previous;
+        }
+        m_position = m_end = 0;
+    }
+
+  private:
+    // Header at the start of every mapping
+    struct Chunk
+    {
+        Chunk* previous;
+        size_t size;
+    };
+
+    size_t m_chunk_size;
+    Chunk* m_chunk = nullptr;
+    uintptr_t m_position = 0;
+    uintptr_t m_end = 0;
+
+    bool grow(size_t size)
+    {
+        size_t chunk_size = sizeof(Chunk) + size > m_chunk_size ? sizeof(Chunk) + size : m_chunk_size;
+        // Whole pages
+        chunk_size = (chunk_size + 4095) & ~size_t(4095);
+        Chunk* chunk = static_cast<Chunk*>(mmap(chunk_size));
+        if (!chunk)
+            return false;
+        chunk->previous = m_chunk;
+        chunk->size = chunk_size;
+        m_chunk = chunk;
+        m_position = reinterpret_cast<uintptr_t>(chunk + 1);
+        m_end = reinterpret_cast<uintptr_t>(chunk) + chunk_size;
+        return true;
+    }
+};
+
+// Arena of operator new
+Arena& default_arena();
+} // namespace mini
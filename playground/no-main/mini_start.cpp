@@ -0,0 +1,184 @@
+// Entry point and the few symbols the compiler expects from libc, see mini_runtime.h
+
+#include <new>
+
+#include "mini_runtime.h"
+
+// The initial stack of a process, from the stack pointer up:
+//   argc, argv[0] ... argv[argc - 1], NULL, envp[0] ... NULL, auxv ...
+#if defined(__x86_64__)
+asm(".text\n"
+    ".global _start\n"
+    ".type _start, @function\n"
+    "_start:\n"
+    "    xor %rbp, %rbp\n"   // outermost frame for debuggers
+    "    mov %rsp, %rdi\n"   // initial stack as the argument
+    "    and $-16, %rsp\n"   // ABI alignment for the call
+    "    call mini_start\n"
+    "    hlt\n");
+#elif defined(__aarch64__)
+asm(".text\n"
+    ".global _start\n"
+    ".type _start, %function\n"
+    "_start:\n"
+    "    mov x29, #0\n"
+    "    mov x30, #0\n"
+    "    mov x0, sp\n"
+    "    bl mini_start\n"
+    "    brk #0\n");
+#endif
+
+// Provided by the linker for static programs
+extern "C" void (*__init_array_start[])(int, char**, char**) __attribute__((visibility("hidden")));
+extern "C" void (*__init_array_end[])(int, char**, char**) __attribute__((visibility("hidden")));
+
+namespace
+{
+// Destructors of the global and function-local static objects, registered by the compiler
+// through __cxa_atexit() once the object is constructed
+struct Atexit
+{
+    void (*destructor)(void*);
+    void* object;
+};
+
+const int max_atexit = 64;
+Atexit atexit_functions[max_atexit];
+int atexit_count = 0;
+
+// In reverse order of construction, when mini_main() returns. mini::exit() skips them like
+// _exit() does.
+void run_atexit()
+{
+    while (atexit_count > 0)
+    {
+        const Atexit& entry = atexit_functions[--atexit_count];
+        entry.destructor(entry.object);
+    }
+}
+} // namespace
+
+extern "C"
+{
+    // Identifies this module to __cxa_atexit(), a static program has only one
+    __attribute__((visibility("hidden"))) void* __dso_handle = &__dso_handle;
+
+    // Returns non-zero when the table is full, the object is then never destroyed
+    int __cxa_atexit(void (*destructor)(void*), void* object, void*)
+    {
+        if (atexit_count == max_atexit)
+            return -1;
+        atexit_functions[atexit_count++] = {destructor, object};
+        return 0;
+    }
+}
+
+extern "C" [[noreturn]] void mini_start(long* stack)
+{
+    int argc = static_cast<int>(stack[0]);
+    char** argv = reinterpret_cast<char**>(stack + 1);
+    char** envp = argv + argc + 1;
+
+    // Global constructors
+    for (auto constructor = __init_array_start; constructor != __init_array_end; constructor++)
+        (*constructor)(argc, argv, envp);
+
+    int status = mini_main(argc, argv, envp);
+    run_atexit();
+    mini::exit(status);
+}
+
+mini::Arena& mini::default_arena()
+{
+    // NOTE Constructed on first use without a guard, the runtime is single threaded. No destructor
+    // runs at the end of the process.
+    alignas(Arena) static char storage[sizeof(Arena)];
+    static Arena* arena = nullptr;
+    if (!arena)
+        arena = new (storage) Arena();
+    return *arena;
+}
+
+void* operator new(size_t size)
+{
+    void* memory = mini::default_arena().alloc(size);
+    if (!memory)
+    {
+        mini::print("out of memory\n", 2);
+        mini::exit(127);
+    }
+    return memory;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+// The arena frees everything at once
+void operator delete(void*) noexcept
+{
+}
+
+void operator delete[](void*) noexcept
+{
+}
+
+void operator delete(void*, size_t) noexcept
+{
+}
+
+void operator delete[](void*, size_t) noexcept
+{
+}
+
+// The compiler may emit calls to these for copies and initialization. NOTE Built with
+// -fno-tree-loop-distribute-patterns, or the loops would be turned into calls to themselves.
+extern "C"
+{
+    void* memcpy(void* destination, const void* source, size_t size)
+    {
+        auto* to = static_cast<unsigned char*>(destination);
+        auto* from = static_cast<const unsigned char*>(source);
+        while (size--)
+            *to++ = *from++;
+        return destination;
+    }
+
+    void* memmove(void* destination, const void* source, size_t size)
+    {
+        auto* to = static_cast<unsigned char*>(destination);
+        auto* from = static_cast<const unsigned char*>(source);
+        if (to < from)
+            while (size--)
+                *to++ = *from++;
+        else
+            while (size--)
+                to[size] = from[size];
+        return destination;
+    }
+
+    void* memset(void* destination, int value, size_t size)
+    {
+        auto* to = static_cast<unsigned char*>(destination);
+        while (size--)
+            *to++ = static_cast<unsigned char>(value);
+        return destination;
+    }
+
+    int memcmp(const void* left, const void* right, size_t size)
+    {
+        auto* a = static_cast<const unsigned char*>(left);
+        auto* b = static_cast<const unsigned char*>(right);
+        for (; size; size--, a++, b++)
+            if (*a != *b)
+                return *a - *b;
+        return 0;
+    }
+
+    // Called for a pure virtual function, cannot be recovered from
+    void __cxa_pure_virtual()
+    {
+        mini::exit(127);
+    }
+}
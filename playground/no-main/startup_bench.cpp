@@ -0,0 +1,81 @@
+// Startup latency benchmark: fork + exec of a program until it exits
+//
+// Runs every program the given number of times with its output sent to /dev/null and prints the
+// mean, median and 99th percentile of the time from fork() to the exit seen by waitpid().
+//
+// Build & run:
+//   make startup-bench
+//   ./startup_bench [runs] ./mini ./hello-main ./hello-main-static
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// Microseconds of every run, empty if the program cannot be run
+static std::vector<double> measure(const char* program, int runs)
+{
+    std::vector<double> times;
+    int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    for (int n = 0; n < runs; n++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid = ::fork();
+        if (pid == 0)
+        {
+            ::dup2(null_fd, STDOUT_FILENO);
+            char* argv[] = {const_cast<char*>(program), nullptr};
+            ::execve(program, argv, environ);
+            ::_exit(127);
+        }
+        int status = 0;
+        if (pid < 0 || ::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0)
+        {
+            std::fprintf(stderr, "startup_bench: %s failed\n", program);
+            times.clear();
+            break;
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        times.push_back(elapsed.count());
+    }
+    ::close(null_fd);
+    return times;
+}
+
+int main(int argc, char** argv)
+{
+    int first = 1;
+    int runs = 1000;
+    if (argc > 1 && std::atoi(argv[1]) > 0)
+    {
+        runs = std::atoi(argv[1]);
+        first = 2;
+    }
+    if (first >= argc)
+    {
+        std::fprintf(stderr, "usage: %s [runs] program...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::printf("%-24s %10s %10s %10s   (us, %d runs)\n", "program", "mean", "median", "p99", runs);
+    for (int n = first; n < argc; n++)
+    {
+        std::vector<double> times = measure(argv[n], runs);
+        if (times.empty())
+            return EXIT_FAILURE;
+        double sum = 0;
+        for (double time : times)
+            sum += time;
+        std::sort(times.begin(), times.end());
+        std::printf("%-24s %10.1f %10.1f %10.1f\n", argv[n], sum / times.size(),
+                    times[times.size() / 2], times[times.size() * 99 / 100]);
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,22 +1,72 @@
 #include "thread_map.h"
 
-ThreadMap::ThreadMap() : m_stop(false)
+#include <algorithm>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+void futex_wait(std::atomic<uint32_t>* word, uint32_t value)
+{
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, value, nullptr,
+              nullptr, 0);
+}
+
+void futex_wake(std::atomic<uint32_t>* word)
+{
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr,
+              nullptr, 0);
+}
+} // namespace
+
+ThreadMap::ThreadMap()
 {
     // Start processor loop
     m_loop_thread = std::thread(&ThreadMap::processor, this);
 };
 
+ThreadMap::ThreadMap(const PoolOptions& options) : ThreadMap()
+{
+    m_options = options;
+    m_options.workers = std::max<size_t>(m_options.workers, 1);
+    m_options.queue_capacity = std::max<size_t>(m_options.queue_capacity, 1);
+    for (size_t n = 0; n < m_options.workers; n++)
+        m_workers.emplace_back(&ThreadMap::worker, this);
+}
+
 ThreadMap::~ThreadMap()
 {
+    // Stop the pool, workers run the queued jobs first
+    {
+        std::lock_guard<std::mutex> lock(m_pool_mutex);
+        m_pool_stop = true;
+    }
+    m_cv_job.notify_all();
+    m_cv_space.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+
     // Stop the processor loop
-    m_stop = true;
-    // NOTE Must notify loop thread to stop blocking on wait and exit
-    m_cv_done.notify_one();
+    m_stop.store(true);
+    // NOTE Must wake up loop thread to stop blocking on wait and exit
+    wake_processor();
     m_loop_thread.join();
 
     // Join any possible missed threads before exiting
-    for (auto& thread : m_threads_map)
-        thread.second.join();
+    for (auto& shard : m_shards)
+        for (auto& thread : shard.threads)
+            thread.second.join();
+
+    // Notified after the processor loop exited
+    Finished* finished = m_finished.exchange(nullptr);
+    while (finished)
+    {
+        Finished* next = finished->next;
+        delete finished;
+        finished = next;
+    }
 };
 
 // Add worker thread to the map, while std::thread objects cannot be copied
@@ -25,53 +75,164 @@ ThreadMap::~ThreadMap()
 // and original one that the caller supplied will become valid
 void ThreadMap::add(std::thread& th, std::thread::id id)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    m_threads_map[id] = std::move(th);
-    // Sanity check on the size of the threads map
-    if (m_threads_map.size() > 20)
+    // Counted before the thread is in the map, processor() may join it and subtract right away
+    m_live.fetch_add(1, std::memory_order_relaxed);
     {
-        // TODO log, raise warning on map size
-        // TODO add control mechanism
+        Shard& map = shard(id);
+        std::lock_guard<std::mutex> lock(map.mutex);
+        map.threads[id] = std::move(th);
     }
+    // The thread may have notified before it was added
+    if (m_unmatched.load())
+        wake_processor();
 }
 
 // Worker threads must call this method to notify exiting
 void ThreadMap::notify_done(std::thread::id id)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    m_finished_threads.push_back(id);
-    m_cv_done.notify_one();
+    Finished* head = m_finished.load(std::memory_order_relaxed);
+    Finished* finished = new Finished{id, head};
+    while (!m_finished.compare_exchange_weak(head, finished, std::memory_order_release,
+                                             std::memory_order_relaxed))
+        finished->next = head;
+    // Only the first push after processor() took the stack has to wake it up. NOTE finished may
+    // already be deleted by processor()
+    if (!head)
+        wake_processor();
 }
 
-// Processor routine joins and removes finished threads from the map
+void ThreadMap::wake_processor()
+{
+    m_wake.fetch_add(1, std::memory_order_release);
+    futex_wake(&m_wake);
+}
+
+// Processor routine joins and removes finished threads from the maps
 void ThreadMap::processor()
 {
+    // Finished ids not found in the maps yet
+    std::vector<std::thread::id> unmatched;
+    std::vector<std::thread> finished_threads;
     while (1)
     {
+        uint32_t wake = m_wake.load(std::memory_order_acquire);
+        bool stop = m_stop.load();
+
+        Finished* finished = m_finished.exchange(nullptr, std::memory_order_acquire);
+        while (finished)
+        {
+            unmatched.push_back(finished->id);
+            Finished* next = finished->next;
+            delete finished;
+            finished = next;
+        }
+
+        // NOTE Published before the maps are searched, add() after the search sees it
+        m_unmatched.store(unmatched.size());
+        for (size_t n = 0; n < unmatched.size();)
+        {
+            Shard& map = shard(unmatched[n]);
+            std::unique_lock<std::mutex> lock(map.mutex);
+            auto found = map.threads.find(unmatched[n]);
+            if (found == map.threads.end())
+            {
+                n++;
+                continue;
+            }
+            finished_threads.push_back(std::move(found->second));
+            map.threads.erase(found);
+            lock.unlock();
+            unmatched[n] = unmatched.back();
+            unmatched.pop_back();
+        }
+        m_unmatched.store(unmatched.size());
+
+        // Join outside of any lock
+        for (auto& thread : finished_threads)
+            thread.join();
+        m_live.fetch_sub(finished_threads.size(), std::memory_order_relaxed);
+        finished_threads.clear();
+
         // Using if in infinite while loop to give ability of logging or
         // performing additional actions on stop
-        if (m_stop)
+        if (stop)
             break;
+        if (!m_finished.load(std::memory_order_acquire))
+            futex_wait(&m_wake, wake);
+    }
+}
+
+// Pool worker routine runs queued jobs until the pool stops and the queue is empty
+void ThreadMap::worker()
+{
+    while (1)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_pool_mutex);
+            m_idle++;
+            m_cv_job.wait(lock, [this] { return m_pool_stop || !m_jobs.empty(); });
+            m_idle--;
+            if (m_jobs.empty())
+                break;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        m_cv_space.notify_one();
+        job();
+    }
+}
 
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_cv_done.wait(lock, [this] {
-            // On termination - stop blocking by setting predicate to true
-            return m_stop || m_finished_threads.size();
-        });
+bool ThreadMap::enqueue(std::function<void()>& job)
+{
+    std::unique_lock<std::mutex> lock(m_pool_mutex);
+    if (m_pool_stop)
+        return false;
 
-        for (auto const& id : m_finished_threads)
+    if (m_jobs.size() >= m_options.queue_capacity)
+    {
+        switch (m_options.backpressure)
         {
-            if (m_threads_map.find(id) != m_threads_map.end())
-            {
-                m_threads_map[id].join();
-                m_threads_map.erase(id);
-            }
-            else
-            {
-                // TODO log notify that given id does not exist in the map
-            }
+        case Backpressure::BLOCK:
+            m_cv_space.wait(lock, [this] {
+                return m_pool_stop || m_jobs.size() < m_options.queue_capacity;
+            });
+            if (m_pool_stop)
+                return false;
+            break;
+        case Backpressure::REJECT:
+            return false;
+        case Backpressure::CALLER_RUNS:
+            lock.unlock();
+            job();
+            return true;
         }
-        // Clear vector of finished threads
-        m_finished_threads.clear();
     }
+
+    m_jobs.push_back(std::move(job));
+    lock.unlock();
+    m_cv_job.notify_one();
+    return true;
+}
+
+void ThreadMap::spawn(std::function<void()> job)
+{
+    std::thread th([this, job = std::move(job)] {
+        job();
+        notify_done();
+    });
+    std::thread::id id = th.get_id();
+    add(th, id);
+}
+
+ThreadMap::Stats ThreadMap::stats() const
+{
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(m_pool_mutex);
+        stats.idle = m_idle;
+        stats.queued = m_jobs.size();
+    }
+    stats.live = m_workers.empty() ? m_live.load(std::memory_order_relaxed) : m_workers.size();
+    return stats;
 }
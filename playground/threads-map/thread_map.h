@@ -2,9 +2,15 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -18,10 +24,52 @@
 // supplied becomes invalid!
 //
 // Exiting threads have to notify about their exitting
+//
+// notify_done() never locks: it pushes the id on a lock-free stack and wakes up processor(), which
+// takes the thread out of its map and joins it outside of any lock. The threads are spread over
+// sharded maps, so add() of different threads rarely contend.
+//
+// Pool mode: constructed with PoolOptions the ThreadMap also starts a fixed pool of workers and
+// submit() queues jobs for them instead of creating a thread per job. When the queue is full the
+// backpressure policy applies:
+//   BLOCK       - submit() waits for a free place in the queue
+//   REJECT      - submit() returns std::nullopt
+//   CALLER_RUNS - the job runs on the thread calling submit()
+// Without a pool submit() runs every job on its own thread of the map. add() and notify_done()
+// work in both modes. The destructor runs the queued jobs before the workers exit.
+//
+// Usage example:
+//
+// ThreadMap threads({4, 1024, ThreadMap::Backpressure::BLOCK});
+// std::optional<std::future<int>> result = threads.submit([] { return 42; });
+// if (result)
+//     int value = result->get();
 class ThreadMap
 {
   public:
+    enum class Backpressure
+    {
+        BLOCK,
+        REJECT,
+        CALLER_RUNS,
+    };
+
+    struct PoolOptions
+    {
+        size_t workers = std::thread::hardware_concurrency();
+        size_t queue_capacity = 1024;
+        Backpressure backpressure = Backpressure::BLOCK;
+    };
+
+    struct Stats
+    {
+        size_t live;   // workers of the pool, or threads in the map without a pool
+        size_t idle;   // workers waiting for a job
+        size_t queued; // jobs waiting for a worker
+    };
+
     ThreadMap();
+    explicit ThreadMap(const PoolOptions& options);
     ~ThreadMap();
 
     // Add worker thread to the map using std::move
@@ -29,25 +77,87 @@ class ThreadMap
     // Worker thread must call this method to notify exiting and be removed from the map
     void notify_done(std::thread::id id = std::this_thread::get_id());
 
+    // Run the job on the pool, std::nullopt if the job is rejected
+    template <typename F>
+    std::optional<std::future<std::invoke_result_t<std::decay_t<F>>>> submit(F&& fn);
+
+    Stats stats() const;
+
   private:
-    mutable std::mutex m_mutex;
+    // Number of maps, add() of different threads rarely takes the same mutex
+    static const size_t m_shards_count = 16;
 
-    // ---- Below here are variables locked by m_ mutex -----
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        // Map stores threads by their unique id as keys
+        std::unordered_map<std::thread::id, std::thread> threads;
+    };
 
-    // Cleanup routine will wait on m_cv_done for worker threads to nofity about exiting
-    std::condition_variable m_cv_done;
-    // Map stores threads by their unique id as keys
-    std::unordered_map<std::thread::id, std::thread> m_threads_map;
-    // Vector of finished threads to be removed from the map
-    std::vector<std::thread::id> m_finished_threads;
-    // Flag controls while loop of cleanup routine
-    bool m_stop;
+    // Node of the stack of finished threads
+    struct Finished
+    {
+        std::thread::id id;
+        Finished* next;
+    };
 
-    // ---- End of variables locked by m_mutex -----
+    Shard m_shards[m_shards_count];
+    // Lock-free stack, pushed by notify_done() and taken as a whole by processor()
+    std::atomic<Finished*> m_finished{nullptr};
+    // Futex word processor() sleeps on, bumped to wake it up
+    std::atomic<uint32_t> m_wake{0};
+    // Finished ids processor() did not find in the maps yet, add() wakes it up for them
+    std::atomic<size_t> m_unmatched{0};
+    std::atomic<size_t> m_live{0};
+    // Flag controls while loop of cleanup routine
+    std::atomic<bool> m_stop{false};
 
     // Thread running processor() loop
     std::thread m_loop_thread;
 
+    // ---- Pool, variables locked by m_pool_mutex -----
+
+    mutable std::mutex m_pool_mutex;
+    // Workers wait on m_cv_job for jobs, blocked submit() on m_cv_space for room in the queue
+    std::condition_variable m_cv_job;
+    std::condition_variable m_cv_space;
+    std::deque<std::function<void()>> m_jobs;
+    size_t m_idle = 0;
+    bool m_pool_stop = false;
+
+    // ---- End of variables locked by m_pool_mutex -----
+
+    PoolOptions m_options;
+    std::vector<std::thread> m_workers;
+
+    Shard& shard(std::thread::id id)
+    {
+        return m_shards[std::hash<std::thread::id>()(id) % m_shards_count];
+    }
+    void wake_processor();
     // Processing loop that joins and removes finished threads from the map
     void processor();
+    // Pool worker loop
+    void worker();
+    // Queue the job applying backpressure, false if rejected
+    bool enqueue(std::function<void()>& job);
+    // Run the job on a new thread of the map
+    void spawn(std::function<void()> job);
 };
+
+template <typename F>
+std::optional<std::future<std::invoke_result_t<std::decay_t<F>>>> ThreadMap::submit(F&& fn)
+{
+    using Result = std::invoke_result_t<std::decay_t<F>>;
+
+    // std::function needs a copyable target, packaged_task is move only
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(fn));
+    std::future<Result> future = task->get_future();
+    std::function<void()> job = [task] { (*task)(); };
+
+    if (m_workers.empty())
+        spawn(std::move(job));
+    else if (!enqueue(job))
+        return std::nullopt;
+    return future;
+}
@@ -0,0 +1,110 @@
+#include "stall_log.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+StallLog::StallLog(size_t size, const std::string& path)
+{
+    size = std::max<size_t>(size, 1024);
+    m_length = sizeof(Header) + size;
+
+    if (!path.empty())
+    {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0)
+        {
+            if (::ftruncate(fd, static_cast<off_t>(m_length)) == 0)
+            {
+                void* address = ::mmap(nullptr, m_length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (address != MAP_FAILED)
+                {
+                    m_header = static_cast<Header*>(address);
+                    m_mapped = true;
+                }
+            }
+            ::close(fd);
+        }
+    }
+    if (!m_mapped)
+        m_header = static_cast<Header*>(std::calloc(1, m_length));
+
+    m_data = reinterpret_cast<char*>(m_header + 1);
+    // A file of a previous run with the same size keeps its reports
+    if (m_header->magic != m_magic || m_header->size != size)
+    {
+        m_header->magic = m_magic;
+        m_header->size = size;
+        m_header->position = 0;
+    }
+}
+
+StallLog::~StallLog()
+{
+    if (m_mapped)
+        ::munmap(m_header, m_length);
+    else
+        std::free(m_header);
+}
+
+void StallLog::write(const char* data, size_t size)
+{
+    size_t capacity = m_header->size;
+    // Only the tail of a report larger than the ring fits
+    if (size > capacity)
+    {
+        data += size - capacity;
+        m_header->position += size - capacity;
+        size = capacity;
+    }
+    size_t offset = m_header->position % capacity;
+    size_t first = std::min(size, capacity - offset);
+    std::memcpy(m_data + offset, data, first);
+    std::memcpy(m_data, data + first, size - first);
+    m_header->position += size;
+}
+
+std::string StallLog::read() const
+{
+    return unwrap(m_header);
+}
+
+std::string StallLog::read_file(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return {};
+    std::string text;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > sizeof(Header))
+    {
+        size_t length = static_cast<size_t>(st.st_size);
+        void* address = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            const Header* header = static_cast<const Header*>(address);
+            if (header->magic == m_magic && sizeof(Header) + header->size <= length)
+                text = unwrap(header);
+            ::munmap(address, length);
+        }
+    }
+    ::close(fd);
+    return text;
+}
+
+std::string StallLog::unwrap(const Header* header)
+{
+    const char* data = reinterpret_cast<const char*>(header + 1);
+    size_t capacity = header->size;
+    if (header->position <= capacity)
+        return std::string(data, header->position);
+
+    size_t offset = header->position % capacity;
+    std::string text(data + offset, capacity - offset);
+    text.append(data, offset);
+    return text;
+}
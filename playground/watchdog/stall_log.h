@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Fixed-size ring of text, the oldest reports are overwritten
+//
+// The buffer is allocated once, write() only copies bytes, so reports can be written while the
+// process is in trouble. With a path the ring is a shared mapping of that file: the reports survive
+// a crash or a kill of the process and can be read with read_file().
+//
+// Not thread-safe, the Watchdog writes and reads it under its mutex.
+class StallLog
+{
+  public:
+    // An empty path or a failed mapping keeps the ring in memory
+    explicit StallLog(size_t size = 64 * 1024, const std::string& path = "");
+    ~StallLog();
+    StallLog(const StallLog&) = delete;
+    StallLog& operator=(const StallLog&) = delete;
+
+    // True if the ring is backed by the file
+    bool mapped() const
+    {
+        return m_mapped;
+    }
+    void write(const char* data, size_t size);
+    // Content from the oldest to the newest byte
+    std::string read() const;
+    // Content of the ring file written by another process
+    static std::string read_file(const std::string& path);
+
+  private:
+    // Start of the file, the magic tells whether an existing file can be continued
+    struct Header
+    {
+        uint64_t magic;
+        uint64_t size;
+        uint64_t position; // total bytes written
+    };
+    static constexpr uint64_t m_magic = 0x676f6c6c61747321; // "!stallog"
+
+    static std::string unwrap(const Header* header);
+
+    Header* m_header = nullptr;
+    char* m_data = nullptr;
+    size_t m_length = 0; // of the allocation or the mapping
+    bool m_mapped = false;
+};
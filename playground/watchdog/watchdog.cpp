@@ -0,0 +1,446 @@
+#include "watchdog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+// Backtrace of a stalled thread, written by the signal handler of that thread
+struct StallCapture
+{
+    enum State
+    {
+        IDLE = 0,
+        PENDING,   // signal sent, waiting for the handler
+        CAPTURING, // the handler is running
+        DONE,
+    };
+    static const int max_frames = 64;
+
+    std::atomic<int> state{IDLE};
+    std::atomic<pid_t> tid{0};
+    void* frames[max_frames];
+    int depth = 0;
+};
+
+StallCapture s_capture;
+// One capture at a time for all watchdogs
+std::mutex s_capture_mutex;
+std::once_flag s_signal_once;
+int s_stall_signal = 0;
+
+pid_t current_tid()
+{
+    return static_cast<pid_t>(::syscall(SYS_gettid));
+}
+
+// NOTE Runs in the signal path: no allocation, no lock
+void stall_signal_handler(int, siginfo_t*, void*)
+{
+    int saved_errno = errno;
+    int expected = StallCapture::PENDING;
+    if (current_tid() == s_capture.tid.load(std::memory_order_acquire) &&
+        s_capture.state.compare_exchange_strong(expected, StallCapture::CAPTURING,
+                                                std::memory_order_acq_rel))
+    {
+        s_capture.depth = ::backtrace(s_capture.frames, StallCapture::max_frames);
+        s_capture.state.store(StallCapture::DONE, std::memory_order_release);
+    }
+    errno = saved_errno;
+}
+
+void install_stall_signal()
+{
+    // The first backtrace() loads the unwinder, which allocates - do it here and not in the handler
+    void* frames[4];
+    ::backtrace(frames, 4);
+
+    s_stall_signal = SIGRTMIN + 3;
+    struct sigaction action = {};
+    action.sa_sigaction = stall_signal_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(s_stall_signal, &action, nullptr);
+}
+
+// Signal the thread and wait for its backtrace, returns the number of frames or -1
+int capture_backtrace(pid_t tid, void** frames, int max_frames)
+{
+    std::lock_guard<std::mutex> lock(s_capture_mutex);
+    s_capture.depth = 0;
+    s_capture.tid.store(tid, std::memory_order_relaxed);
+    s_capture.state.store(StallCapture::PENDING, std::memory_order_release);
+    if (::syscall(SYS_tgkill, ::getpid(), tid, s_stall_signal) != 0)
+    {
+        s_capture.state.store(StallCapture::IDLE, std::memory_order_relaxed);
+        return -1;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    while (s_capture.state.load(std::memory_order_acquire) != StallCapture::DONE)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+        {
+            // The signal is blocked or the thread is stuck in the kernel, a late handler ignores it
+            int expected = StallCapture::PENDING;
+            if (s_capture.state.compare_exchange_strong(expected, StallCapture::IDLE,
+                                                        std::memory_order_acq_rel))
+                return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    int depth = std::min(s_capture.depth, max_frames);
+    std::copy(s_capture.frames, s_capture.frames + depth, frames);
+    s_capture.state.store(StallCapture::IDLE, std::memory_order_relaxed);
+    return depth;
+}
+
+struct TaskStat
+{
+    bool valid = false;
+    char state = '?';
+    uint64_t cpu_ticks = 0; // user + system, in clock ticks
+};
+
+// Parse /proc/self/task/<tid>/stat, see proc(5)
+TaskStat read_task_stat(pid_t tid)
+{
+    TaskStat stat;
+    char path[64];
+    std::snprintf(path, sizeof(path), "/proc/self/task/%d/stat", static_cast<int>(tid));
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return stat;
+    char buffer[1024];
+    ssize_t length = ::read(fd, buffer, sizeof(buffer) - 1);
+    ::close(fd);
+    if (length <= 0)
+        return stat;
+    buffer[length] = 0;
+
+    // The command name may contain spaces and parentheses, the fields start after the last ')'
+    char* fields = std::strrchr(buffer, ')');
+    if (!fields)
+        return stat;
+    unsigned long long utime = 0, stime = 0;
+    // Fields 3 (state) to 15 (stime)
+    if (std::sscanf(fields + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                    &stat.state, &utime, &stime) != 3)
+        return stat;
+    stat.cpu_ticks = utime + stime;
+    stat.valid = true;
+    return stat;
+}
+} // namespace
+
+Watchdog::Watchdog(size_t max_threads, double interval, double tick)
+    : m_max_threads(std::max<size_t>(max_threads, MIN_THREADS)), m_entries(m_max_threads),
+      m_kicks(new KickSlot[m_max_threads])
+{
+    // Also rejects NaN, before the scanner thread exists
+    if (!(interval > 0))
+        throw std::invalid_argument("Watchdog: interval must be positive");
+    m_tick_duration =
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(tick));
+    if (m_tick_duration <= Clock::duration::zero())
+        m_tick_duration = std::chrono::milliseconds(10);
+    // From the clamped tick, a tick <= 0 would give a bogus or negative count
+    double tick_seconds = std::chrono::duration<double>(m_tick_duration).count();
+    m_interval_ticks =
+        std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(interval / tick_seconds)));
+
+    std::fill(std::begin(m_wheel0), std::end(m_wheel0), m_nil);
+    std::fill(std::begin(m_wheel1), std::end(m_wheel1), m_nil);
+    for (size_t n = m_max_threads; n > 0; n--)
+        m_free_handles.push_back(static_cast<Handle>(n - 1));
+
+    m_handler = [](const std::string& name, const Thread_id& id, int strikes) {
+        std::ostringstream thread;
+        thread << id;
+        std::fprintf(stderr, "Watchdog: thread %s (%s) unresponsive, %d failed checks\n",
+                     name.c_str(), thread.str().c_str(), strikes);
+    };
+
+    m_stall_log.reset(new StallLog());
+    std::call_once(s_signal_once, install_stall_signal);
+
+    m_watchdog = std::thread(&Watchdog::start, this);
+}
+
+Watchdog::~Watchdog()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_watchdog_enable = false;
+    }
+    // NOTE Must notify the scanner to stop sleeping and exit
+    m_cv_stop.notify_one();
+    m_watchdog.join();
+}
+
+Watchdog::Handle Watchdog::add_thread(const std::string& name, const Thread_id& id, double timeout)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_free_handles.empty())
+        return invalid_handle;
+    Handle handle = m_free_handles.back();
+    m_free_handles.pop_back();
+    m_current_threads++;
+
+    Entry& entry = m_entries[handle];
+    entry.name = name;
+    entry.id = id;
+    entry.tid = id == std::this_thread::get_id() ? current_tid() : 0;
+    entry.timeout = m_interval_ticks;
+    if (timeout > 0)
+    {
+        double tick = std::chrono::duration<double>(m_tick_duration).count();
+        entry.timeout = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(timeout / tick)));
+    }
+    entry.failed_checks = 0;
+    entry.active = true;
+
+    // Counts as a kick, the thread has a full timeout for the first one
+    m_kicks[handle].tick.store(m_current_tick, std::memory_order_relaxed);
+    arm(handle, m_current_tick + entry.timeout);
+    return handle;
+}
+
+bool Watchdog::done(Handle handle)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (handle < 0 || static_cast<size_t>(handle) >= m_max_threads || !m_entries[handle].active)
+        return false;
+    unlink(handle);
+    m_entries[handle].active = false;
+    m_free_handles.push_back(handle);
+    m_current_threads--;
+    return true;
+}
+
+void Watchdog::set_handler(Handler handler)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_handler = std::move(handler);
+}
+
+bool Watchdog::set_stall_log(const std::string& path, size_t size)
+{
+    std::unique_ptr<StallLog> log(new StallLog(size, path));
+    if (!log->mapped())
+        return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stall_log = std::move(log);
+    return true;
+}
+
+std::string Watchdog::stall_reports()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stall_log->read();
+}
+
+// Put the entry into the wheel bucket of the deadline. Deadlines beyond the second level go to its
+// last bucket and are re-armed when it fires.
+void Watchdog::arm(Handle handle, uint64_t deadline)
+{
+    Entry& entry = m_entries[handle];
+    entry.deadline = deadline;
+    uint64_t delta = deadline > m_current_tick ? deadline - m_current_tick : 1;
+
+    int32_t* bucket;
+    if (delta < m_wheel0_size)
+        bucket = &m_wheel0[deadline & (m_wheel0_size - 1)];
+    else
+    {
+        uint64_t level1 = std::min<uint64_t>(deadline, m_current_tick + (m_wheel1_size - 1) *
+                                                                            m_wheel0_size);
+        bucket = &m_wheel1[(level1 >> m_wheel0_bits) & (m_wheel1_size - 1)];
+    }
+
+    entry.bucket = bucket;
+    entry.prev = m_nil;
+    entry.next = *bucket;
+    if (*bucket != m_nil)
+        m_entries[*bucket].prev = handle;
+    *bucket = handle;
+}
+
+void Watchdog::unlink(Handle handle)
+{
+    Entry& entry = m_entries[handle];
+    if (!entry.bucket)
+        return;
+    if (entry.prev != m_nil)
+        m_entries[entry.prev].next = entry.next;
+    else
+        *entry.bucket = entry.next;
+    if (entry.next != m_nil)
+        m_entries[entry.next].prev = entry.prev;
+    entry.bucket = nullptr;
+    entry.prev = entry.next = m_nil;
+}
+
+// The deadline of the entry passed, check whether the thread kicked meanwhile
+void Watchdog::m_is_expired(Handle handle)
+{
+    Entry& entry = m_entries[handle];
+    uint64_t kicked = m_kicks[handle].tick.load(std::memory_order_relaxed);
+    uint64_t deadline = kicked + entry.timeout;
+
+    if (deadline > m_current_tick)
+    {
+        entry.failed_checks = 0;
+        arm(handle, deadline);
+        return;
+    }
+
+    entry.failed_checks++;
+    if (entry.failed_checks == 1 && entry.tid)
+    {
+        entry.stall_since = Clock::now();
+        entry.stall_cpu = read_task_stat(entry.tid).cpu_ticks;
+    }
+    if (entry.failed_checks == m_unresponsive)
+        report_stall(handle);
+    if (entry.failed_checks >= m_unresponsive && m_handler)
+        m_handler(entry.name, entry.id, entry.failed_checks);
+    arm(handle, m_current_tick + entry.timeout);
+}
+
+// Format the report on the stack and append it to the ring, nothing is allocated
+void Watchdog::report_stall(Handle handle)
+{
+    Entry& entry = m_entries[handle];
+    char report[8192];
+    size_t length = 0;
+    auto append = [&](const char* format, auto... args) {
+        if (length < sizeof(report))
+        {
+            int n = std::snprintf(report + length, sizeof(report) - length, format, args...);
+            if (n > 0)
+                length = std::min(length + static_cast<size_t>(n), sizeof(report) - 1);
+        }
+    };
+
+    struct timespec now;
+    ::clock_gettime(CLOCK_REALTIME, &now);
+    append("%lld.%03ld stall %s tid %d, %d failed checks\n", static_cast<long long>(now.tv_sec),
+           now.tv_nsec / 1000000, entry.name.c_str(), static_cast<int>(entry.tid),
+           entry.failed_checks);
+
+    if (!entry.tid)
+        append("  not registered by the thread itself, no state and backtrace\n");
+    else
+    {
+        TaskStat stat = read_task_stat(entry.tid);
+        if (!stat.valid)
+            append("  thread exited\n");
+        else
+        {
+            static const long ticks_per_second = ::sysconf(_SC_CLK_TCK);
+            uint64_t cpu_ms = (stat.cpu_ticks - std::min(stat.cpu_ticks, entry.stall_cpu)) *
+                              1000 / static_cast<uint64_t>(ticks_per_second);
+            uint64_t wall_ms = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                                      entry.stall_since)
+                    .count());
+            const char* verdict = "sleeping, waiting for a lock, a condition or I/O";
+            if (stat.state == 'R' || cpu_ms * 2 >= wall_ms)
+                verdict = "running, CPU-bound loop";
+            else if (stat.state == 'D')
+                verdict = "uninterruptible wait, disk I/O or kernel lock";
+            append("  state %c, cpu %" PRIu64 " ms of %" PRIu64 " ms, total cpu %" PRIu64
+                   " ms: %s\n",
+                   stat.state, cpu_ms, wall_ms,
+                   stat.cpu_ticks * 1000 / static_cast<uint64_t>(ticks_per_second), verdict);
+
+            void* frames[StallCapture::max_frames];
+            int depth = capture_backtrace(entry.tid, frames, StallCapture::max_frames);
+            if (depth < 0)
+                append("  no backtrace, signal not handled\n");
+            // Frame 0 is the signal handler
+            for (int n = 1; n < depth; n++)
+            {
+                Dl_info info = {};
+                if (::dladdr(frames[n], &info) && info.dli_sname)
+                    append("  #%d %p %s+0x%lx (%s)\n", n - 1, frames[n], info.dli_sname,
+                           static_cast<unsigned long>(static_cast<char*>(frames[n]) -
+                                                      static_cast<char*>(info.dli_saddr)),
+                           info.dli_fname);
+                else
+                    append("  #%d %p (%s)\n", n - 1, frames[n],
+                           info.dli_fname ? info.dli_fname : "?");
+            }
+        }
+    }
+    m_stall_log->write(report, length);
+}
+
+void Watchdog::process_tick()
+{
+    m_current_tick++;
+
+    // Cascade the second level bucket that now falls into the first level range
+    if ((m_current_tick & (m_wheel0_size - 1)) == 0)
+    {
+        int32_t* bucket = &m_wheel1[(m_current_tick >> m_wheel0_bits) & (m_wheel1_size - 1)];
+        int32_t handle = *bucket;
+        *bucket = m_nil;
+        while (handle != m_nil)
+        {
+            int32_t next = m_entries[handle].next;
+            m_entries[handle].bucket = nullptr;
+            if (m_entries[handle].deadline <= m_current_tick)
+                m_is_expired(handle);
+            else
+                arm(handle, m_entries[handle].deadline);
+            handle = next;
+        }
+    }
+
+    int32_t* bucket = &m_wheel0[m_current_tick & (m_wheel0_size - 1)];
+    int32_t handle = *bucket;
+    *bucket = m_nil;
+    while (handle != m_nil)
+    {
+        int32_t next = m_entries[handle].next;
+        m_entries[handle].bucket = nullptr;
+        m_is_expired(handle);
+        handle = next;
+    }
+}
+
+// Scanner loop, advances the tick and fires the wheel buckets
+void Watchdog::start()
+{
+    Clock::time_point next = Clock::now() + m_tick_duration;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_watchdog_enable)
+    {
+        if (m_cv_stop.wait_until(lock, next, [this] { return !m_watchdog_enable; }))
+            break;
+
+        // Catch up if the scanner was delayed
+        Clock::time_point now = Clock::now();
+        while (next <= now)
+        {
+            process_tick();
+            m_tick.store(m_current_tick, std::memory_order_relaxed);
+            next += m_tick_duration;
+        }
+    }
+}
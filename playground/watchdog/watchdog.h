@@ -1,34 +1,116 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
-#include <unordered_map>
-#include <list>
-#include <atomic>
+#include <vector>
+#include <sys/types.h>
+
+#include "stall_log.h"
 
 // Min number of threads
 #define MIN_THREADS 3
 
 // Multi-threading watchdog
+//
+// Threads register with add_thread() and get a Handle back, then call kick(handle) at least once
+// per interval. kick() is a relaxed load of the watchdog tick and a relaxed store into the slot of
+// the thread - no lock, no hashing and no allocation, so thousands of threads can kick at high
+// frequency.
+//
+// One scanner thread keeps the registered threads in a hierarchical timer wheel (256 buckets of one
+// tick, 64 buckets of 256 ticks). Kicks never touch the wheel: when the bucket of a thread fires
+// the scanner compares the last kick with the deadline and either re-arms the thread at its new
+// deadline or counts a failed check. After m_unresponsive consecutive failed checks the thread is
+// reported as unresponsive to the handler, on every further failed check as well.
+//
+// Stall diagnostics: when a thread that registered itself reaches m_unresponsive failed checks the
+// scanner writes a stall report to the StallLog ring (see stall_log.h):
+//   1) run state and CPU time of the thread from /proc/self/task/<tid>/stat, CPU time used since
+//      the first failed check tells a CPU-bound loop from a lock or I/O wait
+//   2) backtrace of the thread, captured by its own signal handler after a tgkill(). The handler
+//      only calls backtrace() into a preallocated buffer, the symbols are resolved by the scanner.
+// The watchdog installs the handler of SIGRTMIN + 3 for the process.
+//
+// Usage example:
+//
+// Watchdog watchdog(64, 1.0);
+// Watchdog::Handle handle = watchdog.add_thread("worker");
+// while (running) { watchdog.kick(handle); ... }
+// watchdog.done(handle);
 class Watchdog
 {
   public:
-    using Interval_t = std::chrono::duration<std::chrono::seconds>;
+    using Clock = std::chrono::steady_clock;
     using Thread_id = std::thread::id;
-    using Time_t = std::chrono::time_point<std::chrono::system_clock>;
+    // Index of the slot of a registered thread, invalid_handle if all slots are taken
+    using Handle = int;
+    // Called by the scanner thread with the name, id and number of consecutive failed checks
+    using Handler = std::function<void(const std::string& name, const Thread_id& id, int strikes)>;
+
+    static constexpr Handle invalid_handle = -1;
 
-    Watchdog(size_t max_threads, double interval);
+    // interval is the default kick timeout in seconds, it must be positive (std::invalid_argument
+    // otherwise). tick is the resolution of the timer wheel, 10 ms if it is not positive.
+    Watchdog(size_t max_threads, double interval, double tick = 0.01);
     ~Watchdog();
-    void add_thread(const std::string& name, const Thread_id& = std::this_thread::get_id());
-    bool kick(const std::string& name, const Thread_id& = std::this_thread::get_id());
-    bool done(const std::string& name, const Thread_id& = std::this_thread::get_id());
+
+    // Register a thread, timeout 0 uses the interval of the watchdog
+    Handle add_thread(const std::string& name, const Thread_id& = std::this_thread::get_id(),
+                      double timeout = 0);
+    // Called by the registered thread, at least once per timeout. Kicking invalid_handle does
+    // nothing, so the result of add_thread() can be kicked unchecked.
+    void kick(Handle handle)
+    {
+        if (handle < 0)
+            return;
+        m_kicks[handle].tick.store(m_tick.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    // Unregister the thread, the handle may be reused by add_thread()
+    bool done(Handle handle);
+
+    // Replace the default handler that prints to stderr
+    void set_handler(Handler handler);
+    // Write the stall reports to a ring mapped from the file, false if it cannot be mapped
+    bool set_stall_log(const std::string& path, size_t size = 64 * 1024);
+    // Stall reports written so far, oldest first
+    std::string stall_reports();
 
   private:
-    enum ThreadInfo
+    static constexpr uint32_t m_wheel0_bits = 8;
+    static constexpr uint32_t m_wheel0_size = 1u << m_wheel0_bits;
+    static constexpr uint32_t m_wheel1_size = 64;
+    static constexpr int32_t m_nil = -1;
+
+    // Written by the kicking thread only, one cache line per thread
+    struct alignas(64) KickSlot
     {
-        NAME = 0,
-        ID,
-        TIME,
+        std::atomic<uint64_t> tick{0};
+    };
+
+    // ---- Scanner state, locked by m_mutex ----
+    struct Entry
+    {
+        std::string name;
+        Thread_id id;
+        pid_t tid = 0;         // 0 if registered by another thread
+        uint64_t timeout = 0;  // in ticks
+        uint64_t deadline = 0; // tick the entry is armed for
+        int failed_checks = 0;
+        // At the first failed check
+        Clock::time_point stall_since;
+        uint64_t stall_cpu = 0;
+        bool active = false;
+        // Links of the wheel bucket list
+        int32_t prev = m_nil;
+        int32_t next = m_nil;
+        int32_t* bucket = nullptr;
     };
 
     std::mutex m_mutex;
@@ -36,14 +118,30 @@ class Watchdog
     static const int m_unresponsive = 3;
     size_t m_max_threads = 0;
     size_t m_current_threads = 0;
-    std::list<std::tuple<std::string, Thread_id, Time_t>> m_list;
-    std::unordered_map<std::string, decltype(m_list)::iterator> m_map;
-    std::chrono::duration<double> m_interval;
-    std::thread m_watchdog;
-    std::unordered_map<std::string, int> m_failed_checks;
+    std::vector<Entry> m_entries;
+    std::vector<Handle> m_free_handles;
+    int32_t m_wheel0[m_wheel0_size];
+    int32_t m_wheel1[m_wheel1_size];
+    // Last tick processed by the scanner
+    uint64_t m_current_tick = 0;
+    Handler m_handler;
+    std::unique_ptr<StallLog> m_stall_log;
     bool m_watchdog_enable = true;
+    std::condition_variable m_cv_stop;
+
+    // ---- End of variables locked by m_mutex ----
+
+    std::unique_ptr<KickSlot[]> m_kicks;
+    // Ticks since the start, advanced by the scanner
+    alignas(64) std::atomic<uint64_t> m_tick{0};
+    Clock::duration m_tick_duration;
+    uint64_t m_interval_ticks;
+    std::thread m_watchdog;
 
-    bool m_is_expired(std::string& name, Thread_id& id);
-    Time_t get_next_expire_time();
+    void arm(Handle handle, uint64_t deadline);
+    void unlink(Handle handle);
+    void process_tick();
+    void m_is_expired(Handle handle);
+    void report_stall(Handle handle);
     void start();
 };
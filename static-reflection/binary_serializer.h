@@ -0,0 +1,438 @@
+// 1). This is a compact binary serializer for the fields of a Struct reflected
+// with DEFINE_STRUCT_SCHEMA() (see static_reflection.h). It is meant for
+// pushing config snapshots and state between processes, e.g. through a
+// RingBuffer, without going through JSON.
+//
+// 2). Format (little-endian):
+//     a) BinaryHeader - schema fingerprint, payload size and format version
+//     b) payload      - the fields in schema order. Trivially copyable fields
+//                       are stored as their raw bytes, std::string and
+//                       std::vector fields as a uint32_t element count
+//                       followed by the elements (which must be trivially
+//                       copyable), nested Structs as their own payload
+//
+// 3). The fingerprint is a constexpr FNV-1a hash of the field names and types
+// of the schema, so a reader built with a different version of the Struct
+// rejects the message by comparing a single integer. Arrays are hashed as
+// their extent and element type. Trivially copyable classes without a schema
+// would be hashed by size alone and are rejected at compile time, reflect
+// them with DEFINE_STRUCT_SCHEMA() instead.
+//
+// 4). Sizes are resolved at compile time: the fixed part of the payload (all
+// trivially copyable fields and the length prefixes) is known up front, so
+// buffer bounds are checked once per message (plus once per string/vector on
+// the way in) and the fields are copied without any further checks.
+// Neighbouring trivially copyable members with no padding between them are
+// copied as one block.
+// deserialize() validates the whole message before it writes the first field,
+// so a malformed message leaves the fields untouched.
+//
+// 5). Static and non-static fields are both supported, for non-static fields
+// the object passed in is (de)serialized.
+//
+// Usage example:
+//
+// std::array<uint8_t, 4096> buf;
+// size_t len = serialize(SampleStruct{}, buf);
+// if (len == 0) { // buffer too small }
+//
+// if (!deserialize(std::span<const uint8_t>(buf.data(), len), SampleStruct{}))
+//   { // schema mismatch or malformed message }
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "static_reflection.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "binary_serializer.h stores fields in host byte order (little-endian)"
+#endif
+
+// Header in front of every serialized Struct
+struct BinaryHeader {
+  static constexpr uint32_t version_value = 1;
+
+  uint64_t fingerprint;
+  uint32_t payload_size;
+  uint32_t version;
+};
+
+namespace detail {
+
+template <typename F>
+constexpr bool is_string_field = std::is_same<F, std::string>::value;
+
+// Fields stored as a count followed by the elements
+template <typename F>
+constexpr bool is_sequence_field =
+    is_string_field<F> || is_std_vector<F>::value;
+
+// Fields stored as their raw bytes
+template <typename F>
+constexpr bool is_raw_field =
+    !has_struct_schema<F> && !is_sequence_field<F> &&
+    std::is_trivially_copyable<F>::value;
+
+// std::array and C array fields, stored as raw bytes but hashed element-wise
+template <typename F>
+struct array_field : std::false_type {};
+
+template <typename E, std::size_t N>
+struct array_field<std::array<E, N>> : std::true_type {
+  using element_type = E;
+  static constexpr std::size_t extent = N;
+};
+
+template <typename E, std::size_t N>
+struct array_field<E[N]> : std::true_type {
+  using element_type = E;
+  static constexpr std::size_t extent = N;
+};
+
+constexpr uint64_t hash_u64(uint64_t hash, uint64_t value) {
+  for (int n = 0; n < 8; n++) {
+    const char byte[1] = {static_cast<char>(value >> (8 * n))};
+    hash = fnv1a(std::string_view(byte, 1), hash);
+  }
+  return hash;
+}
+
+template <typename T, std::size_t... Idx>
+constexpr uint64_t schema_fingerprint(std::index_sequence<Idx...>);
+
+template <typename T>
+constexpr auto schema_indices() {
+  return std::make_index_sequence<
+      std::tuple_size<decltype(StructSchema<T>())>::value>{};
+}
+
+// One character tag of the field type for the fingerprint
+template <typename F>
+constexpr char field_kind() {
+  if constexpr (has_struct_schema<F>)
+    return 'o';
+  else if constexpr (is_string_field<F>)
+    return 's';
+  else if constexpr (is_std_vector<F>::value)
+    return 'v';
+  else if constexpr (array_field<F>::value)
+    return 'a';
+  else if constexpr (std::is_same<F, bool>::value)
+    return 'b';
+  else if constexpr (std::is_floating_point<F>::value)
+    return 'f';
+  else if constexpr (std::is_integral<F>::value)
+    return std::is_signed<F>::value ? 'i' : 'u';
+  else if constexpr (std::is_enum<F>::value)
+    return 'e';
+  else {
+    static_assert(!is_raw_field<F>,
+                  "Binary serialization cannot fingerprint a trivially "
+                  "copyable class without a schema, reflect it with "
+                  "DEFINE_STRUCT_SCHEMA().");
+    // Not serializable at all, reported by hash_field_type()
+    return 'r';
+  }
+}
+
+template <typename F>
+constexpr uint64_t hash_field_type(uint64_t hash) {
+  const char kind[1] = {field_kind<F>()};
+  hash = fnv1a(std::string_view(kind, 1), hash);
+  if constexpr (has_struct_schema<F>) {
+    return hash_u64(hash, schema_fingerprint<F>(schema_indices<F>()));
+  } else if constexpr (is_sequence_field<F>) {
+    using E = typename F::value_type;
+    static_assert(is_raw_field<E>,
+                  "Binary serialization supports std::string and std::vector "
+                  "of trivially copyable elements only.");
+    return hash_field_type<E>(hash);
+  } else if constexpr (array_field<F>::value) {
+    static_assert(is_raw_field<F>,
+                  "Binary serialization supports arrays of trivially "
+                  "copyable elements only.");
+    hash = hash_u64(hash, array_field<F>::extent);
+    return hash_field_type<typename array_field<F>::element_type>(hash);
+  } else {
+    static_assert(is_raw_field<F>,
+                  "Binary serialization supports trivially copyable, "
+                  "std::string, std::vector and nested Struct fields only.");
+    // Size of the fixed fields, so e.g. int32_t -> int64_t is a new schema
+    return hash_u64(hash, sizeof(F));
+  }
+}
+
+// Hash of the name and type of the Idx-th field of the schema
+template <typename T, std::size_t Idx>
+constexpr uint64_t hash_schema_field(uint64_t hash) {
+  constexpr auto field_schema = std::get<Idx>(StructSchema<T>());
+  using F = schema_field_t<decltype(std::get<FIELD>(field_schema))>;
+  return hash_field_type<F>(fnv1a(std::get<NAME>(field_schema), hash));
+}
+
+template <typename T, std::size_t... Idx>
+constexpr uint64_t schema_fingerprint(std::index_sequence<Idx...>) {
+  uint64_t hash = fnv1a_offset;
+  using Expander = int[];
+  (void)Expander{0, ((void)(hash = hash_schema_field<T, Idx>(hash)), 0)...};
+  return hash;
+}
+
+template <typename T, std::size_t... Idx>
+constexpr std::size_t fixed_payload_size(std::index_sequence<Idx...>);
+
+// Bytes of the field that do not depend on its value
+template <typename F>
+constexpr std::size_t fixed_field_size() {
+  if constexpr (has_struct_schema<F>)
+    return fixed_payload_size<F>(schema_indices<F>());
+  else if constexpr (is_sequence_field<F>)
+    return sizeof(uint32_t);
+  else
+    return sizeof(F);
+}
+
+// Bytes taken by the trivially copyable fields and by the length prefixes of
+// the std::string and std::vector fields
+template <typename T, std::size_t... Idx>
+constexpr std::size_t fixed_payload_size(std::index_sequence<Idx...>) {
+  constexpr auto struct_schema = StructSchema<T>();
+  return (std::size_t{0} + ... +
+          fixed_field_size<schema_field_t<decltype(std::get<FIELD>(
+              std::get<Idx>(struct_schema)))>>());
+}
+
+template <typename T, std::size_t... Idx>
+constexpr bool has_variable_fields(std::index_sequence<Idx...>);
+
+template <typename F>
+constexpr bool is_variable_field() {
+  if constexpr (has_struct_schema<F>)
+    return has_variable_fields<F>(schema_indices<F>());
+  else
+    return is_sequence_field<F>;
+}
+
+template <typename T, std::size_t... Idx>
+constexpr bool has_variable_fields(std::index_sequence<Idx...>) {
+  constexpr auto struct_schema = StructSchema<T>();
+  return (false || ... ||
+          is_variable_field<schema_field_t<decltype(std::get<FIELD>(
+              std::get<Idx>(struct_schema)))>>());
+}
+
+// Bytes of the elements of all the strings and vectors of obj
+template <typename T>
+size_t variable_payload_size(const T& obj) {
+  size_t size = 0;
+  for_each_field(obj, [&size](auto&& field, auto&&, auto) {
+    using F = std::decay_t<decltype(field)>;
+    if constexpr (has_struct_schema<F>)
+      size += variable_payload_size(field);
+    else if constexpr (is_sequence_field<F>)
+      size += field.size() * sizeof(typename F::value_type);
+  });
+  return size;
+}
+
+// Raw fields that are neighbours in the object, with no padding between
+// them, are neighbours in the payload too. Such a run is copied with a
+// single memcpy. The run is tracked as an offset into the object, static
+// fields are never part of one.
+struct RawRun {
+  size_t offset = 0;
+  size_t size = 0;
+};
+
+template <typename T, typename F>
+size_t member_offset(const T& obj, const F& field) {
+  return static_cast<size_t>(reinterpret_cast<const uint8_t*>(&field) -
+                             reinterpret_cast<const uint8_t*>(&obj));
+}
+
+template <typename T>
+void write_fields(const T& obj, uint8_t*& pos) {
+  const uint8_t* base = reinterpret_cast<const uint8_t*>(&obj);
+  RawRun run;
+  auto flush = [&] {
+    std::memcpy(pos, base + run.offset, run.size);
+    pos += run.size;
+    run = RawRun();
+  };
+  for_each_tuple(StructSchema<T>(), [&](auto&& field_schema) {
+    auto field_ptr = std::get<FIELD>(field_schema);
+    using F = schema_field_t<decltype(field_ptr)>;
+    const F& field = field_ref(obj, field_ptr);
+    if constexpr (is_raw_field<F> &&
+                  std::is_member_object_pointer<decltype(field_ptr)>::value) {
+      size_t offset = member_offset(obj, field);
+      if (run.size && run.offset + run.size != offset) flush();
+      if (!run.size) run.offset = offset;
+      run.size += sizeof(F);
+      return;
+    }
+    if (run.size) flush();
+    if constexpr (has_struct_schema<F>) {
+      write_fields(field, pos);
+    } else if constexpr (is_sequence_field<F>) {
+      // serialize() keeps the payload, and so every count, within uint32_t
+      uint32_t count = static_cast<uint32_t>(field.size());
+      size_t len = size_t{count} * sizeof(typename F::value_type);
+      std::memcpy(pos, &count, sizeof(count));
+      if (len) std::memcpy(pos + sizeof(count), field.data(), len);
+      pos += sizeof(count) + len;
+    } else {
+      std::memcpy(pos, &field, sizeof(F));
+      pos += sizeof(F);
+    }
+  });
+  if (run.size) flush();
+}
+
+// Walk the payload of a Struct T without writing to any field, returns false
+// if it does not fit between pos and end
+template <typename T>
+bool validate_fields(const T& obj, const uint8_t*& pos, const uint8_t* end) {
+  constexpr size_t fixed_size = fixed_payload_size<T>(schema_indices<T>());
+  if (static_cast<size_t>(end - pos) < fixed_size) return false;
+  // Only the strings and vectors can move the fields that follow them
+  if constexpr (!has_variable_fields<T>(schema_indices<T>())) {
+    pos += fixed_size;
+    return true;
+  } else {
+    bool valid = true;
+    for_each_field(obj, [&](auto&& field, auto&&, auto) {
+      using F = std::decay_t<decltype(field)>;
+      if (!valid) return;
+      if constexpr (has_struct_schema<F>) {
+        valid = validate_fields(field, pos, end);
+      } else if constexpr (is_sequence_field<F>) {
+        uint32_t count;
+        if (static_cast<size_t>(end - pos) < sizeof(count)) {
+          valid = false;
+          return;
+        }
+        std::memcpy(&count, pos, sizeof(count));
+        pos += sizeof(count);
+        size_t len = size_t{count} * sizeof(typename F::value_type);
+        valid = static_cast<size_t>(end - pos) >= len;
+        pos += valid ? len : 0;
+      } else {
+        valid = static_cast<size_t>(end - pos) >= sizeof(F);
+        pos += valid ? sizeof(F) : 0;
+      }
+    });
+    return valid;
+  }
+}
+
+// Read the fields of a payload that passed validate_fields()
+template <typename T>
+void read_fields(T& obj, const uint8_t*& pos) {
+  uint8_t* base = reinterpret_cast<uint8_t*>(&obj);
+  RawRun run;
+  auto flush = [&] {
+    std::memcpy(base + run.offset, pos, run.size);
+    pos += run.size;
+    run = RawRun();
+  };
+  for_each_tuple(StructSchema<T>(), [&](auto&& field_schema) {
+    auto field_ptr = std::get<FIELD>(field_schema);
+    using F = schema_field_t<decltype(field_ptr)>;
+    F& field = field_ref(obj, field_ptr);
+    if constexpr (is_raw_field<F> &&
+                  std::is_member_object_pointer<decltype(field_ptr)>::value) {
+      size_t offset = member_offset(obj, field);
+      if (run.size && run.offset + run.size != offset) flush();
+      if (!run.size) run.offset = offset;
+      run.size += sizeof(F);
+      return;
+    }
+    if (run.size) flush();
+    if constexpr (has_struct_schema<F>) {
+      read_fields(field, pos);
+    } else if constexpr (is_sequence_field<F>) {
+      using E = typename F::value_type;
+      uint32_t count;
+      std::memcpy(&count, pos, sizeof(count));
+      pos += sizeof(count);
+      field.resize(count);
+      if (count) std::memcpy(field.data(), pos, count * sizeof(E));
+      pos += count * sizeof(E);
+    } else {
+      std::memcpy(&field, pos, sizeof(F));
+      pos += sizeof(F);
+    }
+  });
+  if (run.size) flush();
+}
+
+}  // namespace detail
+
+// Compile-time fingerprint of the names and types of the Struct T fields
+template <typename T>
+constexpr uint64_t schema_fingerprint() {
+  return detail::schema_fingerprint<T>(detail::schema_indices<T>());
+}
+
+// Number of bytes serialize() needs for the current field values
+template <typename T>
+size_t serialized_size(const T& obj) {
+  return sizeof(BinaryHeader) +
+         detail::fixed_payload_size<T>(detail::schema_indices<T>()) +
+         detail::variable_payload_size(obj);
+}
+
+// Serialize the fields of the Struct T into out. Returns the number of bytes
+// written, or 0 if out is too small or the payload does not fit the uint32_t
+// payload size of the header.
+template <typename T>
+size_t serialize(const T& obj, std::span<uint8_t> out) {
+  size_t size = serialized_size(obj);
+  // An element count is never larger than the payload, so this bounds the
+  // counts of the strings and vectors as well
+  if (size - sizeof(BinaryHeader) > UINT32_MAX) return 0;
+  if (out.size() < size) return 0;
+
+  BinaryHeader header = {schema_fingerprint<T>(),
+                         static_cast<uint32_t>(size - sizeof(BinaryHeader)),
+                         BinaryHeader::version_value};
+  uint8_t* pos = out.data();
+  std::memcpy(pos, &header, sizeof(header));
+  pos += sizeof(header);
+  detail::write_fields(obj, pos);
+  return size;
+}
+
+// Deserialize the fields of the Struct T from in. Returns false, without
+// modifying any field, if the schema fingerprint does not match or the
+// message is malformed.
+template <typename T>
+bool deserialize(std::span<const uint8_t> in, T&& obj) {
+  using Struct = std::decay_t<T>;
+  BinaryHeader header;
+  if (in.size() < sizeof(header)) return false;
+  std::memcpy(&header, in.data(), sizeof(header));
+  if (header.fingerprint != schema_fingerprint<Struct>() ||
+      header.version != BinaryHeader::version_value ||
+      header.payload_size != in.size() - sizeof(header))
+    return false;
+
+  const uint8_t* begin = in.data() + sizeof(header);
+  const uint8_t* end = begin + header.payload_size;
+  const uint8_t* pos = begin;
+  if (!detail::validate_fields(obj, pos, end) || pos != end) return false;
+
+  pos = begin;
+  detail::read_fields(obj, pos);
+  return true;
+}
@@ -0,0 +1,221 @@
+// Test of binary_serializer.h
+//
+// Structs whose trivially copyable members are partly packed and partly
+// separated by padding are serialized and the payload is compared byte by
+// byte with the fields written one after the other in schema order, so
+// copying neighbouring members as one block must not change the format.
+// The messages must deserialize back to equal values, truncated ones must
+// be rejected without touching the fields. Array fields that differ only in
+// element type or extent must give different fingerprints.
+//
+// Build & run:
+//   g++ -std=c++20 -O2 -o binary_serializer_test binary_serializer_test.cpp
+//   ./binary_serializer_test
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "binary_serializer.h"
+#include "test_util.h"
+
+namespace {
+
+struct Position {
+  int32_t x;
+  int32_t y;
+  int32_t z;
+};
+
+// Runs of packed members broken by padding, a string, a nested Struct and
+// fields reflected out of declaration order
+struct Order {
+  uint64_t id;
+  int32_t quantity;
+  int32_t side;
+  char flag;
+  double price;
+  std::string symbol;
+  Position position;
+  uint16_t venue;
+  uint16_t desk;
+  std::vector<int32_t> fills;
+  std::array<uint8_t, 3> tag;
+  bool active;
+  uint32_t account;
+};
+
+// Static fields are never merged
+struct Limits {
+  static const int FIRST_LINE = __LINE__;
+  static int32_t max_orders;
+  static int32_t max_notional;
+  static const int LAST_LINE = __LINE__;
+
+  static const int PARAMETERS_COUNT = LAST_LINE - FIRST_LINE - 1;
+};
+
+// Same field names, the arrays differ in element type or extent
+struct IntSamples {
+  std::array<int32_t, 4> samples;
+  int32_t grid[2][3];
+};
+
+struct FloatSamples {
+  std::array<float, 4> samples;
+  int32_t grid[2][3];
+};
+
+struct ShortSamples {
+  std::array<int32_t, 2> samples;
+  int32_t grid[2][3];
+};
+
+struct TransposedSamples {
+  std::array<int32_t, 4> samples;
+  int32_t grid[3][2];
+};
+
+int32_t Limits::max_orders = 100;
+int32_t Limits::max_notional = 5000000;
+
+}  // namespace
+
+DEFINE_STRUCT_SCHEMA(Position, DEFINE_STRUCT_FIELD(x, "number"),
+                     DEFINE_STRUCT_FIELD(y, "number"),
+                     DEFINE_STRUCT_FIELD(z, "number"));
+
+DEFINE_STRUCT_SCHEMA(IntSamples, DEFINE_STRUCT_FIELD(samples, "array"),
+                     DEFINE_STRUCT_FIELD(grid, "array"));
+
+DEFINE_STRUCT_SCHEMA(FloatSamples, DEFINE_STRUCT_FIELD(samples, "array"),
+                     DEFINE_STRUCT_FIELD(grid, "array"));
+
+DEFINE_STRUCT_SCHEMA(ShortSamples, DEFINE_STRUCT_FIELD(samples, "array"),
+                     DEFINE_STRUCT_FIELD(grid, "array"));
+
+DEFINE_STRUCT_SCHEMA(TransposedSamples, DEFINE_STRUCT_FIELD(samples, "array"),
+                     DEFINE_STRUCT_FIELD(grid, "array"));
+
+DEFINE_STRUCT_SCHEMA(Order, DEFINE_STRUCT_FIELD(id, "number"),
+                     DEFINE_STRUCT_FIELD(quantity, "number"),
+                     DEFINE_STRUCT_FIELD(side, "number"),
+                     DEFINE_STRUCT_FIELD(flag, "string"),
+                     DEFINE_STRUCT_FIELD(price, "number"),
+                     DEFINE_STRUCT_FIELD(symbol, "string"),
+                     DEFINE_STRUCT_FIELD(position, "object"),
+                     DEFINE_STRUCT_FIELD(desk, "number"),
+                     DEFINE_STRUCT_FIELD(venue, "number"),
+                     DEFINE_STRUCT_FIELD(fills, "array"),
+                     DEFINE_STRUCT_FIELD(tag, "array"),
+                     DEFINE_STRUCT_FIELD(active, "bool"),
+                     DEFINE_STRUCT_FIELD(account, "number"));
+
+DEFINE_STRUCT_SCHEMA(Limits, DEFINE_STRUCT_FIELD(max_orders, "number"),
+                     DEFINE_STRUCT_FIELD(max_notional, "number"));
+
+namespace {
+
+// The payload the format describes, one field after the other
+template <typename T>
+void append_fields(const T& obj, std::vector<uint8_t>& out) {
+  for_each_field(obj, [&out](auto&& field, auto&&, auto) {
+    using F = std::decay_t<decltype(field)>;
+    auto append = [&out](const void* data, size_t size) {
+      const uint8_t* bytes = static_cast<const uint8_t*>(data);
+      out.insert(out.end(), bytes, bytes + size);
+    };
+    if constexpr (has_struct_schema<F>) {
+      append_fields(field, out);
+    } else if constexpr (detail::is_sequence_field<F>) {
+      uint32_t count = static_cast<uint32_t>(field.size());
+      append(&count, sizeof(count));
+      append(field.data(), count * sizeof(typename F::value_type));
+    } else {
+      append(&field, sizeof(F));
+    }
+  });
+}
+
+template <typename T>
+std::vector<uint8_t> expected_payload(const T& obj) {
+  std::vector<uint8_t> payload;
+  append_fields(obj, payload);
+  return payload;
+}
+
+bool equal(const Order& a, const Order& b) {
+  return a.id == b.id && a.quantity == b.quantity && a.side == b.side &&
+         a.flag == b.flag && a.price == b.price && a.symbol == b.symbol &&
+         a.position.x == b.position.x && a.position.y == b.position.y &&
+         a.position.z == b.position.z && a.venue == b.venue &&
+         a.desk == b.desk && a.fills == b.fills && a.tag == b.tag &&
+         a.active == b.active && a.account == b.account;
+}
+
+void test_order() {
+  Order order = {1234567890123ULL, 300,  -1,         'L',
+                 101.25,           "NVDA", {1, -2, 3}, 7,
+                 9,                {100, 150, 50},     {{1, 2, 3}},
+                 true,             42};
+  std::array<uint8_t, 256> buf;
+  size_t len = serialize(order, buf);
+  CHECK(len == serialized_size(order));
+  std::vector<uint8_t> payload = expected_payload(order);
+  CHECK(len == sizeof(BinaryHeader) + payload.size());
+  CHECK(memcmp(buf.data() + sizeof(BinaryHeader), payload.data(),
+               payload.size()) == 0);
+
+  Order copy = {};
+  CHECK(deserialize(std::span<const uint8_t>(buf.data(), len), copy));
+  CHECK(equal(order, copy));
+
+  // Truncated, the fields must stay untouched
+  Order untouched = {};
+  untouched.symbol = "none";
+  Order target = untouched;
+  for (size_t size = 0; size < len; size++)
+    CHECK(!deserialize(std::span<const uint8_t>(buf.data(), size), target));
+  CHECK(equal(target, untouched));
+  CHECK(serialize(order, std::span<uint8_t>(buf.data(), len - 1)) == 0);
+}
+
+void test_static_fields() {
+  std::array<uint8_t, 64> buf;
+  size_t len = serialize(Limits{}, buf);
+  CHECK(len == sizeof(BinaryHeader) + 2 * sizeof(int32_t));
+  std::vector<uint8_t> payload = expected_payload(Limits{});
+  CHECK(memcmp(buf.data() + sizeof(BinaryHeader), payload.data(),
+               payload.size()) == 0);
+  Limits::max_orders = 0;
+  Limits::max_notional = 0;
+  CHECK(deserialize(std::span<const uint8_t>(buf.data(), len), Limits{}));
+  CHECK(Limits::max_orders == 100 && Limits::max_notional == 5000000);
+}
+
+void test_array_fingerprints() {
+  constexpr uint64_t ints = schema_fingerprint<IntSamples>();
+  static_assert(ints != schema_fingerprint<FloatSamples>());
+  static_assert(ints != schema_fingerprint<ShortSamples>());
+  static_assert(ints != schema_fingerprint<TransposedSamples>());
+
+  IntSamples in = {{1, 2, 3, 4}, {{5, 6, 7}, {8, 9, 10}}};
+  std::array<uint8_t, 128> buf;
+  size_t len = serialize(in, buf);
+  CHECK(len == sizeof(BinaryHeader) + sizeof(IntSamples));
+  FloatSamples floats = {};
+  CHECK(!deserialize(std::span<const uint8_t>(buf.data(), len), floats));
+  IntSamples out = {};
+  CHECK(deserialize(std::span<const uint8_t>(buf.data(), len), out));
+  CHECK(memcmp(&in, &out, sizeof(in)) == 0);
+}
+
+}  // namespace
+
+int main() {
+  test_order();
+  test_static_fields();
+  test_array_fingerprints();
+  return test_result();
+}
@@ -0,0 +1,311 @@
+// 1). Incremental config reload for Structs reflected with non-static members
+// (see static_reflection.h). diff(old_config, new_config) compares the two
+// values field by field and returns a field_mask<T>, a std::bitset with one
+// bit per field in schema order, so a reload can tell exactly what changed.
+// Nested Structs are compared recursively and count as a single field of the
+// outer Struct.
+//
+// 2). ConfigSnapshot<T> holds the current config as an immutable snapshot and
+// publishes new ones RCU-style:
+//     a) publish() diffs the new config against the current one, swaps the
+//        snapshot pointer and calls the subscribers whose fields changed
+//     b) readers take a Reader handle once per thread and then read() a
+//        Guard to the current snapshot. Reading is one store to the reader's
+//        own cache line and one load of the snapshot pointer, no lock and no
+//        shared counter is written
+//     c) the replaced snapshot is freed by a later publish(), once every
+//        reader that could still see it has dropped its Guard (epoch based
+//        reclamation)
+//
+// 3). Subscribers run on the publishing thread, after the swap, with the old
+// and the new snapshot and the mask of the changed fields. They must not call
+// publish(), subscribe() or unsubscribe() of the same ConfigSnapshot.
+//
+// 4). A Guard pins its snapshot, and every snapshot published after it, until
+// it is destroyed, so keep it short lived on hot paths. Guards of one Reader
+// must not be nested, and a Reader must be used by one thread at a time.
+//
+// Usage example:
+//
+// struct ServerConfig {
+//    int port;
+//    int threads;
+//    std::string log_level;
+// };
+// DEFINE_STRUCT_SCHEMA(ServerConfig, DEFINE_STRUCT_FIELD(port, "number"),
+//                      DEFINE_STRUCT_FIELD(threads, "number"),
+//                      DEFINE_STRUCT_FIELD(log_level, "string"));
+//
+// ConfigSnapshot<ServerConfig> config(load_config());
+// config.subscribe(make_field_mask<&ServerConfig::threads>(),
+//                  [](const ServerConfig&, const ServerConfig& config,
+//                     const field_mask<ServerConfig>&)
+//                  { pool.resize(config.threads); });
+//
+// auto reader = config.reader();  // per thread
+// { auto cfg = reader.read(); if (cfg->log_level == "debug") ... }
+//
+// config.publish(load_config());  // on reload
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "static_reflection.h"
+
+// One bit per field of the StructSchema of T, in schema order
+template <typename T>
+using field_mask = std::bitset<schema_size<T>>;
+
+namespace detail {
+
+template <typename T>
+bool struct_equal(const T& a, const T& b);
+
+template <typename F>
+bool field_equal(const F& a, const F& b) {
+  if constexpr (has_struct_schema<F>) {
+    return struct_equal(a, b);
+  } else if constexpr (is_std_vector<F>::value || is_std_array<F>::value) {
+    if (a.size() != b.size()) return false;
+    for (std::size_t n = 0; n < a.size(); n++)
+      if (!field_equal(a[n], b[n])) return false;
+    return true;
+  } else {
+    return a == b;
+  }
+}
+
+template <typename T, std::size_t Idx>
+bool field_changed(const T& a, const T& b) {
+  constexpr auto field_ptr = std::get<FIELD>(std::get<Idx>(StructSchema<T>()));
+  return !field_equal(field_ref(a, field_ptr), field_ref(b, field_ptr));
+}
+
+template <typename T, std::size_t... Idx>
+field_mask<T> diff(const T& a, const T& b, std::index_sequence<Idx...>) {
+  field_mask<T> changed;
+  using Expander = int[];
+  (void)Expander{
+      0, ((void)changed.set(Idx, field_changed<T, Idx>(a, b)), 0)...};
+  return changed;
+}
+
+template <typename T>
+bool struct_equal(const T& a, const T& b) {
+  return detail::diff(a, b, std::make_index_sequence<schema_size<T>>{})
+      .none();
+}
+
+}  // namespace detail
+
+// Fields of new_config that differ from old_config
+template <typename T>
+field_mask<T> diff(const T& old_config, const T& new_config) {
+  static_assert(
+      detail::all_member_fields<T>(std::make_index_sequence<schema_size<T>>{}),
+      "diff() needs a schema of non-static data members.");
+  return detail::diff(old_config, new_config,
+                      std::make_index_sequence<schema_size<T>>{});
+}
+
+// Mask with the bits of the given fields set,
+// e.g. make_field_mask<&Config::port, &Config::threads>()
+template <auto Member, auto... Members>
+auto make_field_mask() {
+  using T = typename detail::member_pointer_class<decltype(Member)>::type;
+  field_mask<T> mask;
+  mask.set(schema_index<Member, T>());
+  using Expander = int[];
+  (void)Expander{0, ((void)mask.set(schema_index<Members, T>()), 0)...};
+  return mask;
+}
+
+template <typename T, std::size_t max_readers = 64>
+class ConfigSnapshot {
+  static_assert(
+      detail::all_member_fields<T>(std::make_index_sequence<schema_size<T>>{}),
+      "ConfigSnapshot<T> needs a schema of non-static data members.");
+
+  static constexpr std::size_t cache_line_size = 64;
+
+  // Epoch a reader entered its read section at, 0 outside of it
+  struct alignas(cache_line_size) ReaderSlot {
+    std::atomic_bool used{false};
+    std::atomic<uint64_t> epoch{0};
+  };
+
+ public:
+  using mask_type = field_mask<T>;
+  using callback = std::function<void(
+      const T& old_config, const T& new_config, const mask_type& changed)>;
+
+  // Pins the snapshot that was current when it was created
+  class Guard {
+   public:
+    Guard(Guard&& other) noexcept
+        : m_slot(std::exchange(other.m_slot, nullptr)),
+          m_config(other.m_config) {}
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    Guard& operator=(Guard&&) = delete;
+    ~Guard() {
+      if (m_slot) m_slot->epoch.store(0, std::memory_order_release);
+    }
+
+    const T& operator*() const { return *m_config; }
+    const T* operator->() const { return m_config; }
+    const T* get() const { return m_config; }
+
+   private:
+    friend class ConfigSnapshot;
+    Guard(ReaderSlot* slot, const T* config) : m_slot(slot), m_config(config) {}
+
+    ReaderSlot* m_slot;
+    const T* m_config;
+  };
+
+  // Per thread read handle, holds one of the max_readers reader slots
+  class Reader {
+   public:
+    Reader(Reader&& other) noexcept
+        : m_owner(other.m_owner),
+          m_slot(std::exchange(other.m_slot, nullptr)) {}
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+    Reader& operator=(Reader&&) = delete;
+    ~Reader() {
+      if (m_slot) m_slot->used.store(false, std::memory_order_release);
+    }
+
+    // False if all the reader slots were taken
+    bool valid() const { return m_slot != nullptr; }
+
+    Guard read() const {
+      // The epoch store is ordered before the pointer load (both seq_cst),
+      // pairing with the pointer swap before the epoch increment in
+      // publish(), so the writer either sees this reader or this reader sees
+      // the new snapshot.
+      m_slot->epoch.store(m_owner->m_epoch.load(std::memory_order_seq_cst),
+                          std::memory_order_seq_cst);
+      return Guard(m_slot, m_owner->m_current.load(std::memory_order_seq_cst));
+    }
+
+   private:
+    friend class ConfigSnapshot;
+    Reader(const ConfigSnapshot* owner, ReaderSlot* slot)
+        : m_owner(owner), m_slot(slot) {}
+
+    const ConfigSnapshot* m_owner;
+    ReaderSlot* m_slot;
+  };
+
+  explicit ConfigSnapshot(T initial = T{})
+      : m_current(new T(std::move(initial))) {}
+  ConfigSnapshot(const ConfigSnapshot&) = delete;
+  ConfigSnapshot& operator=(const ConfigSnapshot&) = delete;
+
+  // All Readers and Guards have to be destroyed before
+  ~ConfigSnapshot() { delete m_current.load(std::memory_order_relaxed); }
+
+  Reader reader() const {
+    for (ReaderSlot& slot : m_slots) {
+      bool used = false;
+      if (!slot.used.load(std::memory_order_relaxed) &&
+          slot.used.compare_exchange_strong(used, true,
+                                            std::memory_order_acquire))
+        return Reader(this, &slot);
+    }
+    return Reader(this, nullptr);
+  }
+
+  // Make new_config the current snapshot. Returns the changed fields, nothing
+  // is published and no subscriber is called if no field changed.
+  mask_type publish(T new_config) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const T* old_config = m_current.load(std::memory_order_relaxed);
+    mask_type changed = diff(*old_config, new_config);
+    if (changed.none()) return changed;
+
+    const T* next = new T(std::move(new_config));
+    m_current.store(next, std::memory_order_seq_cst);
+    uint64_t retire_epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+    for (const Subscription& subscription : m_subscriptions)
+      if ((subscription.fields & changed).any())
+        subscription.fn(*old_config, *next, changed);
+
+    m_retired.push_back({std::unique_ptr<const T>(old_config), retire_epoch});
+    reclaim();
+    return changed;
+  }
+
+  // Call fn on every publish() that changes any of the fields. Returns the
+  // subscription id for unsubscribe().
+  int subscribe(const mask_type& fields, callback fn) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_subscriptions.push_back({++m_last_id, fields, std::move(fn)});
+    return m_last_id;
+  }
+
+  void unsubscribe(int id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_subscriptions.begin(); it != m_subscriptions.end(); ++it) {
+      if (it->id == id) {
+        m_subscriptions.erase(it);
+        return;
+      }
+    }
+  }
+
+  // Number of replaced snapshots not freed yet
+  std::size_t retired() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_retired.size();
+  }
+
+ private:
+  struct Subscription {
+    int id;
+    mask_type fields;
+    callback fn;
+  };
+
+  struct Retired {
+    std::unique_ptr<const T> config;
+    uint64_t epoch;
+  };
+
+  // Free the snapshots no reader can see any more: readers that entered at
+  // an epoch >= the retire epoch loaded the pointer after it was swapped.
+  void reclaim() {
+    uint64_t min_epoch = UINT64_MAX;
+    for (const ReaderSlot& slot : m_slots) {
+      uint64_t epoch = slot.epoch.load(std::memory_order_seq_cst);
+      if (epoch != 0 && epoch < min_epoch) min_epoch = epoch;
+    }
+    auto it = m_retired.begin();
+    while (it != m_retired.end() && it->epoch <= min_epoch) ++it;
+    m_retired.erase(m_retired.begin(), it);
+  }
+
+  std::atomic<const T*> m_current;
+  std::atomic<uint64_t> m_epoch{1};
+  mutable std::array<ReaderSlot, max_readers> m_slots;
+
+  mutable std::mutex m_mutex;
+  std::vector<Subscription> m_subscriptions;
+  std::vector<Retired> m_retired;
+  int m_last_id = 0;
+};
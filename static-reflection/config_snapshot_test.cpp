@@ -0,0 +1,95 @@
+// Test of config_snapshot.h together with json_config.h
+//
+// Both headers must work whichever of them is included first, a config is
+// parsed from JSON, published to a ConfigSnapshot and the diff against the
+// previous one must name exactly the changed fields. The test is built once
+// per include order.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -o config_snapshot_test config_snapshot_test.cpp
+//   g++ -std=c++17 -O2 -DCONFIG_SNAPSHOT_FIRST -o config_snapshot_test
+//       config_snapshot_test.cpp
+//   ./config_snapshot_test
+#ifdef CONFIG_SNAPSHOT_FIRST
+#include "config_snapshot.h"
+#include "json_config.h"
+#else
+#include "json_config.h"
+#include "config_snapshot.h"
+#endif
+
+#include <cstdio>
+#include <string>
+
+#include "test_util.h"
+
+namespace {
+
+struct Limits {
+  int max_connections;
+  int timeout_ms;
+};
+
+struct ServerConfig {
+  int port;
+  int threads;
+  std::string log_level;
+  Limits limits;
+};
+
+}  // namespace
+
+DEFINE_STRUCT_SCHEMA(Limits, DEFINE_STRUCT_FIELD(max_connections, "number"),
+                     DEFINE_STRUCT_FIELD(timeout_ms, "number"));
+
+DEFINE_STRUCT_SCHEMA(ServerConfig, DEFINE_STRUCT_FIELD(port, "number"),
+                     DEFINE_STRUCT_FIELD(threads, "number"),
+                     DEFINE_STRUCT_FIELD(log_level, "string"),
+                     DEFINE_STRUCT_FIELD(limits, "object"));
+
+namespace {
+
+void test_reload() {
+  ServerConfig initial = {};
+  CHECK(parse_json_config(R"({"port": 8080, "threads": 4, "log_level": "info",
+                              "limits": {"max_connections": 1000,
+                                         "timeout_ms": 500}})",
+                          initial));
+  ConfigSnapshot<ServerConfig> config(initial);
+
+  int resized = 0;
+  config.subscribe(make_field_mask<&ServerConfig::threads>(),
+                   [&](const ServerConfig&, const ServerConfig& current,
+                       const field_mask<ServerConfig>&) {
+                     resized = current.threads;
+                   });
+
+  ServerConfig reloaded = initial;
+  CHECK(parse_json_config(R"({"threads": 8, "log_level": "debug"})",
+                          reloaded));
+  field_mask<ServerConfig> changed = config.publish(reloaded);
+  CHECK(changed == (make_field_mask<&ServerConfig::threads,
+                                    &ServerConfig::log_level>()));
+  CHECK(resized == 8);
+  CHECK(diff(initial, reloaded) == changed);
+
+  // A nested Struct is compared field by field and counts as one field
+  resized = 0;
+  CHECK(parse_json_config(R"({"limits": {"timeout_ms": 250}})", reloaded));
+  CHECK(config.publish(reloaded) == make_field_mask<&ServerConfig::limits>());
+  CHECK(resized == 0);
+
+  auto reader = config.reader();
+  auto current = reader.read();
+  CHECK(current->port == 8080);
+  CHECK(current->log_level == "debug");
+  CHECK(current->limits.max_connections == 1000);
+  CHECK(current->limits.timeout_ms == 250);
+}
+
+}  // namespace
+
+int main() {
+  test_reload();
+  return test_result();
+}
@@ -0,0 +1,432 @@
+// 1). This is a single-pass, allocation-free JSON config reader that writes
+// the values straight into the fields of a Struct reflected with
+// DEFINE_STRUCT_SCHEMA() (see static_reflection.h). Static fields are parsed
+// with parse_json_config<T>(json), non-static ones into the given object with
+// parse_json_config(json, obj).
+//
+// 2). Everything that depends on the schema is generated at compile time:
+//     a) a key table - open addressing hash table of the FNV-1a hashes of the
+//        field names, so a key is hashed while it is scanned and found with
+//        on average one probe plus a single compare to confirm the match
+//        (no compares against the other field names)
+//     b) a dispatch table - one parse function per field that knows the
+//        field's C++ type and member pointer, indexed by the key table
+//
+// 3). The JSON value is converted by the C++ type of the field: bool,
+// integral, floating point and std::string fields are supported, as well as
+// std::array and std::vector of them (JSON arrays) and nested Structs with
+// their own StructSchema (JSON objects). Only std::string and std::vector
+// fields allocate. nan and inf are not JSON numbers and are rejected. The
+// json_type element of the schema is not used by the parser. Keys that are
+// not in the schema are skipped together with their (possibly nested) value,
+// a skipped value is only checked for matching brackets and terminated
+// strings and may nest up to 64 levels deep.
+// Keys containing escape sequences never match a field name.
+//
+// 4). Fields are assigned in document order. On error, the fields before the
+// error position are already updated, so parse into a staging copy or reload
+// the previous file if partial updates matter.
+//
+// Usage example:
+//
+// size_t error_offset;
+// if (!parse_json_config<SampleStruct>(json_text, &error_offset))
+//   std::cerr << "config error at offset " << error_offset << std::endl;
+
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "static_reflection.h"
+
+namespace detail {
+
+// Scanner over the JSON text, it never allocates except for std::string
+// fields and keeps track of the position for error reporting
+class JsonReader {
+ public:
+  explicit JsonReader(std::string_view json)
+      : m_pos(json.data()),
+        m_begin(json.data()),
+        m_end(json.data() + json.size()) {}
+
+  size_t offset() const { return static_cast<size_t>(m_pos - m_begin); }
+
+  void skip_ws() {
+    while (m_pos != m_end && (*m_pos == ' ' || *m_pos == '\t' ||
+                              *m_pos == '\n' || *m_pos == '\r'))
+      ++m_pos;
+  }
+
+  bool at_end() {
+    skip_ws();
+    return m_pos == m_end;
+  }
+
+  // Consume the character c if it is the next non-whitespace character
+  bool consume(char c) {
+    skip_ws();
+    if (m_pos == m_end || *m_pos != c) return false;
+    ++m_pos;
+    return true;
+  }
+
+  // Read an object key, hashing it in the same pass. The returned view is the
+  // raw text between the quotes.
+  bool read_key(std::string_view& key, uint64_t& hash) {
+    if (!consume('"')) return false;
+    const char* start = m_pos;
+    hash = fnv1a_offset;
+    while (m_pos != m_end && *m_pos != '"') {
+      if (*m_pos == '\\' && ++m_pos == m_end) return false;
+      hash = (hash ^ static_cast<unsigned char>(*m_pos)) * fnv1a_prime;
+      ++m_pos;
+    }
+    if (m_pos == m_end) return false;
+    key = std::string_view(start, static_cast<size_t>(m_pos - start));
+    ++m_pos;
+    return true;
+  }
+
+  bool read(bool& value) {
+    skip_ws();
+    if (literal("true")) {
+      value = true;
+      return true;
+    }
+    if (literal("false")) {
+      value = false;
+      return true;
+    }
+    return false;
+  }
+
+  template <typename T>
+  std::enable_if_t<std::is_arithmetic<T>::value, bool> read(T& value) {
+    skip_ws();
+    // from_chars() also takes nan, inf and infinity, a JSON number starts
+    // with a digit after the optional minus sign
+    const char* digit = m_pos;
+    if (digit != m_end && *digit == '-') ++digit;
+    if (digit == m_end || *digit < '0' || *digit > '9') return false;
+    T parsed;
+    auto result = std::from_chars(m_pos, m_end, parsed);
+    if (result.ec != std::errc() || !at_delimiter(result.ptr)) return false;
+    m_pos = result.ptr;
+    value = parsed;
+    return true;
+  }
+
+  bool read(std::string& value) {
+    if (!consume('"')) return false;
+    value.clear();
+    while (m_pos != m_end && *m_pos != '"') {
+      // Copy runs without escapes in one go
+      const char* run = m_pos;
+      while (m_pos != m_end && *m_pos != '"' && *m_pos != '\\') ++m_pos;
+      value.append(run, static_cast<size_t>(m_pos - run));
+      if (m_pos != m_end && *m_pos == '\\' && !read_escape(value)) return false;
+    }
+    if (m_pos == m_end) return false;
+    ++m_pos;
+    return true;
+  }
+
+  // Skip any value, objects and arrays are skipped without recursion. Bit n
+  // of open_arrays tells whether the bracket open at depth n is a '['.
+  bool skip_value() {
+    skip_ws();
+    int depth = 0;
+    uint64_t open_arrays = 0;
+    do {
+      if (m_pos == m_end) return false;
+      switch (*m_pos) {
+        case '{':
+        case '[':
+          if (depth == 64) return false;
+          if (*m_pos == '[')
+            open_arrays |= uint64_t(1) << depth;
+          else
+            open_arrays &= ~(uint64_t(1) << depth);
+          depth++;
+          ++m_pos;
+          break;
+        case '}':
+        case ']':
+          if (depth-- == 0) return false;
+          if (((open_arrays >> depth) & 1) != (*m_pos == ']')) return false;
+          ++m_pos;
+          break;
+        case '"':
+          ++m_pos;
+          while (m_pos != m_end && *m_pos != '"')
+            m_pos += (*m_pos == '\\' && m_pos + 1 != m_end) ? 2 : 1;
+          if (m_pos == m_end) return false;
+          ++m_pos;
+          break;
+        case ',':
+        case ':':
+          if (depth == 0) return false;
+          ++m_pos;
+          break;
+        default: {
+          // Number or literal, runs until the next delimiter
+          const char* start = m_pos;
+          while (m_pos != m_end && !at_delimiter(m_pos)) ++m_pos;
+          if (m_pos == start) ++m_pos;
+          break;
+        }
+      }
+      skip_ws();
+    } while (depth != 0);
+    return true;
+  }
+
+ private:
+  bool at_delimiter(const char* p) const {
+    return p == m_end || *p == ',' || *p == '}' || *p == ']' || *p == ' ' ||
+           *p == '\t' || *p == '\n' || *p == '\r';
+  }
+
+  bool literal(std::string_view word) {
+    if (static_cast<size_t>(m_end - m_pos) < word.size() ||
+        std::string_view(m_pos, word.size()) != word ||
+        !at_delimiter(m_pos + word.size()))
+      return false;
+    m_pos += word.size();
+    return true;
+  }
+
+  static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  bool read_hex4(uint32_t& code) {
+    if (m_end - m_pos < 4) return false;
+    code = 0;
+    for (int n = 0; n < 4; n++) {
+      int digit = hex_digit(*m_pos++);
+      if (digit < 0) return false;
+      code = (code << 4) | static_cast<uint32_t>(digit);
+    }
+    return true;
+  }
+
+  // Decode the escape sequence at m_pos (pointing at the backslash)
+  bool read_escape(std::string& value) {
+    if (++m_pos == m_end) return false;
+    char c = *m_pos++;
+    switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        value += c;
+        return true;
+      case 'b':
+        value += '\b';
+        return true;
+      case 'f':
+        value += '\f';
+        return true;
+      case 'n':
+        value += '\n';
+        return true;
+      case 'r':
+        value += '\r';
+        return true;
+      case 't':
+        value += '\t';
+        return true;
+      case 'u':
+        break;
+      default:
+        return false;
+    }
+    uint32_t code;
+    if (!read_hex4(code)) return false;
+    // Surrogate pair
+    if (code >= 0xD800 && code <= 0xDBFF) {
+      uint32_t low;
+      if (m_end - m_pos < 2 || m_pos[0] != '\\' || m_pos[1] != 'u')
+        return false;
+      m_pos += 2;
+      if (!read_hex4(low) || low < 0xDC00 || low > 0xDFFF) return false;
+      code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    }
+    // UTF-8 encode
+    if (code < 0x80) {
+      value += static_cast<char>(code);
+    } else if (code < 0x800) {
+      value += static_cast<char>(0xC0 | (code >> 6));
+      value += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      value += static_cast<char>(0xE0 | (code >> 12));
+      value += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      value += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      value += static_cast<char>(0xF0 | (code >> 18));
+      value += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+      value += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      value += static_cast<char>(0x80 | (code & 0x3F));
+    }
+    return true;
+  }
+
+  const char* m_pos;
+  const char* m_begin;
+  const char* m_end;
+};
+
+template <typename T, std::size_t... Idx>
+constexpr auto schema_names(std::index_sequence<Idx...>) {
+  constexpr auto struct_schema = StructSchema<T>();
+  return std::array<std::string_view, sizeof...(Idx)>{
+      {std::string_view(std::get<NAME>(std::get<Idx>(struct_schema)))...}};
+}
+
+template <typename T>
+bool parse_object(JsonReader& reader, T& obj);
+
+// Parse a JSON value into a field of type F
+template <typename F>
+bool read_value(JsonReader& reader, F& value) {
+  if constexpr (has_struct_schema<F>) {
+    return parse_object(reader, value);
+  } else if constexpr (is_std_vector<F>::value) {
+    value.clear();
+    if (!reader.consume('[')) return false;
+    if (reader.consume(']')) return true;
+    do {
+      if (!read_value(reader, value.emplace_back())) return false;
+    } while (reader.consume(','));
+    return reader.consume(']');
+  } else if constexpr (is_std_array<F>::value) {
+    // Exactly as many elements as the array holds
+    if (!reader.consume('[')) return false;
+    for (std::size_t n = 0; n < value.size(); n++) {
+      if (n != 0 && !reader.consume(',')) return false;
+      if (!read_value(reader, value[n])) return false;
+    }
+    return reader.consume(']');
+  } else {
+    return reader.read(value);
+  }
+}
+
+// Parse the value of the Idx-th field of the schema directly into the field
+template <typename T, std::size_t Idx>
+bool parse_field(JsonReader& reader, T& obj) {
+  constexpr auto struct_schema = StructSchema<T>();
+  auto field_ptr = std::get<FIELD>(std::get<Idx>(struct_schema));
+  return read_value(reader, field_ref(obj, field_ptr));
+}
+
+template <typename T, std::size_t... Idx>
+constexpr auto schema_parsers(std::index_sequence<Idx...>) {
+  return std::array<bool (*)(JsonReader&, T&), sizeof...(Idx)>{
+      {&parse_field<T, Idx>...}};
+}
+
+// Compile-time key table of the Struct field names
+template <typename T>
+struct JsonKeyTable {
+  static constexpr std::size_t count = schema_size<T>;
+  static constexpr auto names =
+      schema_names<T>(std::make_index_sequence<count>{});
+  static constexpr auto parsers =
+      schema_parsers<T>(std::make_index_sequence<count>{});
+
+  // Power of two with at least half of the slots empty
+  static constexpr std::size_t table_size() {
+    std::size_t size = 1;
+    while (size < 2 * count) size <<= 1;
+    return size;
+  }
+  static constexpr std::size_t mask = table_size() - 1;
+
+  struct Table {
+    std::array<uint64_t, table_size()> hashes{};
+    // Field index + 1, zero marks an empty slot
+    std::array<uint32_t, table_size()> fields{};
+  };
+
+  static constexpr Table build() {
+    Table table{};
+    for (std::size_t n = 0; n < count; n++) {
+      uint64_t hash = fnv1a(names[n]);
+      std::size_t pos = hash & mask;
+      while (table.fields[pos] != 0) pos = (pos + 1) & mask;
+      table.hashes[pos] = hash;
+      table.fields[pos] = static_cast<uint32_t>(n + 1);
+    }
+    return table;
+  }
+  static constexpr Table table = build();
+
+  // Field index of the key, -1 if the key is not a field name
+  static int find(std::string_view key, uint64_t hash) {
+    for (std::size_t pos = hash & mask; table.fields[pos] != 0;
+         pos = (pos + 1) & mask) {
+      uint32_t field = table.fields[pos] - 1;
+      if (table.hashes[pos] == hash && names[field] == key)
+        return static_cast<int>(field);
+    }
+    return -1;
+  }
+};
+
+// Parse a JSON object into the fields of obj
+template <typename T>
+bool parse_object(JsonReader& reader, T& obj) {
+  using KeyTable = JsonKeyTable<T>;
+  static_assert(KeyTable::count != 0,
+                "StructSchema<T>() for type T should be specialized to return "
+                "FieldSchema tuples, like: (*ptr, field_name, json_type), "
+                "...).");
+
+  if (!reader.consume('{')) return false;
+  if (reader.consume('}')) return true;
+  do {
+    std::string_view key;
+    uint64_t hash;
+    if (!reader.read_key(key, hash) || !reader.consume(':')) return false;
+    int field = KeyTable::find(key, hash);
+    bool ok = (field >= 0) ? KeyTable::parsers[field](reader, obj)
+                           : reader.skip_value();
+    if (!ok) return false;
+  } while (reader.consume(','));
+  return reader.consume('}');
+}
+
+}  // namespace detail
+
+// Parse the json object into the fields of obj. Returns false on a syntax or
+// type error, error_offset is then set to the position where the parsing
+// stopped.
+template <typename T>
+bool parse_json_config(std::string_view json, T& obj,
+                       size_t* error_offset = nullptr) {
+  detail::JsonReader reader(json);
+  bool ok = detail::parse_object(reader, obj) && reader.at_end();
+  if (!ok && error_offset) *error_offset = reader.offset();
+  return ok;
+}
+
+// Parse the json object into the static fields of the Struct T
+template <typename T>
+bool parse_json_config(std::string_view json, size_t* error_offset = nullptr) {
+  T obj{};
+  return parse_json_config(json, obj, error_offset);
+}
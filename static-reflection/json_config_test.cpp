@@ -0,0 +1,214 @@
+// Test of json_config.h
+//
+// Integral and floating point fields take JSON numbers, the nan, inf and
+// infinity spellings std::from_chars() accepts are not JSON and must be
+// rejected with the error offset at the value. Every field name must be found
+// through the key table and a key must be confirmed by name, not only by
+// hash. Unknown keys are skipped with whatever value they have, nested
+// objects, arrays and vectors are parsed into their fields, a duplicate key
+// overwrites the earlier value, and malformed documents are rejected.
+//
+// Build & run:
+//   g++ -std=c++17 -O2 -o json_config_test json_config_test.cpp
+//   ./json_config_test
+#include <array>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "json_config.h"
+#include "test_util.h"
+
+namespace {
+
+struct Limits {
+  int count;
+  double ratio;
+};
+
+struct Endpoint {
+  std::string host;
+  int port;
+};
+
+// Enough fields for the key table to have colliding slots
+struct Service {
+  std::string name;
+  bool enabled;
+  int port;
+  int ports;
+  Endpoint upstream;
+  std::vector<int> retries;
+  std::array<double, 3> weights;
+  std::vector<std::string> tags;
+  std::vector<Endpoint> replicas;
+};
+
+}  // namespace
+
+DEFINE_STRUCT_SCHEMA(Limits, DEFINE_STRUCT_FIELD(count, "number"),
+                     DEFINE_STRUCT_FIELD(ratio, "number"));
+
+DEFINE_STRUCT_SCHEMA(Endpoint, DEFINE_STRUCT_FIELD(host, "string"),
+                     DEFINE_STRUCT_FIELD(port, "number"));
+
+DEFINE_STRUCT_SCHEMA(Service, DEFINE_STRUCT_FIELD(name, "string"),
+                     DEFINE_STRUCT_FIELD(enabled, "bool"),
+                     DEFINE_STRUCT_FIELD(port, "number"),
+                     DEFINE_STRUCT_FIELD(ports, "number"),
+                     DEFINE_STRUCT_FIELD(upstream, "object"),
+                     DEFINE_STRUCT_FIELD(retries, "array"),
+                     DEFINE_STRUCT_FIELD(weights, "array"),
+                     DEFINE_STRUCT_FIELD(tags, "array"),
+                     DEFINE_STRUCT_FIELD(replicas, "array"));
+
+namespace {
+
+void test_numbers() {
+  Limits limits = {};
+  CHECK(parse_json_config(R"({"count": -12, "ratio": -1.5e3})", limits));
+  CHECK(limits.count == -12 && limits.ratio == -1500);
+  CHECK(parse_json_config(R"({"ratio": 0.25})", limits));
+  CHECK(limits.ratio == 0.25);
+}
+
+void test_not_json_numbers() {
+  for (const char* value : {"nan", "NaN", "-nan", "inf", "-inf", "infinity",
+                            "Infinity", "+1", ".5"}) {
+    std::string json = std::string(R"({"ratio": )") + value + "}";
+    Limits limits = {0, 2};
+    size_t error_offset = 0;
+    CHECK(!parse_json_config(json, limits, &error_offset));
+    CHECK(error_offset == json.find(value));
+    CHECK(limits.ratio == 2);
+  }
+  Limits limits = {};
+  CHECK(!parse_json_config(R"({"count": inf})", limits));
+}
+
+void test_key_table() {
+  using KeyTable = detail::JsonKeyTable<Service>;
+  for (std::size_t n = 0; n < KeyTable::count; n++) {
+    std::string_view name = KeyTable::names[n];
+    CHECK(KeyTable::find(name, detail::fnv1a(name)) == static_cast<int>(n));
+  }
+  // A matching hash alone is not a match
+  CHECK(KeyTable::find("bogus", detail::fnv1a("port")) == -1);
+  CHECK(KeyTable::find("por", detail::fnv1a("por")) == -1);
+  CHECK(KeyTable::find("portss", detail::fnv1a("portss")) == -1);
+
+  Service service = {};
+  CHECK(parse_json_config(R"({"ports": 2, "port": 1})", service));
+  CHECK(service.port == 1 && service.ports == 2);
+  // Keys with escapes never match, even when they decode to a field name
+  CHECK(parse_json_config(R"({"p\u006frt": 5})", service));
+  CHECK(service.port == 1);
+}
+
+void test_unknown_keys() {
+  Service service = {};
+  CHECK(parse_json_config(R"({"extra": {"a": [1, {"b": "}]"}], "c": null},
+                              "name": "api",
+                              "list": [[], [[1, 2]], "x\"]"],
+                              "flag": false, "n": -1.5e3,
+                              "port": 80})",
+                          service));
+  CHECK(service.name == "api");
+  CHECK(service.port == 80);
+
+  // Skipped values may nest 64 levels deep
+  std::string deep = std::string(64, '[') + std::string(64, ']');
+  CHECK(parse_json_config(R"({"deep": )" + deep + "}", service));
+  deep = std::string(65, '[') + std::string(65, ']');
+  CHECK(!parse_json_config(R"({"deep": )" + deep + "}", service));
+}
+
+void test_nested_and_arrays() {
+  Service service = {};
+  service.retries = {9, 9, 9, 9};
+  CHECK(parse_json_config(R"({
+      "name": "svc\t\u00e9",
+      "enabled": true,
+      "upstream": {"host": "db", "port": 5432},
+      "retries": [1, 2, 3],
+      "weights": [0.5, 0.25, 0.25],
+      "tags": ["a", "b"],
+      "replicas": [{"host": "r1", "port": 1}, {"port": 2, "host": "r2"}]
+    })",
+                          service));
+  CHECK(service.name == "svc\t\xc3\xa9");
+  CHECK(service.enabled);
+  CHECK(service.upstream.host == "db" && service.upstream.port == 5432);
+  CHECK((service.retries == std::vector<int>{1, 2, 3}));
+  CHECK((service.weights == std::array<double, 3>{0.5, 0.25, 0.25}));
+  CHECK((service.tags == std::vector<std::string>{"a", "b"}));
+  CHECK(service.replicas.size() == 2 && service.replicas[0].host == "r1" &&
+        service.replicas[1].port == 2 && service.replicas[1].host == "r2");
+
+  // A vector is replaced, not appended to
+  CHECK(parse_json_config(R"({"retries": [], "tags": []})", service));
+  CHECK(service.retries.empty() && service.tags.empty());
+  // A nested object only updates the fields it names
+  CHECK(parse_json_config(R"({"upstream": {"port": 6432}})", service));
+  CHECK(service.upstream.host == "db" && service.upstream.port == 6432);
+
+  // A std::array takes exactly its number of elements
+  CHECK(!parse_json_config(R"({"weights": [1, 2]})", service));
+  CHECK(!parse_json_config(R"({"weights": [1, 2, 3, 4]})", service));
+}
+
+void test_duplicate_keys() {
+  Service service = {};
+  CHECK(parse_json_config(
+      R"({"port": 1, "upstream": {"port": 2}, "port": 3, "upstream":
+          {"host": "h"}})",
+      service));
+  CHECK(service.port == 3);
+  CHECK(service.upstream.port == 2 && service.upstream.host == "h");
+}
+
+void test_malformed() {
+  for (const char* json : {
+           "",
+           "[]",
+           R"({"port" 1})",
+           R"({"port": 1,})",
+           R"({"port": 1)",
+           R"({"port": 1} x)",
+           R"({"port": 1}})",
+           R"({port: 1})",
+           R"({"name": "unterminated})",
+           R"({"name": "bad \q escape"})",
+           R"({"name": 1})",
+           R"({"port": "1"})",
+           R"({"port": 1.5})",
+           R"({"enabled": tru})",
+           R"({"enabled": 1})",
+           R"({"retries": [1, 2,]})",
+           R"({"retries": [1 2]})",
+           R"({"upstream": [1]})",
+           R"({"extra": [1, 2})",
+           R"({"extra": {"a": 1]})",
+           R"({"extra": })",
+       }) {
+    Service service = {};
+    size_t error_offset = ~size_t(0);
+    bool ok = parse_json_config(json, service, &error_offset);
+    CHECK(!ok);
+    CHECK(error_offset <= std::string_view(json).size());
+    if (ok) fprintf(stderr, "accepted: %s\n", json);
+  }
+}
+
+}  // namespace
+
+int main() {
+  test_numbers();
+  test_not_json_numbers();
+  test_key_table();
+  test_unknown_keys();
+  test_nested_and_arrays();
+  test_duplicate_keys();
+  test_malformed();
+  return test_result();
+}
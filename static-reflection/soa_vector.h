@@ -0,0 +1,152 @@
+// 1). soa_vector<T> is a structure-of-arrays container generated from the
+// StructSchema of T (see static_reflection.h). Every reflected non-static
+// field of T is stored in its own contiguous std::vector column, so a scan
+// over one field of millions of records only touches the memory of that field
+// and the loop can be vectorized by the compiler.
+//
+// 2). Records are added and read back as whole T values (push_back(), get(),
+// set()), columns are accessed by schema index or by member pointer. Fields
+// of T that are not in the schema are not stored.
+//
+// 3). bool fields are stored in std::vector<bool>, which is bit packed and has
+// no data() pointer, reflect them as uint8_t if raw column access is needed.
+//
+// Usage example:
+//
+// struct Trade {
+//    double price;
+//    uint32_t qty;
+// };
+// DEFINE_STRUCT_SCHEMA(Trade, DEFINE_STRUCT_FIELD(price, "number"),
+//                      DEFINE_STRUCT_FIELD(qty, "number"));
+//
+// soa_vector<Trade> trades;
+// trades.push_back({101.5, 10});
+// double sum = 0;
+// for (double price : trades.column<&Trade::price>()) sum += price;
+
+#pragma once
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "static_reflection.h"
+
+namespace detail {
+
+template <typename T, typename Indices>
+struct soa_columns;
+
+template <typename T, std::size_t... Idx>
+struct soa_columns<T, std::index_sequence<Idx...>> {
+  using type = std::tuple<std::vector<schema_field_t<decltype(std::get<FIELD>(
+      std::get<Idx>(StructSchema<T>())))>>...>;
+};
+
+}  // namespace detail
+
+template <typename T>
+class soa_vector {
+  static constexpr std::size_t field_count = schema_size<T>;
+  using Indices = std::make_index_sequence<field_count>;
+
+  static_assert(field_count != 0,
+                "StructSchema<T>() for type T should be specialized to return "
+                "FieldSchema tuples, like: (*ptr, field_name, json_type), "
+                "...).");
+  static_assert(detail::all_member_fields<T>(Indices{}),
+                "soa_vector<T> needs a schema of non-static data members.");
+
+ public:
+  using value_type = T;
+  using columns_type = typename detail::soa_columns<T, Indices>::type;
+
+  std::size_t size() const { return std::get<0>(m_columns).size(); }
+  bool empty() const { return size() == 0; }
+
+  void reserve(std::size_t n) {
+    for_each_column([n](auto& column) { column.reserve(n); });
+  }
+  void resize(std::size_t n) {
+    for_each_column([n](auto& column) { column.resize(n); });
+  }
+  void clear() {
+    for_each_column([](auto& column) { column.clear(); });
+  }
+
+  void push_back(const T& value) { push_back(value, Indices{}); }
+  void pop_back() {
+    for_each_column([](auto& column) { column.pop_back(); });
+  }
+
+  // Gather the record at index from the columns
+  T get(std::size_t index) const { return get(index, Indices{}); }
+  T operator[](std::size_t index) const { return get(index); }
+
+  // Scatter value into the columns at index
+  void set(std::size_t index, const T& value) {
+    set(index, value, Indices{});
+  }
+
+  // Column of the Idx-th field of the schema
+  template <std::size_t Idx>
+  auto& column() {
+    return std::get<Idx>(m_columns);
+  }
+  template <std::size_t Idx>
+  const auto& column() const {
+    return std::get<Idx>(m_columns);
+  }
+
+  // Column of the field Member, e.g. column<&Trade::price>()
+  template <auto Member, typename = std::enable_if_t<
+                             std::is_member_object_pointer<
+                                 decltype(Member)>::value>>
+  auto& column() {
+    return std::get<member_index<Member>()>(m_columns);
+  }
+  template <auto Member, typename = std::enable_if_t<
+                             std::is_member_object_pointer<
+                                 decltype(Member)>::value>>
+  const auto& column() const {
+    return std::get<member_index<Member>()>(m_columns);
+  }
+
+ private:
+  template <auto Member>
+  static constexpr std::size_t member_index() {
+    return schema_index<Member, T>();
+  }
+
+  template <std::size_t Idx>
+  static constexpr auto field_ptr() {
+    return std::get<FIELD>(std::get<Idx>(StructSchema<T>()));
+  }
+
+  template <typename Fn>
+  void for_each_column(Fn&& fn) {
+    std::apply([&fn](auto&... column) { (fn(column), ...); }, m_columns);
+  }
+
+  template <std::size_t... Idx>
+  void push_back(const T& value, std::index_sequence<Idx...>) {
+    (std::get<Idx>(m_columns).push_back(value.*field_ptr<Idx>()), ...);
+  }
+
+  template <std::size_t... Idx>
+  T get(std::size_t index, std::index_sequence<Idx...>) const {
+    T value{};
+    ((value.*field_ptr<Idx>() = std::get<Idx>(m_columns)[index]), ...);
+    return value;
+  }
+
+  template <std::size_t... Idx>
+  void set(std::size_t index, const T& value, std::index_sequence<Idx...>) {
+    ((std::get<Idx>(m_columns)[index] = value.*field_ptr<Idx>()), ...);
+  }
+
+  columns_type m_columns;
+};
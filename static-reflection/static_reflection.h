@@ -1,7 +1,8 @@
 // 1). This implementation of static reflection is meant to provide ease
 // in iteration over *static fields of a Structure that will be initialized
-// from a json config file. (For non-static members there will be a different
-// static_assert on the pointer type std::false_type vs std::true_type)
+// from a json config file. Non-static data members are reflected the same
+// way, DEFINE_STRUCT_FIELD() then stores a pointer to member and
+// for_each_field() accesses the field of the object it is given.
 //
 // WANR: New variables have to declared between FIRST_LINE and LAST_LINE and
 // not span on more than single line. (no comments in between the lines)
@@ -20,9 +21,19 @@
 // bool SampleStruct::my_bool = true;
 // int SampleStruct::my_int = 123;
 //
-// 2). The PARAMETERS_COUNT field must be present for static_assert in the
-// DEFINE_STRUCT_SCHEMA() macro that assures the correct number of parameters
-// is reflected by that macro
+// 2). The PARAMETERS_COUNT field, when present, is used by static_assert in
+// the DEFINE_STRUCT_SCHEMA() macro that assures the correct number of
+// parameters is reflected by that macro. It is required for static Structs
+// and optional for Structs with non-static members:
+//
+// struct Point {
+//    double x;
+//    double y;
+//    std::vector<int> tags;
+// };
+// DEFINE_STRUCT_SCHEMA(Point, DEFINE_STRUCT_FIELD(x, "number"),
+//                      DEFINE_STRUCT_FIELD(y, "number"),
+//                      DEFINE_STRUCT_FIELD(tags, "array"));
 //
 // 3). The StructSchema has to be defined with the macros:
 // DEFINE_STRUCT_SCHEMA(SampleStruct,
@@ -35,11 +46,21 @@
 //                { std::cout << name << " = " << field << " : " << json_type
 //                            << std::endl;
 //                });
+//
+// 5). A field can itself be a Struct with a StructSchema (nested Struct),
+// has_struct_schema<F> tells such fields apart so the lambda can recurse
+// with for_each_field(field, ...). std::array and std::vector fields are
+// passed to the lambda as they are.
 
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <string_view>
 #include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 // Enum representing consecutive elements of the StructSchema single tuple
 enum StructSchemaElem {
@@ -68,6 +89,77 @@ inline constexpr void for_each_tuple(Tuple&& tuple, Fn&& fn) {
       std::make_index_sequence<std::tuple_size<std::decay_t<Tuple>>::value>{});
 }
 
+// FNV-1a hash used to identify field names and schemas at compile time
+constexpr uint64_t fnv1a_offset = 14695981039346656037ULL;
+constexpr uint64_t fnv1a_prime = 1099511628211ULL;
+
+constexpr uint64_t fnv1a(std::string_view str,
+                         uint64_t hash = fnv1a_offset) {
+  for (char c : str)
+    hash = (hash ^ static_cast<unsigned char>(c)) * fnv1a_prime;
+  return hash;
+}
+
+// Type of the field behind a pointer to static or non-static member
+template <typename FieldPtr>
+struct schema_field {
+  using type = std::remove_pointer_t<FieldPtr>;
+};
+
+template <typename Field, typename Struct>
+struct schema_field<Field Struct::*> {
+  using type = Field;
+};
+
+template <typename FieldPtr>
+using schema_field_t = typename schema_field<std::decay_t<FieldPtr>>::type;
+
+// Reference to the field of obj, obj is ignored for static fields
+template <typename T, typename FieldPtr>
+inline constexpr decltype(auto) field_ref(T&& obj, FieldPtr ptr) {
+  if constexpr (std::is_member_object_pointer<FieldPtr>::value) {
+    return (std::forward<T>(obj).*ptr);
+  } else {
+    (void)obj;
+    return (*ptr);
+  }
+}
+
+template <typename T, typename = void>
+struct has_parameters_count : std::false_type {};
+
+template <typename T>
+struct has_parameters_count<T, std::void_t<decltype(T::PARAMETERS_COUNT)>>
+    : std::true_type {};
+
+template <typename T>
+inline constexpr bool parameters_count_matches(std::size_t count) {
+  if constexpr (has_parameters_count<T>::value)
+    return T::PARAMETERS_COUNT == count;
+  else
+    return true;
+}
+
+template <typename MemberPtr>
+struct member_pointer_class {};
+
+template <typename Field, typename Struct>
+struct member_pointer_class<Field Struct::*> {
+  using type = Struct;
+};
+
+template <typename T>
+struct is_std_vector : std::false_type {};
+
+template <typename T, typename Alloc>
+struct is_std_vector<std::vector<T, Alloc>> : std::true_type {};
+
+template <typename T>
+struct is_std_array : std::false_type {};
+
+template <typename T, std::size_t N>
+struct is_std_array<std::array<T, N>> : std::true_type {};
+
 }  // namespace detail
 
 // This function template with explicit template arguments has to be declared
@@ -91,20 +183,75 @@ inline constexpr auto StructSchema() {
 //
 // The returned tuple is:
 // ((& field1, name1, json_type1), (& field2, name2, json_type2), ...)
-#define DEFINE_STRUCT_SCHEMA(Struct, ...)                                   \
-  template <>                                                               \
-  inline constexpr auto StructSchema<Struct>() {                            \
-    using _Struct = Struct;                                                 \
-                                                                            \
-    static_assert(                                                          \
-        Struct::PARAMETERS_COUNT ==                                         \
-            std::tuple_size<decltype(std::make_tuple(__VA_ARGS__))>::value, \
-        "The number of declared parameters in the struct "                  \
-        "differs from defined reflective schema.");                         \
-                                                                            \
-    return std::make_tuple(__VA_ARGS__);                                    \
+#define DEFINE_STRUCT_SCHEMA(Struct, ...)                                     \
+  template <>                                                                 \
+  inline constexpr auto StructSchema<Struct>() {                              \
+    using _Struct = Struct;                                                   \
+                                                                              \
+    static_assert(                                                            \
+        detail::parameters_count_matches<Struct>(                             \
+            std::tuple_size<decltype(std::make_tuple(__VA_ARGS__))>::value),  \
+        "The number of declared parameters in the struct "                    \
+        "differs from defined reflective schema.");                           \
+                                                                              \
+    return std::make_tuple(__VA_ARGS__);                                      \
   }
 
+// True for Structs with a StructSchema specialization
+template <typename T>
+inline constexpr bool has_struct_schema =
+    std::tuple_size<decltype(StructSchema<T>())>::value != 0;
+
+// Number of fields in the StructSchema of T
+template <typename T>
+inline constexpr std::size_t schema_size =
+    std::tuple_size<decltype(StructSchema<T>())>::value;
+
+namespace detail {
+
+template <typename A, typename B>
+inline constexpr bool same_field_ptr(A a, B b) {
+  if constexpr (std::is_same<A, B>::value)
+    return a == b;
+  else
+    return false;
+}
+
+// Schema index of the member pointer, the field count if it is not reflected
+template <typename T, auto Member, std::size_t... Idx>
+inline constexpr std::size_t schema_index(std::index_sequence<Idx...>) {
+  constexpr auto struct_schema = StructSchema<T>();
+  std::size_t index = sizeof...(Idx);
+  using Expander = int[];
+  (void)Expander{
+      0, ((void)(same_field_ptr(std::get<FIELD>(std::get<Idx>(struct_schema)),
+                                Member) &&
+                 (index = Idx)),
+          0)...};
+  return index;
+}
+
+template <typename T, std::size_t... Idx>
+inline constexpr bool all_member_fields(std::index_sequence<Idx...>) {
+  return (true && ... &&
+          std::is_member_object_pointer<std::decay_t<decltype(std::get<FIELD>(
+              std::get<Idx>(StructSchema<T>())))>>::value);
+}
+
+}  // namespace detail
+
+// Schema index of the field behind the member pointer Member, e.g.
+// schema_index<&Point::y>() == 1. Fails to compile if it is not reflected.
+template <auto Member, typename T = typename detail::member_pointer_class<
+                           decltype(Member)>::type>
+inline constexpr std::size_t schema_index() {
+  constexpr std::size_t index = detail::schema_index<T, Member>(
+      std::make_index_sequence<schema_size<T>>{});
+  static_assert(index < schema_size<T>,
+                "Member is not a field of the StructSchema<T>().");
+  return index;
+}
+
 // Macro for defining each field of the desired Struct
 #define DEFINE_STRUCT_FIELD(struct_field, json_type) \
   std::make_tuple(&_Struct::struct_field, #struct_field, json_type)
@@ -115,9 +262,9 @@ inline constexpr auto StructSchema() {
 // This function takes the corresponding StructSchema<StructType> record of all
 // the fields information and then traverses the elements of the tuple to get
 // the location, name, json_type of each field and call the conversion function
-// as a parameter fn
+// as a parameter fn. Non-static fields are those of the obj.
 template <typename T, typename Fn>
-inline constexpr void for_each_field(T&&, Fn&& fn) {
+inline constexpr void for_each_field(T&& obj, Fn&& fn) {
   // Computed at compile time Struct schema used for
   constexpr auto struct_schema = StructSchema<std::decay_t<T>>();
 
@@ -128,14 +275,15 @@ inline constexpr void for_each_field(T&&, Fn&& fn) {
       "StructSchema<T>() for type T should be specialized to return "
       "FieldSchema tuples, like: (*ptr, field_name, json_type), ...).");
 
-  detail::for_each_tuple(struct_schema, [&fn](auto&& field_schema) {
+  detail::for_each_tuple(struct_schema, [&obj, &fn](auto&& field_schema) {
     using FieldSchema = std::decay_t<decltype(field_schema)>;
     // Assertion makes sure that all the tuples consist of three fields
     static_assert(std::tuple_size<FieldSchema>::value == 3,
                   "FieldSchema tuple should be a tuple of three elements.");
 
     // Call the conversion function on each tuple
-    fn(*std::get<FIELD>(std::forward<decltype(field_schema)>(field_schema)),
+    fn(detail::field_ref(std::forward<T>(obj),
+                         std::get<FIELD>(field_schema)),
        std::get<NAME>(std::forward<decltype(field_schema)>(field_schema)),
        std::get<JSON_TYPE>(std::forward<decltype(field_schema)>(field_schema)));
   });